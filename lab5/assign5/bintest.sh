@@ -0,0 +1,129 @@
+#!/bin/bash
+
+# Checks the binary protocol: values with spaces through ./client -b, and
+# raw frames pipelined with a text command in one write.
+# Run it where ./server and ./client were built; it starts the server in
+# each I/O mode.
+
+# Default port number
+PORT=8080
+# I/O modes of the server: blocking, epoll (-e) and io_uring (-u)
+MODES=("" "-e" "-u")
+
+# Parse arguments for port number and server options (optional)
+while getopts "p:o:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        o) MODES=("$OPTARG") ;;
+        *) echo "Usage: $0 [-p port] [-o server_options]"; exit 1 ;;
+    esac
+done
+
+# Initialize output directory
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR  # Delete the directory if it exists
+fi
+mkdir -p $OUTPUT_DIR    # Create a new directory
+
+# Client: text lines sent as frames, the value is the rest of the line
+CLIENT_REQUESTS=(
+    "CREATE bin1 hello binary world"
+    "READ bin1"
+    "CREATE bin1 again"
+    "UPDATE bin1 a  b  c"
+    "READ bin1"
+    "DELETE bin1"
+    "READ bin1"
+)
+CLIENT_RESPONSES=(
+    "CREATE OK"
+    "hello binary world"
+    "COLLISION"
+    "UPDATE OK"
+    "a  b  c"
+    "DELETE OK"
+    "NOT FOUND"
+)
+
+# Raw: frames around a text command, in one write. A header is magic, op,
+# klen (2 bytes), vlen (4 bytes) and id (4 bytes), in network byte order.
+RAW="\xb5\x00\x00\x03\x00\x00\x00\x03\x00\x00\x00\x01rawv 1"
+RAW+="\xb5\x01\x00\x03\x00\x00\x00\x00\x00\x00\x00\x02raw"
+RAW+="READ raw\n"
+RAW+="\xb5\x03\x00\x03\x00\x00\x00\x00\x00\x00\x00\x03raw"
+RAW+="\xb5\x01\x00\x03\x00\x00\x00\x00\x00\x00\x00\x04raw"
+# CREATE OK, the value of raw, the text answer, DELETE OK and NOT FOUND
+RAW_RESPONSE="b5 01 00 00 00 00 00 00 00 00 00 01"
+RAW_RESPONSE+=" b5 80 00 00 00 00 00 03 00 00 00 02 76 20 31"
+RAW_RESPONSE+=" 76 20 31 0a"
+RAW_RESPONSE+=" b5 05 00 00 00 00 00 00 00 00 00 03"
+RAW_RESPONSE+=" b5 03 00 00 00 00 00 00 00 00 00 04"
+RAW_BYTES=55
+
+# Function to start the server with the given options and wait for it
+start_server() {
+    ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: server did not start with '$*'\033[0m"
+    return 1
+}
+
+stop_server() {
+    kill $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+}
+
+# Function to compare a response file with the expected responses in order
+check_responses() {
+    local file=$1
+    shift
+    local expected
+    expected=$(printf "%s\n" "$@")
+    if [[ "$(cat "$file")" != "$expected" ]]; then
+        echo -e "\033[31mError: responses in $file differ from the expected ones\033[0m"
+        diff <(echo "$expected") "$file"
+        return 1
+    fi
+    return 0
+}
+
+echo "=== Starting Requests and Responses ==="
+
+for mode in "${MODES[@]}"; do
+    echo "Server mode: '${mode:-blocking}'"
+    start_server $mode || exit 1
+    out="$OUTPUT_DIR/mode${mode}"
+
+    # The client prints a banner before the replies and a line after them
+    printf "%s\n" "${CLIENT_REQUESTS[@]}" |
+        timeout 5 ./client -p $PORT -b |
+        sed -n "2,$((${#CLIENT_REQUESTS[@]} + 1))p" > "$out.client.log"
+
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf "$RAW" >&3
+    timeout 2 head -c $RAW_BYTES <&3 | od -An -v -tx1 |
+        tr -s ' \n' ' ' | sed 's/^ //; s/ $//' > "$out.raw.log"
+    exec 3<&-
+    stop_server
+
+    echo "=== Verifying Responses ==="
+    check_responses "$out.client.log" "${CLIENT_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: client -b in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    check_responses "$out.raw.log" "$RAW_RESPONSE" || {
+        echo -e "\033[31mTest Failed: raw frames in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    echo "Responses in mode '${mode:-blocking}' verified successfully."
+done
+
+echo -e "\033[32mTest Passed: All conditions satisfied.\033[0m"
+exit 0
@@ -0,0 +1,123 @@
+#!/bin/bash
+
+# Checks that pipelined and split commands are answered in order.
+# Run it where ./server was built; it starts the server in each I/O mode.
+
+# Default port number
+PORT=8080
+# I/O modes of the server: blocking, epoll (-e) and io_uring (-u)
+MODES=("" "-e" "-u")
+
+# Parse arguments for port number and server options (optional)
+while getopts "p:o:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        o) MODES=("$OPTARG") ;;
+        *) echo "Usage: $0 [-p port] [-o server_options]"; exit 1 ;;
+    esac
+done
+
+# Initialize output directory
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR  # Delete the directory if it exists
+fi
+mkdir -p $OUTPUT_DIR    # Create a new directory
+
+# Pipelined: every command in one write
+PIPELINED="CREATE pipe1 a\nCREATE pipe2 b\nREAD pipe1\nREAD pipe2\nUPDATE pipe1 c\nREAD pipe1\nDELETE pipe2\nREAD pipe2\n"
+PIPELINED_RESPONSES=(
+    "CREATE OK"
+    "CREATE OK"
+    "a"
+    "b"
+    "UPDATE OK"
+    "c"
+    "DELETE OK"
+    "NOT FOUND"
+)
+# Split: commands cut at arbitrary points, one write per piece
+SPLIT=("CRE" "ATE split x" "yz\nRE" "AD split\nREAD pipe1\n")
+SPLIT_RESPONSES=(
+    "CREATE OK"
+    "xyz"
+    "c"
+)
+
+# Function to start the server with the given options and wait for it
+start_server() {
+    ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: server did not start with '$*'\033[0m"
+    return 1
+}
+
+stop_server() {
+    kill $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+}
+
+# Function to read n responses from fd 3 into a file
+read_responses() {
+    local n=$1 file=$2 line
+    : > "$file"
+    for ((j = 0; j < n; j++)); do
+        read -t 2 -r line <&3 || break
+        echo "$line" >> "$file"
+    done
+}
+
+# Function to compare a response file with the expected responses in order
+check_responses() {
+    local file=$1
+    shift
+    local expected
+    expected=$(printf "%s\n" "$@")
+    if [[ "$(cat "$file")" != "$expected" ]]; then
+        echo -e "\033[31mError: responses in $file differ from the expected ones\033[0m"
+        diff <(echo "$expected") "$file"
+        return 1
+    fi
+    return 0
+}
+
+echo "=== Starting Requests and Responses ==="
+
+for mode in "${MODES[@]}"; do
+    echo "Server mode: '${mode:-blocking}'"
+    start_server $mode || exit 1
+    out="$OUTPUT_DIR/mode${mode}"
+
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf "$PIPELINED" >&3
+    read_responses ${#PIPELINED_RESPONSES[@]} "$out.pipelined.log"
+
+    for piece in "${SPLIT[@]}"; do
+        printf "$piece" >&3
+        sleep 0.2
+    done
+    read_responses ${#SPLIT_RESPONSES[@]} "$out.split.log"
+
+    exec 3<&-
+    stop_server
+
+    echo "=== Verifying Responses ==="
+    check_responses "$out.pipelined.log" "${PIPELINED_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: pipelined commands in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    check_responses "$out.split.log" "${SPLIT_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: split commands in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    echo "Responses in mode '${mode:-blocking}' verified successfully."
+done
+
+echo -e "\033[32mTest Passed: All conditions satisfied.\033[0m"
+exit 0
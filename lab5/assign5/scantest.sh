@@ -0,0 +1,125 @@
+#!/bin/bash
+
+# Checks that SCAN returns every key while another client grows the table:
+# the keys created before the scan must all be returned at least once.
+# Run it where ./server was built; it starts the server in each I/O mode,
+# with each engine.
+
+# Default port number
+PORT=8080
+# I/O modes of the server: blocking, epoll (-e) and io_uring (-u)
+MODES=("" "-e" "-u")
+# Table engines: chaining and open addressing (-o)
+ENGINES=("" "-o")
+
+# Parse arguments for port number and server options (optional)
+while getopts "p:o:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        o) MODES=("$OPTARG") ;;
+        *) echo "Usage: $0 [-p port] [-o server_options]"; exit 1 ;;
+    esac
+done
+
+# Initialize output directory
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR  # Delete the directory if it exists
+fi
+mkdir -p $OUTPUT_DIR    # Create a new directory
+
+# Keys present for the whole scan, and keys created while it runs. The
+# table starts with 16 buckets, so it doubles many times meanwhile.
+NUM_KEYS=2000
+NUM_GROW=20000
+HASH_SIZE=16
+# Buckets per SCAN call
+SCAN_COUNT=16
+
+# Function to start the server with the given options and wait for it
+start_server() {
+    ./server -p $PORT "$@" >> "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: server did not start with '$*'\033[0m"
+    return 1
+}
+
+# Function to stop the server. io_uring closes the listening socket a
+# little later, so wait until the port is free.
+stop_server() {
+    kill $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    for _ in $(seq 50); do
+        if ! (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+}
+
+# Function to create keys prefix0 .. prefix(n-1) in one write, discarding
+# the responses
+create_keys() {
+    local prefix=$1 n=$2
+    exec 4<>/dev/tcp/127.0.0.1/$PORT
+    seq 0 $((n - 1)) | sed "s/.*/CREATE $prefix& v/" >&4
+    timeout 30 head -n $n <&4 > /dev/null
+    exec 4<&-
+}
+
+# Function to scan the whole table, writing every key returned to a file
+scan_keys() {
+    local file=$1 cursor=0 n key
+    : > "$file"
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    while :; do
+        printf "SCAN $cursor $SCAN_COUNT\n" >&3
+        read -t 5 -r cursor n <&3 || break
+        for ((k = 0; k < n; k++)); do
+            read -t 5 -r key <&3 || break
+            echo "$key" >> "$file"
+        done
+        if [[ $cursor == 0 ]]; then
+            break
+        fi
+    done
+    exec 3<&-
+}
+
+echo "=== Starting Requests and Responses ==="
+
+seq 0 $((NUM_KEYS - 1)) | sed "s/^/scan/" | sort > "$OUTPUT_DIR/expected.log"
+for mode in "${MODES[@]}"; do
+    for engine in "${ENGINES[@]}"; do
+        name="${mode:-blocking}${engine:+ $engine}"
+        echo "Server mode: '$name'"
+        out="$OUTPUT_DIR/mode${mode}${engine}"
+        start_server -s $HASH_SIZE $mode $engine || exit 1
+
+        create_keys scan $NUM_KEYS
+        create_keys grow $NUM_GROW &
+        GROW_PID=$!
+        scan_keys "$out.scan.log"
+        wait $GROW_PID
+        stop_server
+
+        echo "=== Verifying Responses ==="
+        missing=$(grep "^scan" "$out.scan.log" | sort -u |
+                  comm -23 "$OUTPUT_DIR/expected.log" - | wc -l)
+        if [[ $missing -ne 0 ]]; then
+            echo -e "\033[31mError: SCAN missed $missing of $NUM_KEYS keys\033[0m"
+            echo -e "\033[31mTest Failed: SCAN during growth in mode '$name'\033[0m"
+            exit 1
+        fi
+        echo "Responses in mode '$name' verified successfully."
+    done
+done
+
+echo -e "\033[32mTest Passed: All conditions satisfied.\033[0m"
+exit 0
@@ -0,0 +1,154 @@
+#!/bin/bash
+
+# Checks that a snapshot is reloaded: the writes before a SNAPSHOT survive
+# kill -9 and a restart, and the writes after it are not in the file.
+# Run it where ./server was built; it starts the server in each I/O mode.
+
+# Default port number
+PORT=8080
+# I/O modes of the server: blocking, epoll (-e) and io_uring (-u)
+MODES=("" "-e" "-u")
+
+# Parse arguments for port number and server options (optional)
+while getopts "p:o:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        o) MODES=("$OPTARG") ;;
+        *) echo "Usage: $0 [-p port] [-o server_options]"; exit 1 ;;
+    esac
+done
+
+# Initialize output directory
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR  # Delete the directory if it exists
+fi
+mkdir -p $OUTPUT_DIR    # Create a new directory
+SNAP="$OUTPUT_DIR/snap.db"
+
+# Before the kill: writes, a snapshot of them, and one write after it
+WRITES="CREATE snap1 a\nCREATE snap2 b\nUPDATE snap1 c\nCREATE snap3 d\nDELETE snap3\nSNAPSHOT\n"
+WRITES_RESPONSES=(
+    "CREATE OK"
+    "CREATE OK"
+    "UPDATE OK"
+    "CREATE OK"
+    "DELETE OK"
+    "SNAPSHOT OK"
+)
+LATE="CREATE snap4 e\n"
+LATE_RESPONSES=(
+    "CREATE OK"
+)
+# After the restart: the table as the snapshot saw it
+RELOAD="READ snap1\nREAD snap2\nREAD snap3\nREAD snap4\n"
+RELOAD_RESPONSES=(
+    "c"
+    "b"
+    "NOT FOUND"
+    "NOT FOUND"
+)
+
+# Function to start the server with the given options and wait for it
+start_server() {
+    ./server -p $PORT "$@" >> "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: server did not start with '$*'\033[0m"
+    return 1
+}
+
+# Function to kill the server without letting it shut down. io_uring
+# closes the listening socket of a killed process a little later, so
+# wait until the port is free.
+crash_server() {
+    kill -9 $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    for _ in $(seq 50); do
+        if ! (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+}
+
+# Function to send commands in one write and read n responses into a file
+request() {
+    local cmds=$1 n=$2 file=$3 line
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf "$cmds" >&3
+    : > "$file"
+    for ((j = 0; j < n; j++)); do
+        read -t 2 -r line <&3 || break
+        echo "$line" >> "$file"
+    done
+    exec 3<&-
+}
+
+# Function to wait until the server has written the snapshot. It is
+# renamed into place once complete, so its existence is enough.
+wait_snapshot() {
+    for _ in $(seq 50); do
+        if [[ -f $SNAP ]]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: no snapshot was written\033[0m"
+    return 1
+}
+
+# Function to compare a response file with the expected responses in order
+check_responses() {
+    local file=$1
+    shift
+    local expected
+    expected=$(printf "%s\n" "$@")
+    if [[ "$(cat "$file")" != "$expected" ]]; then
+        echo -e "\033[31mError: responses in $file differ from the expected ones\033[0m"
+        diff <(echo "$expected") "$file"
+        return 1
+    fi
+    return 0
+}
+
+echo "=== Starting Requests and Responses ==="
+
+for mode in "${MODES[@]}"; do
+    echo "Server mode: '${mode:-blocking}'"
+    out="$OUTPUT_DIR/mode${mode}"
+    rm -f "$SNAP"
+
+    start_server -c "$SNAP" $mode || exit 1
+    request "$WRITES" ${#WRITES_RESPONSES[@]} "$out.writes.log"
+    wait_snapshot || exit 1
+    request "$LATE" ${#LATE_RESPONSES[@]} "$out.late.log"
+    crash_server
+
+    start_server -c "$SNAP" $mode || exit 1
+    request "$RELOAD" ${#RELOAD_RESPONSES[@]} "$out.reload.log"
+    crash_server
+
+    echo "=== Verifying Responses ==="
+    check_responses "$out.writes.log" "${WRITES_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: writes in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    check_responses "$out.late.log" "${LATE_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: write after the snapshot in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    check_responses "$out.reload.log" "${RELOAD_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: snapshot reload in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    echo "Responses in mode '${mode:-blocking}' verified successfully."
+done
+
+echo -e "\033[32mTest Passed: All conditions satisfied.\033[0m"
+exit 0
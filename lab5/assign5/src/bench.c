@@ -0,0 +1,852 @@
+/*---------------------------------------------------------------------------*/
+/* bench.c                                                                   */
+/* skvs-bench, a multi-connection load generator with latency histograms     */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <getopt.h>
+#include <errno.h>
+#include "common.h"
+#include "hist.h"
+#include "zipf.h"
+/*---------------------------------------------------------------------------*/
+#define BENCH_CONNS 16
+#define BENCH_THREADS 4
+#define BENCH_DURATION 10
+#define BENCH_KEYS 100000
+#define BENCH_VALUE_SIZE 64
+#define BENCH_MIX "0,90,10,0"
+#define BENCH_MAX_DEPTH 1024
+/* answers still outstanding when the run ends are waited for this long */
+#define BENCH_DRAIN_NS 2000000000ULL
+/* requests per send while preloading */
+#define BENCH_PRELOAD_BATCH 1000
+/* longest request: command, key and value */
+#define BENCH_REQ_MAX (16 + MAX_KEY_LEN + BUFFER_SIZE)
+#define BENCH_RBUF_SIZE (64 * 1024)
+/*---------------------------------------------------------------------------*/
+enum bench_op
+{
+    OP_CREATE,
+    OP_READ,
+    OP_UPDATE,
+    OP_DELETE,
+    OP_COUNT
+};
+static const char *g_op_names[OP_COUNT] = {"CREATE", "READ", "UPDATE",
+                                           "DELETE"};
+/*---------------------------------------------------------------------------*/
+/* settings of the run, shared read-only by the threads */
+static struct
+{
+    struct sockaddr_in addr;
+    int num_conns;
+    int num_threads;
+    int duration;
+    unsigned mix[OP_COUNT];     // relative weights of the commands
+    unsigned mix_total;
+    unsigned long num_keys;
+    double theta;               // zipf skew, 0 for uniform keys
+    int value_size;
+    int depth;                  // requests in flight per connection
+    double rate;                // requests per second, 0 for closed loop
+    int binary;
+    char *value;
+    struct zipf keys;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} g_cfg;
+/*---------------------------------------------------------------------------*/
+struct bench_conn
+{
+    int fd;
+
+    /* requests built but not sent yet */
+    char *wbuf;
+    size_t wlen;
+    size_t woff;
+
+    /* answers received but not complete yet */
+    char rbuf[BENCH_RBUF_SIZE];
+    size_t rlen;
+
+    /* when each request in flight was due, oldest first. a ring of
+     * g_cfg.depth. the latency of an answer counts from there, so a
+     * request delayed by a slow server is not left out (coordinated
+     * omission). */
+    uint64_t *due;
+    int head;
+    int count;
+
+    uint64_t next_due;          // of the next request, open loop only
+    uint64_t interval;          // between its requests, open loop only
+};
+/*---------------------------------------------------------------------------*/
+struct bench_thread
+{
+    pthread_t tid;
+    int idx;
+    struct bench_conn *conns;
+    int num_conns;
+    uint64_t rng;
+    uint64_t sent[OP_COUNT];
+    uint64_t done;
+    uint64_t misses;            // NOT FOUND and COLLISION
+    uint64_t errors;            // INVALID CMD and INTERNAL ERR
+    uint64_t last_ns;           // of the last answer
+    uint64_t hist[HIST_BUCKETS];
+    int ret;
+};
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* appends one request to the output of c */
+static void
+conn_push(struct bench_thread *t, struct bench_conn *c, uint64_t due)
+{
+    char key[MAX_KEY_LEN + 1], *p;
+    struct bin_hdr hdr;
+    unsigned pick = zipf_rng(&t->rng) % g_cfg.mix_total;
+    int op = 0, klen, vlen;
+
+    while (pick >= g_cfg.mix[op])
+    {
+        pick -= g_cfg.mix[op];
+        op++;
+    }
+    klen = snprintf(key, sizeof(key), "key%lu",
+                    zipf_next(&g_cfg.keys, &t->rng));
+    vlen = (op == OP_CREATE || op == OP_UPDATE) ? g_cfg.value_size : 0;
+
+    p = c->wbuf + c->wlen;
+    if (g_cfg.binary)
+    {
+        hdr.magic = BIN_MAGIC;
+        hdr.op = op;
+        hdr.klen = htons(klen);
+        hdr.vlen = htonl(vlen);
+        hdr.id = htonl(c->head + c->count);
+        memcpy(p, &hdr, sizeof(hdr));
+        memcpy(p + sizeof(hdr), key, klen);
+        memcpy(p + sizeof(hdr) + klen, g_cfg.value, vlen);
+        c->wlen += sizeof(hdr) + klen + vlen;
+    }
+    else if (vlen)
+    {
+        c->wlen += sprintf(p, "%s %s %s\n", g_op_names[op], key, g_cfg.value);
+    }
+    else
+    {
+        c->wlen += sprintf(p, "%s %s\n", g_op_names[op], key);
+    }
+
+    c->due[(c->head + c->count) % g_cfg.depth] = due;
+    c->count++;
+    t->sent[op]++;
+}
+/*---------------------------------------------------------------------------*/
+/* sends what is pending on c.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+conn_flush(struct bench_conn *c)
+{
+    ssize_t sent;
+
+    while (c->woff < c->wlen)
+    {
+        sent = send(c->fd, c->wbuf + c->woff, c->wlen - c->woff,
+                    MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            perror("send failed");
+            return -1;
+        }
+        c->woff += sent;
+    }
+    c->wlen = 0;
+    c->woff = 0;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* issues the requests c may send now: as many as the pipeline holds in
+ * a closed loop, and the ones that are due in an open loop.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+conn_fill(struct bench_thread *t, struct bench_conn *c, uint64_t now)
+{
+    /* the output buffer holds a full pipeline, and is only reused once
+     * it was sent */
+    if (c->wlen > 0 || now >= g_cfg.end_ns)
+    {
+        return 0;
+    }
+    while (c->count < g_cfg.depth)
+    {
+        if (g_cfg.rate == 0)
+        {
+            conn_push(t, c, now);
+            continue;
+        }
+        if (c->next_due > now)
+        {
+            break;
+        }
+        conn_push(t, c, c->next_due);
+        c->next_due += c->interval;
+    }
+
+    return conn_flush(c);
+}
+/*---------------------------------------------------------------------------*/
+/* takes the answer of the oldest request in flight on c */
+static void
+conn_done(struct bench_thread *t, struct bench_conn *c, int status,
+          uint64_t now)
+{
+    uint64_t due = c->due[c->head];
+
+    c->head = (c->head + 1) % g_cfg.depth;
+    c->count--;
+    t->done++;
+    t->hist[hist_index(now > due ? now - due : 0)]++;
+    t->last_ns = now;
+    if (status == 1)
+    {
+        t->misses++;
+    }
+    else if (status == 2)
+    {
+        t->errors++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* reads the answers that arrived on c.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+conn_on_readable(struct bench_thread *t, struct bench_conn *c)
+{
+    struct bin_hdr hdr;
+    ssize_t len;
+    size_t off, end;
+    uint64_t now;
+    int status;
+    char *nl;
+
+    while (1)
+    {
+        len = recv(c->fd, c->rbuf + c->rlen, BENCH_RBUF_SIZE - c->rlen, 0);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            perror("recv failed");
+            return -1;
+        }
+        if (len == 0)
+        {
+            fprintf(stderr, "Server closed the connection.\n");
+            return -1;
+        }
+        c->rlen += len;
+
+        now = now_ns();
+        off = 0;
+        while (c->count > 0)
+        {
+            if (g_cfg.binary)
+            {
+                if (c->rlen - off < sizeof(hdr))
+                {
+                    break;
+                }
+                memcpy(&hdr, c->rbuf + off, sizeof(hdr));
+                end = off + sizeof(hdr) + ntohl(hdr.vlen);
+                if (hdr.magic != BIN_MAGIC || end - off > BUFFER_SIZE)
+                {
+                    fprintf(stderr, "Malformed reply\n");
+                    return -1;
+                }
+                if (end > c->rlen)
+                {
+                    break;
+                }
+                status = (hdr.op == 2 || hdr.op == 3) ? 1 :
+                         (hdr.op == 0 || hdr.op == 6) ? 2 : 0;
+            }
+            else
+            {
+                nl = memchr(c->rbuf + off, '\n', c->rlen - off);
+                if (nl == NULL)
+                {
+                    break;
+                }
+                end = nl - c->rbuf + 1;
+                /* the values of the run never look like these */
+                status = (strncmp(c->rbuf + off, "NOT FOUND\n", 10) == 0 ||
+                          strncmp(c->rbuf + off, "COLLISION\n", 10) == 0) ? 1 :
+                         (strncmp(c->rbuf + off, "INVALID CMD\n", 12) == 0 ||
+                          strncmp(c->rbuf + off, "INTERNAL ERR\n", 13) == 0)
+                             ? 2 : 0;
+            }
+            conn_done(t, c, status, now);
+            off = end;
+        }
+        if (c->count == 0 && off < c->rlen)
+        {
+            fprintf(stderr, "Unexpected reply\n");
+            return -1;
+        }
+        c->rlen -= off;
+        memmove(c->rbuf, c->rbuf + off, c->rlen);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* arms tfd for the next request due on a connection with room in its
+ * pipeline, or disarms it */
+static void
+arm_timer(struct bench_thread *t, int tfd)
+{
+    struct itimerspec its = {0};
+    uint64_t next = 0;
+    int i;
+
+    for (i = 0; i < t->num_conns; i++)
+    {
+        if (t->conns[i].count < g_cfg.depth &&
+            (next == 0 || t->conns[i].next_due < next))
+        {
+            next = t->conns[i].next_due;
+        }
+    }
+    if (next && next < g_cfg.end_ns)
+    {
+        its.it_value.tv_sec = next / 1000000000ULL;
+        its.it_value.tv_nsec = next % 1000000000ULL;
+    }
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+    {
+        perror("timerfd_settime failed");
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void *
+bench_thread_main(void *arg)
+{
+    struct bench_thread *t = arg;
+    struct epoll_event ev, events[64];
+    struct bench_conn *c;
+    uint64_t now, expirations;
+    int epfd, tfd = -1, n, i, busy;
+
+    t->ret = -1;
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        perror("epoll_create1 failed");
+        return NULL;
+    }
+    for (i = 0; i < t->num_conns; i++)
+    {
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &t->conns[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->conns[i].fd, &ev) < 0)
+        {
+            perror("epoll_ctl failed");
+            goto out;
+        }
+    }
+    if (g_cfg.rate > 0)
+    {
+        /* wakes the thread when the next request is due */
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (tfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+        {
+            perror("timerfd failed");
+            goto out;
+        }
+    }
+
+    now = now_ns();
+    for (i = 0; i < t->num_conns; i++)
+    {
+        if (conn_fill(t, &t->conns[i], now) < 0)
+        {
+            goto out;
+        }
+    }
+
+    while (1)
+    {
+        if (tfd >= 0)
+        {
+            arm_timer(t, tfd);
+        }
+        n = epoll_wait(epfd, events, 64, 10);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait failed");
+            goto out;
+        }
+
+        now = now_ns();
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                if (read(tfd, &expirations, sizeof(expirations)) < 0 &&
+                    errno != EAGAIN)
+                {
+                    perror("timerfd read failed");
+                }
+                continue;
+            }
+            if ((events[i].events & EPOLLIN) && conn_on_readable(t, c) < 0)
+            {
+                goto out;
+            }
+            if (conn_flush(c) < 0)
+            {
+                goto out;
+            }
+        }
+
+        busy = 0;
+        for (i = 0; i < t->num_conns; i++)
+        {
+            if (conn_fill(t, &t->conns[i], now) < 0)
+            {
+                goto out;
+            }
+            busy |= t->conns[i].count > 0;
+        }
+        if (now >= g_cfg.end_ns &&
+            (!busy || now >= g_cfg.end_ns + BENCH_DRAIN_NS))
+        {
+            break;
+        }
+    }
+    t->ret = 0;
+
+out:
+    if (tfd >= 0)
+    {
+        close(tfd);
+    }
+    close(epfd);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* returns a connected socket, or -1 */
+static int
+bench_connect(int nonblock)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+    {
+        perror("socket failed");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&g_cfg.addr, sizeof(g_cfg.addr)) < 0)
+    {
+        perror("connect failed");
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    if (nonblock && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+    {
+        perror("fcntl failed");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+/*---------------------------------------------------------------------------*/
+/* creates every key, so that a run starts on a full table.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+bench_preload(void)
+{
+    char *buf, rbuf[BENCH_RBUF_SIZE];
+    unsigned long i, j, n;
+    size_t len;
+    ssize_t got;
+    int fd, k;
+
+    fd = bench_connect(0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    buf = malloc(BENCH_PRELOAD_BATCH * BENCH_REQ_MAX);
+    if (buf == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0; i < g_cfg.num_keys; i += n)
+    {
+        n = g_cfg.num_keys - i < BENCH_PRELOAD_BATCH ?
+            g_cfg.num_keys - i : BENCH_PRELOAD_BATCH;
+        len = 0;
+        for (j = i; j < i + n; j++)
+        {
+            len += sprintf(buf + len, "CREATE key%lu %s\n", j, g_cfg.value);
+        }
+        if (send(fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len)
+        {
+            perror("send failed");
+            break;
+        }
+        /* one line per answer, COLLISION for the keys already there */
+        for (j = 0; j < n;)
+        {
+            got = recv(fd, rbuf, sizeof(rbuf), 0);
+            if (got <= 0)
+            {
+                fprintf(stderr, "Server closed the connection.\n");
+                goto out;
+            }
+            for (k = 0; k < got; k++)
+            {
+                j += rbuf[k] == '\n';
+            }
+        }
+    }
+
+out:
+    free(buf);
+    close(fd);
+
+    return i >= g_cfg.num_keys ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+parse_mix(char *arg)
+{
+    char *tok, *saveptr;
+    int op;
+
+    g_cfg.mix_total = 0;
+    tok = strtok_r(arg, ",", &saveptr);
+    for (op = 0; op < OP_COUNT; op++)
+    {
+        if (tok == NULL)
+        {
+            return -1;
+        }
+        g_cfg.mix[op] = strtoul(tok, NULL, 10);
+        g_cfg.mix_total += g_cfg.mix[op];
+        tok = strtok_r(NULL, ",", &saveptr);
+    }
+
+    return g_cfg.mix_total > 0 && tok == NULL ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_report(struct bench_thread *threads)
+{
+    static uint64_t hist[HIST_BUCKETS];
+    static const double qs[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+    uint64_t sent[OP_COUNT] = {0}, done = 0, misses = 0, errors = 0;
+    uint64_t last = g_cfg.start_ns, min = 0, max = 0;
+    double secs;
+    int i, j;
+
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        for (j = 0; j < OP_COUNT; j++)
+        {
+            sent[j] += threads[i].sent[j];
+        }
+        for (j = 0; j < HIST_BUCKETS; j++)
+        {
+            hist[j] += threads[i].hist[j];
+        }
+        done += threads[i].done;
+        misses += threads[i].misses;
+        errors += threads[i].errors;
+        last = threads[i].last_ns > last ? threads[i].last_ns : last;
+    }
+    for (j = 0; j < HIST_BUCKETS; j++)
+    {
+        if (hist[j])
+        {
+            min = min ? min : hist_value(j);
+            max = hist_value(j);
+        }
+    }
+    secs = (last - g_cfg.start_ns) / 1e9;
+
+    printf("%lu requests in %.2f s: %.0f requests/s "
+           "(%lu CREATE, %lu READ, %lu UPDATE, %lu DELETE)\n",
+           done, secs, secs > 0 ? done / secs : 0.0,
+           sent[OP_CREATE], sent[OP_READ], sent[OP_UPDATE], sent[OP_DELETE]);
+    printf("%lu NOT FOUND or COLLISION, %lu errors, %lu unanswered\n",
+           misses, errors,
+           sent[0] + sent[1] + sent[2] + sent[3] - done);
+    printf("latency (us): min %.1f", min / 1e3);
+    for (i = 0; i < (int)(sizeof(qs) / sizeof(qs[0])); i++)
+    {
+        printf(" p%g %.1f", qs[i] * 100,
+               hist_percentile(hist, done, qs[i]) / 1e3);
+    }
+    printf(" max %.1f\n", max / 1e3);
+}
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+    char *ip = DEFAULT_LOOPBACK_IP, mix[] = BENCH_MIX;
+    int port = DEFAULT_PORT, preload = 0;
+    struct bench_thread *threads;
+    struct bench_conn *c;
+    uint64_t interval;
+    int opt, i, j, ret = 0;
+
+    g_cfg.num_conns = BENCH_CONNS;
+    g_cfg.num_threads = BENCH_THREADS;
+    g_cfg.duration = BENCH_DURATION;
+    g_cfg.num_keys = BENCH_KEYS;
+    g_cfg.value_size = BENCH_VALUE_SIZE;
+    g_cfg.depth = 1;
+    parse_mix(mix);
+
+    while ((opt = getopt(argc, argv, "i:p:c:t:d:x:k:z:v:P:r:lbh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            ip = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            if (port <= 1024 || port >= 65536)
+            {
+                fprintf(stderr, "Invalid port number\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            g_cfg.num_conns = atoi(optarg);
+            break;
+        case 't':
+            g_cfg.num_threads = atoi(optarg);
+            break;
+        case 'd':
+            g_cfg.duration = atoi(optarg);
+            break;
+        case 'x':
+            if (parse_mix(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid mix, expected "
+                                "create,read,update,delete weights\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'k':
+            g_cfg.num_keys = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            g_cfg.theta = atof(optarg);
+            break;
+        case 'v':
+            g_cfg.value_size = atoi(optarg);
+            break;
+        case 'P':
+            g_cfg.depth = atoi(optarg);
+            break;
+        case 'r':
+            g_cfg.rate = atof(optarg);
+            break;
+        case 'l':
+            preload = 1;
+            break;
+        case 'b':
+            g_cfg.binary = 1;
+            break;
+        case 'h':
+        default:
+            printf("Usage: %s [-i server_ip (%s)] [-p port (%d)] "
+                   "[-c connections (%d)] [-t threads (%d)] "
+                   "[-d duration_s (%d)] "
+                   "[-x create,read,update,delete (%s)] [-k keys (%d)] "
+                   "[-z zipf_theta (0, uniform)] [-v value_size (%d)] "
+                   "[-P pipeline_depth (1)] "
+                   "[-r requests_per_s (0, closed loop)] [-l] [-b]\n",
+                   argv[0], DEFAULT_LOOPBACK_IP, DEFAULT_PORT, BENCH_CONNS,
+                   BENCH_THREADS, BENCH_DURATION, BENCH_MIX, BENCH_KEYS,
+                   BENCH_VALUE_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (g_cfg.num_conns < 1 || g_cfg.num_threads < 1 ||
+        g_cfg.duration < 1 || g_cfg.num_keys < 1 || g_cfg.rate < 0 ||
+        g_cfg.depth < 1 || g_cfg.depth > BENCH_MAX_DEPTH ||
+        g_cfg.theta < 0 || g_cfg.theta >= 1 || g_cfg.value_size < 1 ||
+        g_cfg.value_size > BUFFER_SIZE - MAX_KEY_LEN - 16)
+    {
+        fprintf(stderr, "Invalid arguments, see %s -h\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (g_cfg.num_threads > g_cfg.num_conns)
+    {
+        g_cfg.num_threads = g_cfg.num_conns;
+    }
+
+    memset(&g_cfg.addr, 0, sizeof(g_cfg.addr));
+    g_cfg.addr.sin_family = AF_INET;
+    g_cfg.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &g_cfg.addr.sin_addr) <= 0)
+    {
+        fprintf(stderr, "Invalid IP address\n");
+        exit(EXIT_FAILURE);
+    }
+    g_cfg.value = malloc(g_cfg.value_size + 1);
+    threads = calloc(g_cfg.num_threads, sizeof(struct bench_thread));
+    if (g_cfg.value == NULL || threads == NULL)
+    {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(g_cfg.value, 'v', g_cfg.value_size);
+    g_cfg.value[g_cfg.value_size] = '\0';
+    zipf_init(&g_cfg.keys, g_cfg.num_keys, g_cfg.theta);
+
+    if (preload)
+    {
+        printf("Creating %lu keys\n", g_cfg.num_keys);
+        if (bench_preload() < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* connection j goes to thread j % num_threads */
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        threads[i].idx = i;
+        threads[i].rng = zipf_mix64(now_ns() + i) | 1;
+        threads[i].num_conns = g_cfg.num_conns / g_cfg.num_threads +
+                               (i < g_cfg.num_conns % g_cfg.num_threads);
+        threads[i].conns = calloc(threads[i].num_conns,
+                                  sizeof(struct bench_conn));
+        if (threads[i].conns == NULL)
+        {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        for (j = 0; j < threads[i].num_conns; j++)
+        {
+            c = &threads[i].conns[j];
+            c->fd = bench_connect(1);
+            c->wbuf = malloc((size_t)g_cfg.depth * BENCH_REQ_MAX);
+            c->due = malloc(g_cfg.depth * sizeof(uint64_t));
+            if (c->fd < 0 || c->wbuf == NULL || c->due == NULL)
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    printf("Running %d s, %d connections on %d threads, %s keys of %lu, "
+           "values of %d bytes, pipeline %d, ",
+           g_cfg.duration, g_cfg.num_conns, g_cfg.num_threads,
+           g_cfg.theta > 0 ? "zipf" : "uniform", g_cfg.num_keys,
+           g_cfg.value_size, g_cfg.depth);
+    if (g_cfg.rate > 0)
+    {
+        printf("%.0f requests/s\n", g_cfg.rate);
+    }
+    else
+    {
+        printf("closed loop\n");
+    }
+
+    g_cfg.start_ns = now_ns();
+    g_cfg.end_ns = g_cfg.start_ns + g_cfg.duration * 1000000000ULL;
+    /* the connections of an open loop send in turn, spread evenly */
+    interval = g_cfg.rate > 0 ? 1e9 * g_cfg.num_conns / g_cfg.rate : 0;
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        for (j = 0; j < threads[i].num_conns; j++)
+        {
+            c = &threads[i].conns[j];
+            c->interval = interval ? interval : 1;
+            c->next_due = g_cfg.start_ns + interval *
+                          (j * g_cfg.num_threads + i) / g_cfg.num_conns;
+        }
+    }
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        if (pthread_create(&threads[i].tid, NULL, bench_thread_main,
+                           &threads[i]) != 0)
+        {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        ret |= threads[i].ret;
+    }
+
+    print_report(threads);
+
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        for (j = 0; j < threads[i].num_conns; j++)
+        {
+            close(threads[i].conns[j].fd);
+            free(threads[i].conns[j].wbuf);
+            free(threads[i].conns[j].due);
+        }
+        free(threads[i].conns);
+    }
+    free(threads);
+    free(g_cfg.value);
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -15,11 +15,153 @@
 #include <errno.h>
 #include "common.h"
 /*---------------------------------------------------------------------------*/
+/* commands and fixed responses of the binary protocol, by index */
+static const char *g_bin_cmds[] = {
+    "CREATE", "READ", "UPDATE", "DELETE", "SNAPSHOT", "STATS", "EXPIRE"};
+static const char *g_bin_msgs[] = {
+    "INVALID CMD",
+    "CREATE OK",
+    "COLLISION",
+    "NOT FOUND",
+    "UPDATE OK",
+    "DELETE OK",
+    "INTERNAL ERR",
+    "SNAPSHOT OK",
+    "SNAPSHOT BUSY",
+    "EXPIRE OK"};
+/*---------------------------------------------------------------------------*/
+static int
+send_all(int sockfd, const char *buf, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(sockfd, buf, len, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+recv_all(int sockfd, char *buf, size_t len)
+{
+    ssize_t received;
+
+    while (len > 0)
+    {
+        received = recv(sockfd, buf, len, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return -1;
+        }
+        buf += received;
+        len -= received;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* sends a text command line as a binary frame and prints the reply.
+ * the value is the rest of the line after the key, so it may contain spaces.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+bin_request(int sockfd, char *line, uint32_t id, const char *prefix)
+{
+    char frame[BUFFER_SIZE], value[BUFFER_SIZE + 1];
+    struct bin_hdr hdr;
+    char *cmd, *key, *val, *saveptr;
+    size_t klen, vlen, i;
+
+    line[strcspn(line, "\n")] = '\0';
+    cmd = strtok_r(line, " ", &saveptr);
+    key = strtok_r(NULL, " ", &saveptr);
+    val = strtok_r(NULL, "", &saveptr);
+    key = key ? key : "";
+    val = val ? val : "";
+
+    hdr.magic = BIN_MAGIC;
+    hdr.op = 0xFF; // unknown command, answered with INVALID CMD
+    for (i = 0; cmd && i < sizeof(g_bin_cmds) / sizeof(g_bin_cmds[0]); i++)
+    {
+        if (strcasecmp(cmd, g_bin_cmds[i]) == 0)
+        {
+            hdr.op = i;
+        }
+    }
+    klen = strlen(key) > MAX_KEY_LEN ? MAX_KEY_LEN : strlen(key);
+    vlen = strlen(val);
+    if (sizeof(hdr) + klen + vlen > BUFFER_SIZE)
+    {
+        vlen = BUFFER_SIZE - sizeof(hdr) - klen;
+    }
+    hdr.klen = htons(klen);
+    hdr.vlen = htonl(vlen);
+    hdr.id = htonl(id);
+
+    memcpy(frame, &hdr, sizeof(hdr));
+    memcpy(frame + sizeof(hdr), key, klen);
+    memcpy(frame + sizeof(hdr) + klen, val, vlen);
+    if (send_all(sockfd, frame, sizeof(hdr) + klen + vlen) < 0)
+    {
+        perror("send failed");
+        return -1;
+    }
+
+    if (recv_all(sockfd, (char *)&hdr, sizeof(hdr)) < 0)
+    {
+        printf("Server closed the connection.\n");
+        return -1;
+    }
+    vlen = ntohl(hdr.vlen);
+    if (hdr.magic != BIN_MAGIC || vlen > BUFFER_SIZE)
+    {
+        fprintf(stderr, "Malformed reply\n");
+        return -1;
+    }
+    if (recv_all(sockfd, value, vlen) < 0)
+    {
+        printf("Server closed the connection.\n");
+        return -1;
+    }
+    value[vlen] = '\0';
+
+    if (hdr.op == BIN_ST_VALUE)
+    {
+        printf("%s%s\n", prefix, value);
+    }
+    else if (hdr.op < sizeof(g_bin_msgs) / sizeof(g_bin_msgs[0]))
+    {
+        printf("%s%s\n", prefix, g_bin_msgs[hdr.op]);
+    }
+    else
+    {
+        printf("%sunknown status %d\n", prefix, hdr.op);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
     char *ip = DEFAULT_LOOPBACK_IP;
     int port = DEFAULT_PORT;
     int interactive = 0; /* Default is non-interactive mode */
+    int binary = 0;      /* Default is the text protocol */
     int opt;
 
 /*---------------------------------------------------------------------------*/
@@ -28,10 +170,11 @@ int main(int argc, char *argv[])
     struct sockaddr_in server_addr;
     char buffer[BUFFER_SIZE];
     ssize_t bytes_received;
+    uint32_t id = 0;
 /*---------------------------------------------------------------------------*/
 
     /* parse command line options */
-    while ((opt = getopt(argc, argv, "i:p:th")) != -1)
+    while ((opt = getopt(argc, argv, "i:p:tbh")) != -1)
     {
         switch (opt)
         {
@@ -49,10 +192,13 @@ int main(int argc, char *argv[])
         case 't':
             interactive = 1;
             break;
+        case 'b':
+            binary = 1;
+            break;
         case 'h':
         default:
             printf("Usage: %s [-i server_ip_or_domain (%s)] "
-                   "[-p port (%d)] [-t]\n",
+                   "[-p port (%d)] [-t] [-b]\n",
                    argv[0],
                    DEFAULT_LOOPBACK_IP, 
                    DEFAULT_PORT);
@@ -89,8 +235,34 @@ int main(int argc, char *argv[])
 
     printf("Connected to %s:%d\n", ip, port);
 
+    /* binary protocol mode: same input lines, sent as binary frames */
+    if (binary)
+    {
+        while (1)
+        {
+            if (interactive)
+            {
+                printf("Enter command: ");
+            }
+            if (fgets(buffer, sizeof(buffer), stdin) == NULL ||
+                buffer[0] == '\n')
+            {
+                if (interactive)
+                {
+                    printf("Input terminated. Closing connection.\n");
+                }
+                break;
+            }
+            if (bin_request(sockfd, buffer, id++,
+                            interactive ? "Server reply: " : "") < 0)
+            {
+                break;
+            }
+        }
+    }
+
     /* 인터랙티브 모드 */
-    if (interactive)
+    else if (interactive)
     {
         while (1)
         {
@@ -6,6 +6,7 @@
 #define _COMMON_H
 /*---------------------------------------------------------------------------*/
 #include <errno.h>
+#include <stdint.h>
 /*---------------------------------------------------------------------------*/
 #define MAX_KEY_LEN 32
 #define BUFFER_SIZE 4096
@@ -16,6 +17,31 @@
 #define NUM_THREADS 10
 #define RWLOCK_DELAY 0
 #define TIMEOUT 1
+/* keys of one MGET or MSET at most, more than a command line can hold */
+#define MAX_BATCH_KEYS (BUFFER_SIZE / 2)
+/*---------------------------------------------------------------------------*/
+/* binary protocol
+ * every frame starts with BIN_MAGIC, a byte that never begins a text
+ * command, followed by the key and the value. integers are in network
+ * byte order. a request carries a command index (CREATE 0, READ 1,
+ * UPDATE 2, DELETE 3, SNAPSHOT 4, STATS 5, EXPIRE 6) in op; a response
+ * carries the index of the fixed message (INVALID CMD 0, CREATE OK 1, ...
+ * SNAPSHOT BUSY 8, EXPIRE OK 9) or BIN_ST_VALUE followed by the value,
+ * e.g. of READ or STATS. EXPIRE carries its TTL in seconds as the value
+ * in decimal; CREATE and UPDATE take no TTL. a frame carries one key,
+ * so MGET and MSET are text only, and so are SCAN, RANGE and PREFIX,
+ * whose keys may not fit in a frame.
+ * a frame is at most BUFFER_SIZE bytes. */
+#define BIN_MAGIC 0xB5
+#define BIN_ST_VALUE 0x80
+struct bin_hdr
+{
+    uint8_t magic;
+    uint8_t op;     // command in requests, status in responses
+    uint16_t klen;  // key length, 0 in responses
+    uint32_t vlen;  // value length
+    uint32_t id;    // opaque request id, echoed in the response
+} __attribute__((packed));
 /*---------------------------------------------------------------------------*/
 #ifdef DEBUG
 #define DEBUG_PRINT(...)                                               \
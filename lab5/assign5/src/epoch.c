@@ -0,0 +1,235 @@
+/*---------------------------------------------------------------------------*/
+/* epoch.c                                                                   */
+/* Epoch-based memory reclamation for lock-free readers                      */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "epoch.h"
+/*---------------------------------------------------------------------------*/
+/* a retired pointer waiting for its grace period */
+struct epoch_item
+{
+    void *ptr;
+    void (*free_fn)(void *);
+    struct epoch_item *next;
+};
+/*---------------------------------------------------------------------------*/
+/* per-thread record. state is (epoch << 1 | 1) inside a read section,
+ * and 0 outside. everything but state is private to the owner thread. */
+struct epoch_rec
+{
+    unsigned long state;
+    int depth;                              // read section nesting
+    unsigned long count;                    // retirements since advancing
+
+    /* items retired in the epochs limbo_epoch[i], i = epoch % 3 */
+    struct epoch_item *limbo[3];
+    unsigned long limbo_epoch[3];
+
+    struct epoch_rec *next;
+};
+/*---------------------------------------------------------------------------*/
+static unsigned long g_epoch = 0;
+static struct epoch_rec *g_recs = NULL;
+static __thread struct epoch_rec *t_rec = NULL;
+/*---------------------------------------------------------------------------*/
+/* returns the record of the calling thread, registering it on first use */
+static struct epoch_rec *
+epoch_rec_get(void)
+{
+    struct epoch_rec *rec = t_rec;
+
+    if (rec)
+    {
+        return rec;
+    }
+
+    rec = calloc(1, sizeof(struct epoch_rec));
+    if (rec == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate epoch record");
+        return NULL;
+    }
+
+    rec->next = __atomic_load_n(&g_recs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_recs, &rec->next, rec, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        ;
+    }
+    t_rec = rec;
+
+    return rec;
+}
+/*---------------------------------------------------------------------------*/
+static void
+epoch_free_list(struct epoch_item *item)
+{
+    struct epoch_item *next;
+
+    while (item)
+    {
+        next = item->next;
+        item->free_fn(item->ptr);
+        free(item);
+        item = next;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* frees the items of rec whose grace period is over */
+static void
+epoch_reclaim(struct epoch_rec *rec, unsigned long epoch)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (rec->limbo[i] && rec->limbo_epoch[i] + 2 <= epoch)
+        {
+            epoch_free_list(rec->limbo[i]);
+            rec->limbo[i] = NULL;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* moves the global epoch forward when every thread inside a read section
+ * has seen the current one. returns the global epoch. */
+static unsigned long
+epoch_advance(void)
+{
+    struct epoch_rec *rec;
+    unsigned long epoch, state;
+
+    /* order the unlinks before the scan of the records */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE);
+
+    for (rec = __atomic_load_n(&g_recs, __ATOMIC_ACQUIRE); rec;
+         rec = rec->next)
+    {
+        state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != epoch)
+        {
+            /* a reader still runs in an older epoch */
+            return epoch;
+        }
+    }
+
+    /* somebody else may have advanced it meanwhile, that is fine too */
+    __atomic_compare_exchange_n(&g_epoch, &epoch, epoch + 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE);
+}
+/*---------------------------------------------------------------------------*/
+/* waits for a full grace period. used when retiring runs out of memory. */
+static void
+epoch_synchronize(void)
+{
+    unsigned long target = __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE) + 2;
+
+    while (epoch_advance() < target)
+    {
+        sched_yield();
+    }
+}
+/*---------------------------------------------------------------------------*/
+int epoch_enter(void)
+{
+    TRACE_PRINT();
+    struct epoch_rec *rec = epoch_rec_get();
+    unsigned long epoch;
+
+    if (rec == NULL)
+    {
+        return -1;
+    }
+    if (rec->depth++ > 0)
+    {
+        return 0;
+    }
+
+    epoch = __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&rec->state, epoch << 1 | 1, __ATOMIC_RELAXED);
+    /* announce before loading any shared pointer */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void epoch_exit(void)
+{
+    TRACE_PRINT();
+    struct epoch_rec *rec = t_rec;
+
+    if (rec == NULL)
+    {
+        return;
+    }
+    if (--rec->depth > 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------------*/
+void epoch_retire(void *ptr, void (*free_fn)(void *))
+{
+    TRACE_PRINT();
+    struct epoch_rec *rec = epoch_rec_get();
+    struct epoch_item *item = malloc(sizeof(struct epoch_item));
+    unsigned long epoch;
+    int i;
+
+    if (rec == NULL || item == NULL)
+    {
+        DEBUG_PRINT("Failed to defer reclamation, waiting for readers");
+        free(item);
+        epoch_synchronize();
+        free_fn(ptr);
+        return;
+    }
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+
+    /* readers that may still see ptr entered in this epoch or before */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE);
+
+    epoch_reclaim(rec, epoch);
+    i = epoch % 3;
+    if (rec->limbo[i] && rec->limbo_epoch[i] != epoch)
+    {
+        /* three epochs old, always past its grace period */
+        epoch_free_list(rec->limbo[i]);
+        rec->limbo[i] = NULL;
+    }
+    item->next = rec->limbo[i];
+    rec->limbo[i] = item;
+    rec->limbo_epoch[i] = epoch;
+
+    if (++rec->count >= EPOCH_RETIRE_BATCH)
+    {
+        rec->count = 0;
+        epoch_reclaim(rec, epoch_advance());
+    }
+}
+/*---------------------------------------------------------------------------*/
+void epoch_drain(void)
+{
+    TRACE_PRINT();
+    struct epoch_rec *rec;
+    int i;
+
+    for (rec = __atomic_load_n(&g_recs, __ATOMIC_ACQUIRE); rec;
+         rec = rec->next)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            epoch_free_list(rec->limbo[i]);
+            rec->limbo[i] = NULL;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+/*---------------------------------------------------------------------------*/
+/* epoch.h                                                                   */
+/* Epoch-based memory reclamation for lock-free readers                      */
+/*---------------------------------------------------------------------------*/
+#ifndef _EPOCH_H
+#define _EPOCH_H
+/*---------------------------------------------------------------------------*/
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* try to advance the global epoch after this many retirements */
+#define EPOCH_RETIRE_BATCH 64
+/*---------------------------------------------------------------------------*/
+/**
+ * enters a read section of the calling thread. memory reachable from
+ * shared pointers loaded inside the section is not freed before
+ * the matching epoch_exit(). sections may be nested.
+ * returns -1 when any internal errors occur; the section is not entered.
+ * returns 0 on success.
+ */
+int epoch_enter(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * leaves a read section entered by epoch_enter().
+ */
+void epoch_exit(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * schedules free_fn(ptr) for the time when no thread can still hold ptr.
+ * ptr must already be unreachable from shared pointers.
+ * must not be called inside a read section.
+ */
+void epoch_retire(void *ptr, void (*free_fn)(void *));
+/*---------------------------------------------------------------------------*/
+/**
+ * frees everything retired so far, whoever retired it.
+ * only safe when no other thread is inside a read section or retiring,
+ * e.g. after all workers are joined.
+ */
+void epoch_drain(void);
+/*---------------------------------------------------------------------------*/
+#endif // _EPOCH_H
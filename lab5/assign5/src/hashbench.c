@@ -0,0 +1,1130 @@
+/*---------------------------------------------------------------------------*/
+/* hashbench.c                                                               */
+/* In-process benchmark of the SKVS internals, without the network           */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hashtable.h"
+#include "skvslib.h"
+#include "hist.h"
+#include "zipf.h"
+/*---------------------------------------------------------------------------*/
+#define HB_THREADS 4
+#define HB_KEYS 100000
+#define HB_DURATION 3
+#define HB_READ_PCT 90
+#define HB_VALUE_SIZE 64
+/* operations between two looks at the stop flag */
+#define HB_STOP_CHECK 64
+/* requests parsed at least per protocol, and the distinct ones among
+ * them, few enough to stay in the cache */
+#define HB_PARSE_ROUNDS 5000000
+#define HB_PARSE_REQS 1024
+/* keys hashed at least per key set, the set over and over */
+#define HB_HASH_ROUNDS 10000000
+/* entries of a comma list of -r */
+#define HB_LIST_MAX 16
+/* words of the data a lock of the lock mode guards */
+#define HB_LOCK_WORDS 8
+/*---------------------------------------------------------------------------*/
+#define HB_ENGINE_COUNT (HASH_ENGINE_SWISS + 1)
+static const char *g_engine_names[HB_ENGINE_COUNT] = {"chain", "swiss"};
+/* the variants of rwlock.c, and pthread_rwlock_t as a baseline for the
+ * lock mode */
+#define HB_LOCK_PTHREAD (RWLOCK_MODE_FAIR + 1)
+#define HB_LOCK_COUNT (HB_LOCK_PTHREAD + 1)
+static const char *g_lock_names[HB_LOCK_COUNT] = {"cond", "futex", "bias",
+                                                  "fair", "pthread"};
+/* read percentages the lock mode sweeps when -r is not given */
+static const int g_lock_reads[] = {100, 99, 95, 90, 50};
+/*---------------------------------------------------------------------------*/
+/* what a run measures */
+enum HB_MODE
+{
+    HB_MODE_TABLE,      // the table under threads (hashtable.c)
+    HB_MODE_PARSE,      // the text and binary parsers of skvslib.c
+    HB_MODE_GROW,       // hash_insert() while the table doubles
+    HB_MODE_HASH,       // hash64() alone, its speed and spread
+    HB_MODE_LOCK,       // the lock variants alone, on a cache line each
+    HB_MODE_COUNT
+};
+static const char *g_mode_names[HB_MODE_COUNT] = {"table", "parse", "grow",
+                                                  "hash", "lock"};
+/*---------------------------------------------------------------------------*/
+/* key sets, built once before the run */
+enum HB_KEYSET
+{
+    HB_KEYSET_SEQ,      // key0, key1, ... sequential ids
+    HB_KEYSET_UUID,     // random UUIDs, as 32 hex digits
+    HB_KEYSET_PREFIX,   // a long common prefix and a short counter
+    HB_KEYSET_COUNT
+};
+static const char *g_keyset_names[HB_KEYSET_COUNT] = {"seq", "uuid",
+                                                      "prefix"};
+/*---------------------------------------------------------------------------*/
+/* phases of a run of the table mode */
+enum HB_PHASE
+{
+    HB_PHASE_INSERT,    // every key once, split between the threads
+    HB_PHASE_MIXED,     // searches and writes for the duration
+    HB_PHASE_COUNT
+};
+static const char *g_phase_names[HB_PHASE_COUNT] = {"insert", "mixed"};
+/*---------------------------------------------------------------------------*/
+/* keeps the copies, the hashes and the reads from being left out */
+volatile uint64_t g_sink;
+/*---------------------------------------------------------------------------*/
+/* a lock of the lock mode and the data it guards */
+struct hb_lock
+{
+    rwlock_t rw;
+    pthread_rwlock_t prw;
+    unsigned long data[HB_LOCK_WORDS];
+} __attribute__((aligned(64)));
+/*---------------------------------------------------------------------------*/
+/* settings of the run, shared read-only by the threads */
+static struct
+{
+    int mode;                   // enum HB_MODE
+    int keyset;                 // enum HB_KEYSET
+    hash_opts_t opts;           // engine and lock_mode are set per run
+    int engine_list[HB_ENGINE_COUNT];
+    int num_engine_list;
+    int lock_list[HB_LOCK_COUNT];
+    int num_lock_list;
+    int read_list[HB_LIST_MAX];
+    int num_read_list;
+    int num_threads;
+    unsigned long num_keys;
+    int read_pct;               // set per run, from read_list
+    int churn_pct;              // delete and insert again
+    double theta;
+    int duration;
+    int timed;                  // lock mode: time every acquisition
+    int pinned;                 // thread i runs on CPU i % num_cpus
+    int num_cpus;               // online
+    char *value;
+    char (*keys)[MAX_KEY_LEN + 1];
+    struct zipf dist;
+    hashtable_t *table;
+    struct hb_lock *locks;      // lock mode, opts.num_locks of them
+    pthread_barrier_t barrier;
+    int stop;
+} g_cfg;
+/*---------------------------------------------------------------------------*/
+struct hb_thread
+{
+    pthread_t tid;
+    int idx;
+    int perf_fd;                // cache miss counter, or -1
+    unsigned long ops[HB_PHASE_COUNT];
+    unsigned long failed[HB_PHASE_COUNT];   // operations that returned -1
+    unsigned long long misses[HB_PHASE_COUNT];
+    unsigned long reads;        // lock mode: acquisitions to read
+    unsigned long writes;       // and to write
+    unsigned long lock_failed;
+    uint64_t *wait[2];          // and their waits in ns, reads first
+};
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* opens a counter of the cache misses of the calling thread in user
+ * space, disabled. returns -1 where perf events are not allowed, e.g.
+ * with kernel.perf_event_paranoid above 2 or in a container. */
+static int
+perf_open(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+/*---------------------------------------------------------------------------*/
+static void
+perf_start(struct hb_thread *t)
+{
+    if (t->perf_fd >= 0)
+    {
+        ioctl(t->perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(t->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+perf_stop(struct hb_thread *t, int phase)
+{
+    unsigned long long count;
+
+    if (t->perf_fd >= 0)
+    {
+        ioctl(t->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(t->perf_fd, &count, sizeof(count)) == sizeof(count))
+        {
+            t->misses[phase] = count;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* writes key i of the key set to key */
+static void
+make_key(unsigned long i, char *key)
+{
+    uint64_t hi, lo;
+
+    switch (g_cfg.keyset)
+    {
+    case HB_KEYSET_UUID:
+        /* version 4 and variant bits, as a random UUID has them */
+        hi = zipf_mix64(i * 2 + 1);
+        lo = zipf_mix64(i * 2 + 2);
+        hi = (hi & ~0xF000ULL) | 0x4000ULL;
+        lo = (lo & ~(3ULL << 62)) | (2ULL << 62);
+        sprintf(key, "%016lx%016lx", hi, lo);
+        break;
+    case HB_KEYSET_PREFIX:
+        /* MAX_KEY_LEN long, only the last digits differ */
+        sprintf(key, "tenant/0042/session/%012lu", i);
+        break;
+    default:
+        sprintf(key, "key%lu", i);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* inserts the keys of thread t, every num_threads-th from its index */
+static void
+run_insert(struct hb_thread *t)
+{
+    unsigned long i;
+
+    for (i = t->idx; i < g_cfg.num_keys; i += g_cfg.num_threads)
+    {
+        if (hash_insert(g_cfg.table, g_cfg.keys[i], g_cfg.value) < 0)
+        {
+            t->failed[HB_PHASE_INSERT]++;
+        }
+        t->ops[HB_PHASE_INSERT]++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* searches and writes random keys until the main thread says stop */
+static void
+run_mixed(struct hb_thread *t)
+{
+    uint64_t rng = zipf_mix64(now_ns() + t->idx) | 1;
+    unsigned long ops = 0, failed = 0;
+    const char *value, *key;
+    int pick, i, ret;
+
+    while (!__atomic_load_n(&g_cfg.stop, __ATOMIC_RELAXED))
+    {
+        for (i = 0; i < HB_STOP_CHECK; i++)
+        {
+            pick = zipf_rng(&rng) % 100;
+            key = g_cfg.keys[zipf_next(&g_cfg.dist, &rng)];
+            if (pick < g_cfg.read_pct)
+            {
+                /* the lock-free path of READ */
+                ret = epoch_enter();
+                if (ret == 0)
+                {
+                    ret = hash_search(g_cfg.table, key, &value);
+                    epoch_exit();
+                }
+            }
+            else if (pick < g_cfg.read_pct + g_cfg.churn_pct)
+            {
+                ret = hash_delete(g_cfg.table, key);
+                if (ret >= 0)
+                {
+                    ret = hash_insert(g_cfg.table, key, g_cfg.value);
+                }
+                ops++;
+            }
+            else
+            {
+                ret = hash_update(g_cfg.table, key, g_cfg.value);
+            }
+            failed += ret < 0;
+            ops++;
+        }
+    }
+
+    t->ops[HB_PHASE_MIXED] = ops;
+    t->failed[HB_PHASE_MIXED] = failed;
+}
+/*---------------------------------------------------------------------------*/
+static void *
+hb_thread_main(void *arg)
+{
+    struct hb_thread *t = arg;
+
+    t->perf_fd = perf_open();
+
+    pthread_barrier_wait(&g_cfg.barrier);
+    perf_start(t);
+    run_insert(t);
+    perf_stop(t, HB_PHASE_INSERT);
+    pthread_barrier_wait(&g_cfg.barrier);
+
+    pthread_barrier_wait(&g_cfg.barrier);
+    perf_start(t);
+    run_mixed(t);
+    perf_stop(t, HB_PHASE_MIXED);
+    pthread_barrier_wait(&g_cfg.barrier);
+
+    if (t->perf_fd >= 0)
+    {
+        close(t->perf_fd);
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* prints one line of key=value pairs for a phase */
+static void
+print_phase(struct hb_thread *threads, int phase, uint64_t ns)
+{
+    unsigned long ops = 0, failed = 0;
+    unsigned long long misses = 0;
+    int i, counted = 1;
+
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        ops += threads[i].ops[phase];
+        failed += threads[i].failed[phase];
+        misses += threads[i].misses[phase];
+        counted &= threads[i].perf_fd >= 0;
+    }
+
+    printf("phase=%s engine=%s lock=%s threads=%d cpus=%d pinned=%d "
+           "keyset=%s keys=%lu hash_size=%zu "
+           "stripes=%zu read_pct=%d churn_pct=%d dist=%s theta=%.2f "
+           "value_size=%zu ops=%lu failed=%lu secs=%.3f ops_per_s=%.0f "
+           "ns_per_op=%.1f",
+           g_phase_names[phase], g_engine_names[g_cfg.opts.engine],
+           g_lock_names[g_cfg.opts.lock_mode], g_cfg.num_threads,
+           g_cfg.num_cpus, g_cfg.pinned,
+           g_keyset_names[g_cfg.keyset], g_cfg.num_keys,
+           g_cfg.opts.hash_size, g_cfg.opts.num_locks,
+           g_cfg.read_pct, g_cfg.churn_pct,
+           g_cfg.theta > 0 ? "zipf" : "uniform", g_cfg.theta,
+           strlen(g_cfg.value), ops, failed, ns / 1e9,
+           ops ? ops / (ns / 1e9) : 0.0,
+           ops ? (double)ns * g_cfg.num_threads / ops : 0.0);
+    if (counted)
+    {
+        printf(" cache_misses=%llu misses_per_op=%.2f\n", misses,
+               ops ? (double)misses / ops : 0.0);
+    }
+    else
+    {
+        printf(" cache_misses=NA misses_per_op=NA\n");
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* writes READ of key, or UPDATE of key to the value, to buf as a text
+ * line or a binary frame. returns its length. */
+static size_t
+make_req(char *buf, int bin, int write, const char *key)
+{
+    size_t klen = strlen(key), vlen = write ? strlen(g_cfg.value) : 0;
+    struct bin_hdr hdr;
+
+    if (!bin)
+    {
+        return write ? sprintf(buf, "UPDATE %s %s\n", key, g_cfg.value)
+                     : sprintf(buf, "READ %s\n", key);
+    }
+    hdr.magic = BIN_MAGIC;
+    hdr.op = write ? CMD_UPDATE : CMD_READ;
+    hdr.klen = htons(klen);
+    hdr.vlen = htonl(vlen);
+    hdr.id = htonl(0);
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), key, klen);
+    memcpy(buf + sizeof(hdr) + klen, g_cfg.value, vlen);
+
+    return sizeof(hdr) + klen + vlen;
+}
+/*---------------------------------------------------------------------------*/
+/* times skvs_parse_req(), which a sharded server runs on every request,
+ * on text lines and on binary frames of the same READs and UPDATEs.
+ * a request is copied to a scratch buffer before it is parsed, since
+ * the text parser writes into it, so the time of the copies alone is
+ * taken first and subtracted. returns -1 when any request does not
+ * parse as the command it was built as. */
+static int
+run_parse(void)
+{
+    static const char *protos[] = {"text", "binary"};
+    unsigned long n = g_cfg.num_keys, rounds, r, i, failed = 0;
+    size_t *off, *lens, bytes;
+    uint64_t rng = zipf_mix64(now_ns()) | 1, sum = 0, t0, copy, parse;
+    char *reqs, *scratch;
+    struct skvs_req *req;
+    ssize_t used;
+    int bin, *writes;
+
+    n = n < HB_PARSE_REQS ? n : HB_PARSE_REQS;
+    reqs = malloc(n * BUFFER_SIZE);
+    off = malloc(n * sizeof(size_t));
+    lens = malloc(n * sizeof(size_t));
+    writes = malloc(n * sizeof(int));
+    scratch = malloc(BUFFER_SIZE);
+    req = malloc(SKVS_REQ_MAX);
+    if (reqs == NULL || off == NULL || lens == NULL || writes == NULL ||
+        scratch == NULL || req == NULL)
+    {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++)
+    {
+        writes[i] = zipf_rng(&rng) % 100 >= (uint64_t)g_cfg.read_pct;
+    }
+    rounds = (HB_PARSE_ROUNDS + n - 1) / n;
+
+    for (bin = 0; bin < 2; bin++)
+    {
+        bytes = 0;
+        for (i = 0; i < n; i++)
+        {
+            off[i] = bytes;
+            lens[i] = make_req(reqs + bytes, bin, writes[i],
+                               g_cfg.keys[zipf_next(&g_cfg.dist, &rng)]);
+            bytes += lens[i];
+        }
+
+        t0 = now_ns();
+        for (r = 0; r < rounds; r++)
+        {
+            for (i = 0; i < n; i++)
+            {
+                memcpy(scratch, reqs + off[i], lens[i]);
+                sum += scratch[lens[i] - 1];
+            }
+        }
+        copy = now_ns() - t0;
+
+        t0 = now_ns();
+        for (r = 0; r < rounds; r++)
+        {
+            for (i = 0; i < n; i++)
+            {
+                memcpy(scratch, reqs + off[i], lens[i]);
+                used = skvs_parse_req(scratch, lens[i], req);
+                if (used != (ssize_t)lens[i] ||
+                    req->cmd != (writes[i] ? CMD_UPDATE : CMD_READ))
+                {
+                    failed++;
+                }
+            }
+        }
+        parse = now_ns() - t0;
+
+        printf("mode=parse proto=%s keyset=%s reqs=%lu read_pct=%d "
+               "value_size=%zu bytes_per_req=%.1f failed=%lu "
+               "copy_ns_per_req=%.2f ns_per_req=%.2f reqs_per_s=%.0f\n",
+               protos[bin], g_keyset_names[g_cfg.keyset], rounds * n,
+               g_cfg.read_pct, strlen(g_cfg.value), (double)bytes / n, failed,
+               (double)copy / (rounds * n),
+               (double)(parse - copy) / (rounds * n),
+               parse > copy ? rounds * n / ((parse - copy) / 1e9) : 0.0);
+    }
+    g_sink = sum;
+    free(reqs);
+    free(off);
+    free(lens);
+    free(writes);
+    free(scratch);
+    free(req);
+
+    return failed ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_grow(size_t buckets, const uint64_t *hist, unsigned long n,
+           unsigned long failed, uint64_t max)
+{
+    printf("mode=grow keyset=%s buckets=%zu inserts=%lu failed=%lu "
+           "p50_ns=%lu p99_ns=%lu max_ns=%lu\n",
+           g_keyset_names[g_cfg.keyset], buckets, n, failed,
+           hist_percentile(hist, n, 0.5),
+           hist_percentile(hist, n, 0.99), max);
+}
+/*---------------------------------------------------------------------------*/
+/* inserts the -n keys into a table of -s buckets from one thread and
+ * times every hash_insert(). the table doubles on the way, so one line
+ * per number of buckets shows what a doubling and the migration behind
+ * it cost the inserts. the insert that doubled the table counts with the
+ * new number. returns -1 when any insert fails. */
+static int
+run_grow(void)
+{
+    static uint64_t hist[HIST_BUCKETS];
+    char key[MAX_KEY_LEN + 1];
+    unsigned long i, n = 0, failed = 0, total_failed = 0;
+    uint64_t t0, ns, max = 0;
+    hashtable_t *table;
+    size_t size;
+    int ret;
+
+    table = hash_init(g_cfg.opts.hash_size, 0);
+    if (table == NULL)
+    {
+        fprintf(stderr, "hash_init failed\n");
+        return -1;
+    }
+
+    size = table->cur->size;
+    for (i = 0; i < g_cfg.num_keys; i++)
+    {
+        make_key(i, key);
+        t0 = now_ns();
+        ret = hash_insert(table, key, g_cfg.value);
+        ns = now_ns() - t0;
+
+        if (table->cur->size != size)
+        {
+            print_grow(size, hist, n, failed, max);
+            memset(hist, 0, sizeof(hist));
+            n = failed = max = 0;
+            size = table->cur->size;
+        }
+        hist[hist_index(ns)]++;
+        n++;
+        max = ns > max ? ns : max;
+        if (ret != 1)
+        {
+            failed++;
+            total_failed++;
+        }
+    }
+    print_grow(size, hist, n, failed, max);
+    hash_destroy(table);
+
+    return total_failed ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* hashes the key set over and over for the speed of hash64(), and
+ * counts the keys per bucket of hash_size buckets, taken from the low
+ * bits like the table does, for the spread */
+static int
+run_hash(void)
+{
+    uint64_t seed = zipf_mix64(now_ns()), sum = 0, t0, ns;
+    unsigned long n = g_cfg.num_keys, rounds, r, i;
+    size_t buckets = 1, b, max = 0, *count, *lens;
+    double expected, diff, chi2 = 0;
+
+    while (buckets < g_cfg.opts.hash_size)
+    {
+        buckets <<= 1;
+    }
+    count = calloc(buckets, sizeof(size_t));
+    lens = malloc(n * sizeof(size_t));
+    if (count == NULL || lens == NULL)
+    {
+        free(count);
+        free(lens);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        lens[i] = strlen(g_cfg.keys[i]);
+        count[hash64(g_cfg.keys[i], lens[i], seed) & (buckets - 1)]++;
+    }
+
+    /* about 1 for a hash that spreads the keys like random numbers */
+    expected = (double)n / buckets;
+    for (b = 0; b < buckets; b++)
+    {
+        diff = count[b] - expected;
+        chi2 += diff * diff / expected;
+        max = count[b] > max ? count[b] : max;
+    }
+
+    /* a new seed each round, so that no round can be left out */
+    rounds = (HB_HASH_ROUNDS + n - 1) / n;
+    t0 = now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < n; i++)
+        {
+            sum += hash64(g_cfg.keys[i], lens[i], seed + r);
+        }
+    }
+    ns = now_ns() - t0;
+    g_sink = sum;
+
+    printf("mode=hash keyset=%s keys=%lu key_len=%zu hash_size=%zu "
+           "hashes=%lu ns_per_key=%.2f keys_per_s=%.0f "
+           "chi2_per_bucket=%.3f expected_per_bucket=%.2f "
+           "max_per_bucket=%zu\n",
+           g_keyset_names[g_cfg.keyset], n, lens[0], buckets, rounds * n,
+           (double)ns / (rounds * n), rounds * n / (ns / 1e9),
+           chi2 / buckets, expected, max);
+    free(count);
+    free(lens);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* takes lock l to read or to write. returns -1 on failure. */
+static int
+hb_lock(struct hb_lock *l, int write)
+{
+    if (g_cfg.opts.lock_mode == HB_LOCK_PTHREAD)
+    {
+        return (write ? pthread_rwlock_wrlock(&l->prw)
+                      : pthread_rwlock_rdlock(&l->prw)) ? -1 : 0;
+    }
+
+    return write ? rwlock_write_lock(&l->rw) : rwlock_read_lock(&l->rw);
+}
+/*---------------------------------------------------------------------------*/
+static int
+hb_unlock(struct hb_lock *l, int write)
+{
+    if (g_cfg.opts.lock_mode == HB_LOCK_PTHREAD)
+    {
+        return pthread_rwlock_unlock(&l->prw) ? -1 : 0;
+    }
+
+    return write ? rwlock_write_unlock(&l->rw) : rwlock_read_unlock(&l->rw);
+}
+/*---------------------------------------------------------------------------*/
+/* takes random locks to read their data, or to write it, until the
+ * main thread says stop */
+static void *
+hb_lock_main(void *arg)
+{
+    struct hb_thread *t = arg;
+    uint64_t rng = zipf_mix64(now_ns() + t->idx) | 1;
+    unsigned long sum = 0;
+    struct hb_lock *l;
+    uint64_t t0 = 0;
+    int i, j, write, ret;
+
+    pthread_barrier_wait(&g_cfg.barrier);
+    while (!__atomic_load_n(&g_cfg.stop, __ATOMIC_RELAXED))
+    {
+        for (i = 0; i < HB_STOP_CHECK; i++)
+        {
+            write = zipf_rng(&rng) % 100 >= (uint64_t)g_cfg.read_pct;
+            l = &g_cfg.locks[zipf_rng(&rng) % g_cfg.opts.num_locks];
+            if (g_cfg.timed)
+            {
+                t0 = now_ns();
+            }
+            ret = hb_lock(l, write);
+            if (g_cfg.timed)
+            {
+                t->wait[write][hist_index(now_ns() - t0)]++;
+            }
+            if (ret < 0)
+            {
+                t->lock_failed++;
+                continue;
+            }
+            for (j = 0; j < HB_LOCK_WORDS; j++)
+            {
+                if (write)
+                {
+                    l->data[j]++;
+                }
+                else
+                {
+                    sum += l->data[j];
+                }
+            }
+            t->lock_failed += hb_unlock(l, write) < 0;
+            t->writes += write;
+            t->reads += !write;
+        }
+    }
+    g_sink = sum;
+    pthread_barrier_wait(&g_cfg.barrier);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* starts the threads of a run, which wait at the barrier first. when
+ * pinned, thread i runs only on CPU i % num_cpus, so that the cache
+ * lines of the locks move between the same cores in every run. */
+static void
+start_threads(struct hb_thread *threads, void *(*start)(void *))
+{
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int i;
+
+    g_cfg.stop = 0;
+    pthread_barrier_init(&g_cfg.barrier, NULL, g_cfg.num_threads + 1);
+    pthread_attr_init(&attr);
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        threads[i].idx = i;
+        if (g_cfg.pinned)
+        {
+            CPU_ZERO(&cpus);
+            CPU_SET(i % g_cfg.num_cpus, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        if (pthread_create(&threads[i].tid, &attr, start, &threads[i]) != 0)
+        {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+/*---------------------------------------------------------------------------*/
+/* runs the threads on the locks of one variant for the duration.
+ * returns -1 when the locks could not be created or any lock call
+ * failed. */
+static int
+run_lock(void)
+{
+    static uint64_t wait[2][HIST_BUCKETS];
+    static const double qs[] = {0.5, 0.99, 0.9999};
+    unsigned long reads = 0, writes = 0, failed = 0, ops, total;
+    int i, j, w, n = g_cfg.opts.num_locks, ret = 0;
+    struct hb_thread *threads;
+    uint64_t t0, ns;
+    void *mem;
+
+    threads = calloc(g_cfg.num_threads, sizeof(struct hb_thread));
+    if (threads == NULL ||
+        posix_memalign(&mem, 64, n * sizeof(struct hb_lock)) != 0)
+    {
+        fprintf(stderr, "Failed to create the locks\n");
+        free(threads);
+        return -1;
+    }
+    g_cfg.locks = mem;
+    memset(g_cfg.locks, 0, n * sizeof(struct hb_lock));
+    memset(wait, 0, sizeof(wait));
+    for (i = 0; i < g_cfg.num_threads && g_cfg.timed; i++)
+    {
+        threads[i].wait[0] = calloc(2 * HIST_BUCKETS, sizeof(uint64_t));
+        threads[i].wait[1] = threads[i].wait[0] + HIST_BUCKETS;
+        if (threads[i].wait[0] == NULL)
+        {
+            perror("calloc failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < n && ret == 0; i++)
+    {
+        if (g_cfg.opts.lock_mode == HB_LOCK_PTHREAD)
+        {
+            ret = pthread_rwlock_init(&g_cfg.locks[i].prw, NULL) ? -1 : 0;
+        }
+        else
+        {
+            ret = rwlock_init_mode(&g_cfg.locks[i].rw, 0,
+                                   g_cfg.opts.lock_mode);
+        }
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "Failed to initialize the locks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start_threads(threads, hb_lock_main);
+    pthread_barrier_wait(&g_cfg.barrier);
+    t0 = now_ns();
+    sleep(g_cfg.duration);
+    __atomic_store_n(&g_cfg.stop, 1, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&g_cfg.barrier);
+    ns = now_ns() - t0;
+
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        reads += threads[i].reads;
+        writes += threads[i].writes;
+        failed += threads[i].lock_failed;
+        for (j = 0; j < HIST_BUCKETS && g_cfg.timed; j++)
+        {
+            wait[0][j] += threads[i].wait[0][j];
+            wait[1][j] += threads[i].wait[1][j];
+        }
+        free(threads[i].wait[0]);
+    }
+    ops = reads + writes;
+    printf("mode=lock lock=%s threads=%d cpus=%d pinned=%d locks=%zu "
+           "read_pct=%d reads=%lu writes=%lu failed=%lu secs=%.3f "
+           "ops_per_s=%.0f ns_per_op=%.1f",
+           g_lock_names[g_cfg.opts.lock_mode], g_cfg.num_threads,
+           g_cfg.num_cpus, g_cfg.pinned, g_cfg.opts.num_locks,
+           g_cfg.read_pct, reads, writes, failed, ns / 1e9, ops / (ns / 1e9),
+           ops ? (double)ns * g_cfg.num_threads / ops : 0.0);
+    /* the waits of reads and of writes, up to the slowest one */
+    for (w = 0; w < 2 && g_cfg.timed; w++)
+    {
+        total = w ? writes : reads;
+        for (i = 0; i < (int)(sizeof(qs) / sizeof(qs[0])); i++)
+        {
+            printf(" %s_wait_p%g_ns=%lu", w ? "write" : "read", qs[i] * 100,
+                   total ? hist_percentile(wait[w], total, qs[i]) : 0);
+        }
+        j = HIST_BUCKETS - 1;
+        while (j > 0 && wait[w][j] == 0)
+        {
+            j--;
+        }
+        printf(" %s_wait_max_ns=%lu", w ? "write" : "read",
+               total ? hist_value(j) : 0);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    for (i = 0; i < n; i++)
+    {
+        if (g_cfg.opts.lock_mode == HB_LOCK_PTHREAD)
+        {
+            pthread_rwlock_destroy(&g_cfg.locks[i].prw);
+        }
+        else
+        {
+            rwlock_destroy(&g_cfg.locks[i].rw);
+        }
+    }
+    pthread_barrier_destroy(&g_cfg.barrier);
+    free(g_cfg.locks);
+    free(threads);
+
+    return failed ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* inserts the keys into a table and runs the mixed phase on it.
+ * returns -1 when the table could not be created or any operation
+ * failed. */
+static int
+run_table(void)
+{
+    struct hb_thread *threads;
+    uint64_t t0, t1;
+    int i, ret = 0;
+
+    threads = calloc(g_cfg.num_threads, sizeof(struct hb_thread));
+    g_cfg.table = hash_init_opts(&g_cfg.opts);
+    if (threads == NULL || g_cfg.table == NULL)
+    {
+        fprintf(stderr, "Failed to create the table\n");
+        free(threads);
+        return -1;
+    }
+    /* the stripes as the table rounded them, for the report */
+    g_cfg.opts.num_locks = g_cfg.table->num_locks;
+
+    start_threads(threads, hb_thread_main);
+    pthread_barrier_wait(&g_cfg.barrier);
+    t0 = now_ns();
+    pthread_barrier_wait(&g_cfg.barrier);
+    t1 = now_ns();
+    print_phase(threads, HB_PHASE_INSERT, t1 - t0);
+
+    pthread_barrier_wait(&g_cfg.barrier);
+    t0 = now_ns();
+    sleep(g_cfg.duration);
+    __atomic_store_n(&g_cfg.stop, 1, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&g_cfg.barrier);
+    t1 = now_ns();
+    print_phase(threads, HB_PHASE_MIXED, t1 - t0);
+
+    for (i = 0; i < g_cfg.num_threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        ret |= threads[i].failed[HB_PHASE_INSERT] ||
+               threads[i].failed[HB_PHASE_MIXED];
+    }
+    pthread_barrier_destroy(&g_cfg.barrier);
+    hash_destroy(g_cfg.table);
+    free(threads);
+
+    return ret ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+find_name(const char **names, int n, const char *name)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+/* parses a comma list of names, or of numbers when names is NULL, into
+ * list. returns the number of entries, or -1 when the list is empty,
+ * too long or holds an unknown name. */
+static int
+parse_list(char *arg, const char **names, int num_names, int *list,
+           int max)
+{
+    char *tok, *save;
+    int n = 0;
+
+    for (tok = strtok_r(arg, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        if (n == max)
+        {
+            return -1;
+        }
+        list[n] = names ? find_name(names, num_names, tok) : atoi(tok);
+        if (list[n] < 0)
+        {
+            return -1;
+        }
+        n++;
+    }
+
+    return n > 0 ? n : -1;
+}
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+    size_t value_size = HB_VALUE_SIZE;
+    unsigned long i;
+    int opt, e, m, r, ret = 0;
+
+    g_cfg.mode = HB_MODE_TABLE;
+    g_cfg.keyset = HB_KEYSET_SEQ;
+    g_cfg.opts.hash_size = DEFAULT_HASH_SIZE;
+    g_cfg.num_threads = HB_THREADS;
+    g_cfg.num_keys = HB_KEYS;
+    g_cfg.duration = HB_DURATION;
+    g_cfg.num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "b:k:t:n:s:l:r:c:z:d:v:e:m:wph")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            g_cfg.mode = find_name(g_mode_names, HB_MODE_COUNT, optarg);
+            break;
+        case 'k':
+            g_cfg.keyset = find_name(g_keyset_names, HB_KEYSET_COUNT,
+                                     optarg);
+            break;
+        case 't':
+            g_cfg.num_threads = atoi(optarg);
+            break;
+        case 'n':
+            g_cfg.num_keys = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            g_cfg.opts.hash_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            g_cfg.opts.num_locks = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            g_cfg.num_read_list = parse_list(optarg, NULL, 0,
+                                             g_cfg.read_list, HB_LIST_MAX);
+            break;
+        case 'c':
+            g_cfg.churn_pct = atoi(optarg);
+            break;
+        case 'z':
+            g_cfg.theta = atof(optarg);
+            break;
+        case 'd':
+            g_cfg.duration = atoi(optarg);
+            break;
+        case 'v':
+            value_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            g_cfg.num_engine_list = parse_list(optarg, g_engine_names,
+                                               HB_ENGINE_COUNT,
+                                               g_cfg.engine_list,
+                                               HB_ENGINE_COUNT);
+            break;
+        case 'm':
+            g_cfg.num_lock_list = parse_list(optarg, g_lock_names,
+                                             HB_LOCK_COUNT, g_cfg.lock_list,
+                                             HB_LOCK_COUNT);
+            break;
+        case 'w':
+            g_cfg.timed = 1;
+            break;
+        case 'p':
+            g_cfg.pinned = 1;
+            break;
+        case 'h':
+        default:
+            printf("Usage: %s [-b table|parse|grow|hash|lock (table)] "
+                   "[-k seq|uuid|prefix (seq)] "
+                   "[-t num_threads (%d)] [-n num_keys (%d)] "
+                   "[-s hash_size (%d)] "
+                   "[-l lock_stripes (%d), locks of -b lock (1)] "
+                   "[-r read_pct,... (%d), -b lock (100,99,95,90,50)] "
+                   "[-c delete_insert_pct (0)] "
+                   "[-z zipf_theta (0, uniform)] [-d duration_s (%d)] "
+                   "[-v value_size (%d)] [-e chain|swiss,... (chain)] "
+                   "[-m cond|futex|bias|fair|pthread,... (cond), "
+                   "-b lock (all)] [-w time lock waits of -b lock] "
+                   "[-p pin threads to CPUs]\n",
+                   argv[0], HB_THREADS, HB_KEYS, DEFAULT_HASH_SIZE,
+                   DEFAULT_LOCK_STRIPES, HB_READ_PCT, HB_DURATION,
+                   HB_VALUE_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* the lock mode sweeps every variant and several ratios by
+     * default, and pthread_rwlock_t does not fit into the table */
+    if (g_cfg.num_lock_list == 0)
+    {
+        g_cfg.num_lock_list = g_cfg.mode == HB_MODE_LOCK ? HB_LOCK_COUNT : 1;
+        for (m = 0; m < g_cfg.num_lock_list; m++)
+        {
+            g_cfg.lock_list[m] = m;
+        }
+    }
+    if (g_cfg.num_engine_list == 0)
+    {
+        g_cfg.num_engine_list = 1;
+        g_cfg.engine_list[0] = HASH_ENGINE_CHAIN;
+    }
+    if (g_cfg.num_read_list == 0)
+    {
+        g_cfg.num_read_list = 1;
+        g_cfg.read_list[0] = HB_READ_PCT;
+        if (g_cfg.mode == HB_MODE_LOCK)
+        {
+            g_cfg.num_read_list = sizeof(g_lock_reads) / sizeof(int);
+            memcpy(g_cfg.read_list, g_lock_reads, sizeof(g_lock_reads));
+        }
+    }
+    if (g_cfg.mode == HB_MODE_LOCK && g_cfg.opts.num_locks == 0)
+    {
+        g_cfg.opts.num_locks = 1;
+    }
+    for (m = 0; m < g_cfg.num_lock_list; m++)
+    {
+        if (g_cfg.mode != HB_MODE_LOCK &&
+            g_cfg.lock_list[m] == HB_LOCK_PTHREAD)
+        {
+            ret = -1;
+        }
+    }
+    for (r = 0; r < g_cfg.num_read_list; r++)
+    {
+        if (g_cfg.read_list[r] + g_cfg.churn_pct > 100)
+        {
+            ret = -1;
+        }
+    }
+    if (g_cfg.num_threads < 1 || g_cfg.num_keys < 1 ||
+        g_cfg.opts.hash_size < 1 || g_cfg.num_read_list < 0 ||
+        g_cfg.churn_pct < 0 || g_cfg.num_lock_list < 0 || ret < 0 ||
+        g_cfg.theta < 0 || g_cfg.theta >= 1 || g_cfg.duration < 1 ||
+        value_size < 1 || value_size >= BUFFER_SIZE ||
+        g_cfg.num_engine_list < 0 || g_cfg.mode < 0 || g_cfg.keyset < 0)
+    {
+        fprintf(stderr, "Invalid arguments, see %s -h\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    g_cfg.value = malloc(value_size + 1);
+    if (g_cfg.value == NULL)
+    {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(g_cfg.value, 'v', value_size);
+    g_cfg.value[value_size] = '\0';
+
+    if (g_cfg.mode == HB_MODE_GROW)
+    {
+        /* makes its keys as it goes, there may be too many to keep */
+        ret = run_grow();
+    }
+    else
+    {
+        g_cfg.keys = malloc(g_cfg.num_keys * sizeof(g_cfg.keys[0]));
+        if (g_cfg.keys == NULL)
+        {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < g_cfg.num_keys; i++)
+        {
+            make_key(i, g_cfg.keys[i]);
+        }
+        zipf_init(&g_cfg.dist, g_cfg.num_keys, g_cfg.theta);
+    }
+    if (g_cfg.mode == HB_MODE_HASH)
+    {
+        ret = run_hash();
+    }
+    for (r = 0; g_cfg.mode == HB_MODE_PARSE && r < g_cfg.num_read_list &&
+         ret == 0; r++)
+    {
+        g_cfg.read_pct = g_cfg.read_list[r];
+        ret = run_parse();
+    }
+    if (g_cfg.mode == HB_MODE_LOCK)
+    {
+        /* the bare locks have no engine */
+        g_cfg.num_engine_list = 1;
+    }
+    /* every engine with every lock variant and every read percentage */
+    for (e = 0; (g_cfg.mode == HB_MODE_TABLE || g_cfg.mode == HB_MODE_LOCK) &&
+         e < g_cfg.num_engine_list && ret == 0; e++)
+    {
+        for (m = 0; m < g_cfg.num_lock_list && ret == 0; m++)
+        {
+            for (r = 0; r < g_cfg.num_read_list && ret == 0; r++)
+            {
+                g_cfg.opts.engine = g_cfg.engine_list[e];
+                g_cfg.opts.lock_mode = g_cfg.lock_list[m];
+                g_cfg.read_pct = g_cfg.read_list[r];
+                ret = g_cfg.mode == HB_MODE_LOCK ? run_lock() : run_table();
+            }
+        }
+    }
+
+    free(g_cfg.keys);
+    free(g_cfg.value);
+
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -3,158 +3,1471 @@
 /* Author: Junghan Yoon, KyoungSoo Park                                      */
 /* Modified by: (Your Name)                                                  */
 /*---------------------------------------------------------------------------*/
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 #include "hashtable.h"
+#include "swiss.h"
+#include "slab.h"
 /*---------------------------------------------------------------------------*/
-int hash(const char *key, size_t hash_size)
+/* odd 64-bit constants of the hash (from wyhash) */
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+/*---------------------------------------------------------------------------*/
+/* reference-counted value storage; node->value points at data.
+ * the table holds one reference, and every pinned reader holds another. */
+struct hash_value
+{
+    uint32_t refcnt;
+    uint32_t len;           // values are shorter than BUFFER_SIZE
+    uint64_t expires;       // deadline in milliseconds, 0 for none
+    char data[];
+};
+/*---------------------------------------------------------------------------*/
+/* search counters of one thread for one table, written by that thread
+ * only. a record has a cache line of its own, and stays on the list of
+ * its table until the table is destroyed. */
+struct hash_counters
+{
+    unsigned long hits;
+    unsigned long misses;
+    pthread_t owner;
+    struct hash_counters *next;
+} __attribute__((aligned(64)));
+/*---------------------------------------------------------------------------*/
+/* tables get ids, so that a thread never takes a new table at the address
+ * of a destroyed one for the table its counters belong to */
+static unsigned long g_table_ids = 0;
+static pthread_mutex_t g_counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct hash_counters *t_counters = NULL;
+static __thread unsigned long t_counters_id = 0;
+/*---------------------------------------------------------------------------*/
+static inline struct hash_value *
+value_hdr(const char *value)
+{
+    return (struct hash_value *)(value - offsetof(struct hash_value, data));
+}
+/*---------------------------------------------------------------------------*/
+char *hash_value_new(const char *value, size_t len)
+{
+    struct hash_value *hv = slab_alloc(sizeof(struct hash_value) + len + 1);
+
+    if (hv == NULL)
+    {
+        return NULL;
+    }
+    hv->refcnt = 1;
+    hv->len = len;
+    hv->expires = 0;
+    memcpy(hv->data, value, len);
+    hv->data[len] = '\0';
+
+    return hv->data;
+}
+/*---------------------------------------------------------------------------*/
+void hash_value_pin(const char *value)
+{
+    __atomic_add_fetch(&value_hdr(value)->refcnt, 1, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+size_t hash_value_len(const char *value)
+{
+    return value_hdr(value)->len;
+}
+/*---------------------------------------------------------------------------*/
+void hash_value_set_expires(char *value, uint64_t expires)
+{
+    value_hdr(value)->expires = expires;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t hash_value_expires(const char *value)
+{
+    /* hash_expire() may set it while readers look at the value */
+    return __atomic_load_n(&value_hdr(value)->expires, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+int hash_value_expired(hashtable_t *table, const char *value)
+{
+    uint64_t expires = hash_value_expires(value);
+
+    /* only values with a deadline read the clock */
+    return expires &&
+           !__atomic_load_n(&table->expiry_held, __ATOMIC_RELAXED) &&
+           expires <= timer_now();
+}
+/*---------------------------------------------------------------------------*/
+void hash_expiry_hold(hashtable_t *table)
+{
+    TRACE_PRINT();
+
+    __atomic_add_fetch(&table->expiry_held, 1, __ATOMIC_RELAXED);
+    timer_hold(table->timers);
+}
+/*---------------------------------------------------------------------------*/
+void hash_expiry_release(hashtable_t *table)
 {
     TRACE_PRINT();
-    unsigned int hash = 0;
-    while (*key)
+
+    timer_release(table->timers);
+    __atomic_sub_fetch(&table->expiry_held, 1, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+/* drops the reference of the table once readers are done with the value */
+static void
+value_retired(void *value)
+{
+    hash_value_unpin(value);
+}
+/*---------------------------------------------------------------------------*/
+/* allocates a node with room for a key of key_size bytes right behind
+ * it, and points node->key there */
+static node_t *
+node_new(size_t key_size)
+{
+    node_t *node = slab_alloc(sizeof(node_t) + key_size + 1);
+
+    if (node)
     {
-        hash = (hash << 5) + *key++;
+        node->key = (char *)(node + 1);
+        node->key_size = key_size;
+        node->referenced = 0;
     }
 
-    return hash % hash_size;
+    return node;
 }
 /*---------------------------------------------------------------------------*/
-hashtable_t *hash_init(size_t hash_size, int delay)
+/* frees an unlinked node once readers are done with it */
+static void
+node_retired(void *ptr)
+{
+    node_t *node = ptr;
+
+    hash_value_unpin(node->value);
+    slab_free(node);
+}
+/*---------------------------------------------------------------------------*/
+/* frees a chain of nodes moved to the grown table. their values
+ * now belong to the copies. */
+static void
+chain_retired(void *ptr)
+{
+    node_t *node = ptr, *next;
+
+    while (node)
+    {
+        next = node->next;
+        slab_free(node);
+        node = next;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void hash_value_unpin(const char *value)
 {
     TRACE_PRINT();
-    int i, j, ret;
-    hashtable_t *table = malloc(sizeof(hashtable_t));
+    struct hash_value *hv = value_hdr(value);
 
-    if (table == NULL)
+    if (__atomic_sub_fetch(&hv->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table");
+        slab_free(hv);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* returns the search counters of the calling thread for table,
+ * or NULL when they cannot be allocated */
+static struct hash_counters *
+counters_of(hashtable_t *table)
+{
+    struct hash_counters *c;
+    void *mem;
+
+    if (t_counters_id == table->id)
+    {
+        return t_counters;
+    }
+
+    pthread_mutex_lock(&g_counters_lock);
+    /* the thread may come back to a table it used before */
+    for (c = table->counters; c; c = c->next)
+    {
+        if (pthread_equal(c->owner, pthread_self()))
+        {
+            break;
+        }
+    }
+    if (c == NULL && posix_memalign(&mem, 64, sizeof(*c)) == 0)
+    {
+        c = memset(mem, 0, sizeof(*c));
+        c->owner = pthread_self();
+        c->next = table->counters;
+        __atomic_store_n(&table->counters, c, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_counters_lock);
+
+    if (c)
+    {
+        t_counters = c;
+        t_counters_id = table->id;
+    }
+
+    return c;
+}
+/*---------------------------------------------------------------------------*/
+/* counts the result of a search as a hit or a miss, and returns it */
+static inline int
+hash_count(hashtable_t *table, int ret)
+{
+    struct hash_counters *c = counters_of(table);
+    unsigned long *stat;
+
+    if (c && ret >= 0)
+    {
+        stat = ret > 0 ? &c->hits : &c->misses;
+        /* only this thread writes it, the store just must not tear */
+        __atomic_store_n(stat, *stat + 1, __ATOMIC_RELAXED);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/* wyhash-style mixing: the two halves of a 128-bit product folded */
+static inline uint64_t
+hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t
+hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t
+hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    uint64_t a, b, h = seed ^ HASH_P0;
+    size_t n = len;
+
+    while (n > 16)
+    {
+        h = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ h);
+        p += 16;
+        n -= 16;
+    }
+
+    /* the last 1..16 bytes, read as two possibly overlapping words */
+    if (n >= 8)
+    {
+        a = hash_read64(p);
+        b = hash_read64(p + n - 8);
+    }
+    else if (n >= 4)
+    {
+        a = hash_read32(p);
+        b = hash_read32(p + n - 4);
+    }
+    else if (n > 0)
+    {
+        a = (uint64_t)p[0] << 16 | (uint64_t)p[n >> 1] << 8 | p[n - 1];
+        b = 0;
+    }
+    else
+    {
+        a = b = 0;
+    }
+
+    return hash_mix(HASH_P2 ^ len, hash_mix(a ^ HASH_P1, b ^ h));
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t
+hash_key(hashtable_t *table, const char *key)
+{
+    return hash64(key, strlen(key), table->seed);
+}
+/*---------------------------------------------------------------------------*/
+int hash(const char *key, size_t hash_size)
+{
+    TRACE_PRINT();
+
+    return hash64(key, strlen(key), 0) % hash_size;
+}
+/*---------------------------------------------------------------------------*/
+static hash_array_t *
+array_new(size_t size)
+{
+    hash_array_t *array = malloc(sizeof(hash_array_t));
+
+    if (array == NULL)
+    {
+        return NULL;
+    }
+    array->size = size;
+    array->buckets = calloc(size, sizeof(node_t *));
+    array->bucket_sizes = calloc(size, sizeof(size_t));
+    if (array->buckets == NULL || array->bucket_sizes == NULL)
+    {
+        free(array->buckets);
+        free(array->bucket_sizes);
+        free(array);
         return NULL;
     }
 
-    table->hash_size = hash_size;
-    table->total_entries = 0;
-
-    table->buckets = malloc(hash_size * sizeof(node_t *));
-    if (table->buckets == NULL)
+    return array;
+}
+/*---------------------------------------------------------------------------*/
+/* frees the buckets of an array, not the nodes */
+static void
+array_retired(void *ptr)
+{
+    hash_array_t *array = ptr;
+
+    free(array->buckets);
+    free(array->bucket_sizes);
+    free(array);
+}
+/*---------------------------------------------------------------------------*/
+static inline rwlock_t *
+lock_of(hashtable_t *table, uint64_t hash)
+{
+    return &table->locks[hash & (table->num_locks - 1)].lock;
+}
+/*---------------------------------------------------------------------------*/
+/* walks a chain with acquire loads, safe without the lock */
+static node_t *
+chain_find(node_t *const *head, uint64_t hash, const char *key)
+{
+    node_t *node;
+
+    for (node = __atomic_load_n(head, __ATOMIC_ACQUIRE); node;
+         node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))
+    {
+        if (node->hash == hash && strcmp(node->key, key) == 0)
+        {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* finds key in the old buckets and then in the current ones.
+ * the caller must be in a read section. */
+static node_t *
+hash_find(hashtable_t *table, uint64_t hash, const char *key)
+{
+    hash_array_t *old, *cur;
+    node_t *node;
+
+    do
+    {
+        old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+        cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+
+        /* a moved node is published in cur before it leaves old */
+        if (old)
+        {
+            node = chain_find(&old->buckets[hash & (old->size - 1)],
+                              hash, key);
+            if (node)
+            {
+                return node;
+            }
+        }
+        node = chain_find(&cur->buckets[hash & (cur->size - 1)], hash, key);
+        if (node)
+        {
+            return node;
+        }
+
+        /* a resize started or finished meanwhile, the miss may be false */
+    } while (old != __atomic_load_n(&table->old, __ATOMIC_ACQUIRE) ||
+             cur != __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE));
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* moves old bucket i into the current buckets. nodes are copied and the
+ * old chain is retired as a whole, so that lock-free readers walking it
+ * are never sent into another chain. the caller holds the lock of i.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+bucket_migrate(hashtable_t *table, size_t i)
+{
+    hash_array_t *old = table->old, *cur = table->cur;
+    node_t *head = old->buckets[i], *node, *copy, *copies = NULL;
+    size_t j;
+
+    if (head == NULL)
+    {
+        return 0;
+    }
+
+    /* allocate every copy first, so that a failure leaves no duplicate */
+    for (node = head; node; node = node->next)
+    {
+        copy = node_new(node->key_size);
+        if (copy == NULL)
+        {
+            chain_retired(copies);
+            return -1;
+        }
+        copy->hash = node->hash;
+        memcpy(copy->key, node->key, node->key_size + 1);
+        copy->value = node->value;
+        copy->value_size = node->value_size;
+        copy->referenced = node->referenced;
+        copy->next = copies;
+        copies = copy;
+    }
+
+    while (copies)
+    {
+        copy = copies;
+        copies = copies->next;
+        j = copy->hash & (cur->size - 1);
+        copy->next = cur->buckets[j];
+        __atomic_store_n(&cur->buckets[j], copy, __ATOMIC_RELEASE);
+        cur->bucket_sizes[j]++;
+    }
+
+    __atomic_store_n(&old->buckets[i], NULL, __ATOMIC_RELEASE);
+    old->bucket_sizes[i] = 0;
+    epoch_retire(head, chain_retired);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* moves the old bucket of hash before a writer touches the current ones,
+ * so that a key never lives in both. the caller holds the lock of hash.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+hash_prepare(hashtable_t *table, uint64_t hash)
+{
+    if (table->old == NULL)
+    {
+        return 0;
+    }
+
+    return bucket_migrate(table, hash & (table->old->size - 1));
+}
+/*---------------------------------------------------------------------------*/
+/* unlinks a node whose deadline passed from bucket index of cur.
+ * the caller holds the lock of the bucket. */
+static void
+chain_expire(hashtable_t *table, hash_array_t *cur, size_t index,
+             node_t *node)
+{
+    node_t **link = &cur->buckets[index];
+
+    while (*link != node)
+    {
+        link = &(*link)->next;
+    }
+    __atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+    cur->bucket_sizes[index]--;
+    hash_expired(table, node->key,
+                 hash_entry_bytes(table, node->key_size, node->value_size));
+    epoch_retire(node, node_retired);
+}
+/*---------------------------------------------------------------------------*/
+/* called by the timer thread when a deadline of key passed. the key may
+ * have been deleted, or given another deadline since. */
+static void
+hash_expire_due(void *arg, const char *key, uint64_t deadline)
+{
+    hashtable_t *table = arg;
+    hash_array_t *cur;
+    node_t *node;
+    uint64_t h, expires;
+    size_t index;
+    rwlock_t *lock;
+
+    if (table->swiss)
+    {
+        swiss_expire_due(table, key, deadline);
+        return;
+    }
+
+    h = hash_key(table, key);
+    lock = lock_of(table, h);
+    rwlock_write_lock(lock);
+    if (hash_prepare(table, h) < 0)
+    {
+        /* still treated as gone, retry with the next write of the key */
+        rwlock_write_unlock(lock);
+        return;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+    node = chain_find(&cur->buckets[index], h, key);
+    if (node)
+    {
+        expires = hash_value_expires(node->value);
+        if (expires && expires <= timer_now())
+        {
+            chain_expire(table, cur, index, node);
+        }
+        else if (expires == deadline &&
+                 timer_add(table->timers, key, deadline) < 0)
+        {
+            /* the clock went back, so wait for the deadline again */
+            DEBUG_PRINT("Failed to schedule the expiry of a key");
+        }
+    }
+    rwlock_write_unlock(lock);
+}
+/*---------------------------------------------------------------------------*/
+static void
+lock_all(hashtable_t *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->num_locks; i++)
+    {
+        rwlock_write_lock(&table->locks[i].lock);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+unlock_all(hashtable_t *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->num_locks; i++)
+    {
+        rwlock_write_unlock(&table->locks[i].lock);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* starts a resize when the table is overloaded, or moves the next few old
+ * buckets while one is in progress. called by writers after they release
+ * their lock. only one thread at a time does it; the others skip it. */
+static void
+hash_grow(hashtable_t *table)
+{
+    TRACE_PRINT();
+    hash_array_t *old, *cur;
+    rwlock_t *lock;
+    size_t total;
+    int i, ret;
+
+    old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+    cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+    total = __atomic_load_n(&table->total_entries, __ATOMIC_RELAXED);
+    if (old == NULL && total <= cur->size * HASH_MAX_LOAD)
+    {
+        return;
+    }
+    if (pthread_mutex_trylock(&table->resize_lock) != 0)
+    {
+        return;
+    }
+
+    if (table->old == NULL)
+    {
+        if (total > table->cur->size * HASH_MAX_LOAD)
+        {
+            cur = array_new(table->cur->size * 2);
+            if (cur == NULL)
+            {
+                DEBUG_PRINT("Failed to allocate memory for grown buckets");
+                pthread_mutex_unlock(&table->resize_lock);
+                return;
+            }
+
+            /* writers see either no resize or a fresh one */
+            lock_all(table);
+            __atomic_store_n(&table->old, table->cur, __ATOMIC_RELEASE);
+            __atomic_store_n(&table->cur, cur, __ATOMIC_RELEASE);
+            table->migrate_next = 0;
+            unlock_all(table);
+        }
+        pthread_mutex_unlock(&table->resize_lock);
+        return;
+    }
+
+    old = table->old;
+    for (i = 0; i < HASH_MIGRATE_STEP && table->migrate_next < old->size;
+         i++)
+    {
+        lock = lock_of(table, table->migrate_next);
+        rwlock_write_lock(lock);
+        ret = bucket_migrate(table, table->migrate_next);
+        rwlock_write_unlock(lock);
+        if (ret < 0)
+        {
+            /* out of memory, retry the bucket on a later write */
+            break;
+        }
+        table->migrate_next++;
+    }
+
+    if (table->migrate_next == old->size)
+    {
+        /* no writer may still look at the old buckets */
+        lock_all(table);
+        __atomic_store_n(&table->old, NULL, __ATOMIC_RELEASE);
+        unlock_all(table);
+        epoch_retire(old, array_retired);
+    }
+
+    pthread_mutex_unlock(&table->resize_lock);
+}
+/*---------------------------------------------------------------------------*/
+/* a random seed, so that clients cannot pick colliding keys */
+static uint64_t
+hash_seed(void)
+{
+    uint64_t seed;
+
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+    {
+        seed = (uint64_t)time(NULL) * HASH_P1 ^ (uint64_t)getpid();
+    }
+
+    return seed;
+}
+/*---------------------------------------------------------------------------*/
+hashtable_t *hash_init(size_t hash_size, int delay)
+{
+    TRACE_PRINT();
+    hash_opts_t opts = {
+        .hash_size = hash_size,
+        .delay = delay,
+        .engine = HASH_ENGINE_CHAIN,
+    };
+
+    return hash_init_opts(&opts);
+}
+/*---------------------------------------------------------------------------*/
+hashtable_t *hash_init_opts(const hash_opts_t *opts)
+{
+    TRACE_PRINT();
+    int ret;
+    size_t i, j, size, stripes;
+    void *locks;
+    hashtable_t *table = calloc(1, sizeof(hashtable_t));
+
+    if (table == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table");
+        return NULL;
+    }
+
+    /* bucket indices are masked, so keep the sizes powers of two */
+    for (size = 1; size < opts->hash_size; size <<= 1)
+    {
+        ;
+    }
+
+    /* every generation of buckets must split evenly over the stripes */
+    for (stripes = 1;
+         stripes < (opts->num_locks ? opts->num_locks : DEFAULT_LOCK_STRIPES)
+         && stripes < size;
+         stripes <<= 1)
+    {
+        ;
+    }
+
+    table->hash_size = size;
+    table->num_locks = stripes;
+    table->seed = opts->seed ? opts->seed : hash_seed();
+    table->mem_limit = opts->mem_limit;
+    table->id = __atomic_add_fetch(&g_table_ids, 1, __ATOMIC_RELAXED);
+
+    table->timers = timer_open(hash_expire_due, table);
+    if (table->timers == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table timers");
+        free(table);
+        return NULL;
+    }
+
+    if (posix_memalign(&locks, 64, stripes * sizeof(lock_stripe_t)) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table locks");
+        timer_close(table->timers);
+        free(table);
+        return NULL;
+    }
+    /* rwlock_init() frees a stale writer_ring, so start from zeroes */
+    memset(locks, 0, stripes * sizeof(lock_stripe_t));
+    table->locks = locks;
+
+    if (pthread_mutex_init(&table->resize_lock, NULL) != 0)
+    {
+        DEBUG_PRINT("Failed to initialize resize lock");
+        timer_close(table->timers);
+        free(table->locks);
+        free(table);
+        return NULL;
+    }
+
+    for (i = 0; i < stripes; i++)
+    {
+        ret = rwlock_init_mode(&table->locks[i].lock, opts->delay,
+                               opts->lock_mode);
+        if (ret != 0)
+        {
+            DEBUG_PRINT("Failed to initialize read-write lock");
+            break;
+        }
+    }
+
+    if (i == stripes)
+    {
+        if (opts->ordered && (table->index = skiplist_new()) == NULL)
+        {
+            ret = -1;
+        }
+        else if (opts->engine == HASH_ENGINE_SWISS)
+        {
+            ret = swiss_init(table, stripes);
+        }
+        else
+        {
+            table->cur = array_new(size);
+            ret = table->cur ? 0 : -1;
+        }
+        if (ret == 0)
+        {
+            return table;
+        }
+        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
+        if (table->index)
+        {
+            skiplist_free(table->index);
+        }
+    }
+
+    for (j = 0; j < i; j++)
+    {
+        rwlock_destroy(&table->locks[j].lock);
+    }
+    pthread_mutex_destroy(&table->resize_lock);
+    timer_close(table->timers);
+    free(table->locks);
+    free(table);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+void hash_set_write_hook(hashtable_t *table, hash_write_hook_t hook,
+                         void *arg)
+{
+    TRACE_PRINT();
+
+    /* the timer thread reads the hook, and must find arg set with it */
+    table->write_arg = arg;
+    __atomic_store_n(&table->write_hook, hook, __ATOMIC_RELEASE);
+
+    /* a report runs under the lock of its key, so once every lock was
+     * taken no expiry still calls the old hook */
+    lock_all(table);
+    unlock_all(table);
+}
+/*---------------------------------------------------------------------------*/
+void hash_lock_all(hashtable_t *table)
+{
+    TRACE_PRINT();
+
+    /* same order as hash_grow(): resize lock first, then the stripes */
+    pthread_mutex_lock(&table->resize_lock);
+    lock_all(table);
+}
+/*---------------------------------------------------------------------------*/
+void hash_unlock_all(hashtable_t *table)
+{
+    TRACE_PRINT();
+
+    unlock_all(table);
+    pthread_mutex_unlock(&table->resize_lock);
+}
+/*---------------------------------------------------------------------------*/
+size_t hash_entry_bytes(hashtable_t *table, size_t key_len, size_t value_len)
+{
+    size_t value = sizeof(struct hash_value) + value_len + 1;
+
+    if (table->swiss)
+    {
+        return swiss_slot_bytes() + value;
+    }
+
+    return sizeof(node_t) + key_len + 1 + value;
+}
+/*---------------------------------------------------------------------------*/
+void hash_evicted(hashtable_t *table, const char *key, size_t bytes)
+{
+    hash_account(table, 0, bytes);
+    __atomic_sub_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    /* only the evicting thread writes it */
+    __atomic_store_n(&table->evictions, table->evictions + 1,
+                     __ATOMIC_RELAXED);
+    hash_report(table, HASH_OP_DELETE, key, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void hash_expired(hashtable_t *table, const char *key, size_t bytes)
+{
+    hash_account(table, 0, bytes);
+    __atomic_sub_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&table->expired, 1, __ATOMIC_RELAXED);
+    hash_report(table, HASH_OP_DELETE, key, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void hash_ttl_set(hashtable_t *table, const char *key, const char *value,
+                  uint64_t expires)
+{
+    char deadline[24];
+
+    __atomic_store_n(&value_hdr(value)->expires, expires, __ATOMIC_RELAXED);
+    snprintf(deadline, sizeof(deadline), "%lu", (unsigned long)expires);
+    hash_report(table, HASH_OP_EXPIRE, key, deadline);
+    if (expires && timer_add(table->timers, key, expires) < 0)
+    {
+        /* the key is still dropped when it is accessed */
+        DEBUG_PRINT("Failed to schedule the expiry of a key");
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* moves the clock hand over the buckets until the table fits its limit.
+ * the caller holds the resize lock, so the buckets stay in place. */
+static void
+chain_evict(hashtable_t *table)
+{
+    hash_array_t *cur = table->cur;
+    node_t *node, **link;
+    rwlock_t *lock;
+    size_t i, n;
+
+    for (n = 0; n < HASH_EVICT_TURNS * cur->size && hash_over_limit(table);
+         n++)
+    {
+        i = table->clock_hand++ & (cur->size - 1);
+        lock = lock_of(table, i);
+        rwlock_write_lock(lock);
+
+        /* bucket i and its old bucket share the low bits of their hashes */
+        if (hash_prepare(table, i) < 0)
+        {
+            rwlock_write_unlock(lock);
+            continue;
+        }
+
+        link = &cur->buckets[i];
+        while ((node = *link) && hash_over_limit(table))
+        {
+            if (__atomic_load_n(&node->referenced, __ATOMIC_RELAXED))
+            {
+                /* read since the last turn, give it another one */
+                __atomic_store_n(&node->referenced, 0, __ATOMIC_RELAXED);
+                link = &node->next;
+                continue;
+            }
+            __atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+            cur->bucket_sizes[i]--;
+            hash_evicted(table, node->key,
+                         hash_entry_bytes(table, node->key_size,
+                                          node->value_size));
+            epoch_retire(node, node_retired);
+        }
+
+        rwlock_write_unlock(lock);
+    }
+}
+/*---------------------------------------------------------------------------*/
+void hash_evict(hashtable_t *table)
+{
+    TRACE_PRINT();
+
+    if (!hash_over_limit(table))
+    {
+        return;
+    }
+    /* one thread evicts while the others keep serving. holding the
+     * resize lock also keeps the buckets from being replaced. */
+    if (pthread_mutex_trylock(&table->resize_lock) != 0)
+    {
+        return;
+    }
+
+    if (table->swiss)
+    {
+        swiss_evict(table);
+    }
+    else
+    {
+        chain_evict(table);
+    }
+
+    pthread_mutex_unlock(&table->resize_lock);
+}
+/*---------------------------------------------------------------------------*/
+void hash_stats(hashtable_t *table, struct hash_stats *stats)
+{
+    TRACE_PRINT();
+    struct hash_counters *c;
+
+    memset(stats, 0, sizeof(struct hash_stats));
+    stats->entries = __atomic_load_n(&table->total_entries, __ATOMIC_RELAXED);
+    stats->mem_used = __atomic_load_n(&table->mem_used, __ATOMIC_RELAXED);
+    stats->mem_limit = table->mem_limit;
+    stats->evictions = __atomic_load_n(&table->evictions, __ATOMIC_RELAXED);
+    stats->expired = __atomic_load_n(&table->expired, __ATOMIC_RELAXED);
+    stats->batch_keys = __atomic_load_n(&table->batch_keys, __ATOMIC_RELAXED);
+    stats->batch_locks = __atomic_load_n(&table->batch_locks,
+                                         __ATOMIC_RELAXED);
+    for (c = __atomic_load_n(&table->counters, __ATOMIC_ACQUIRE); c;
+         c = c->next)
+    {
+        stats->hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+    }
+}
+/*---------------------------------------------------------------------------*/
+int hash_bulk_begin(hashtable_t *table, size_t entries, uint64_t seed)
+{
+    TRACE_PRINT();
+    hash_array_t *cur;
+    size_t size;
+
+    if (table->total_entries || table->old)
+    {
+        DEBUG_PRINT("Bulk loading needs an empty table");
+        return -1;
+    }
+    table->seed = seed;
+    /* deadlines may pass while the table is loaded without locks */
+    timer_hold(table->timers);
+    if (table->swiss)
+    {
+        return swiss_bulk_begin(table, entries);
+    }
+
+    for (size = table->cur->size; size * HASH_MAX_LOAD < entries; size <<= 1)
+    {
+        ;
+    }
+    if (size > table->cur->size)
+    {
+        /* nobody has seen the empty buckets yet */
+        cur = array_new(size);
+        if (cur == NULL)
+        {
+            return -1;
+        }
+        array_retired(table->cur);
+        table->cur = cur;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int hash_bulk_insert(hashtable_t *table, uint64_t h, const char *key,
+                     size_t klen, const char *value, size_t vlen,
+                     uint64_t expires)
+{
+    TRACE_PRINT();
+    hash_array_t *cur = table->cur;
+    size_t index;
+    node_t *node;
+
+    if (table->index && skiplist_insert(table->index, key, klen) < 0)
+    {
+        return -1;
+    }
+    if (table->swiss)
+    {
+        return swiss_bulk_insert(table, h, key, klen, value, vlen, expires);
+    }
+
+    node = node_new(klen);
+    if (node == NULL)
+    {
+        return -1;
+    }
+    node->hash = h;
+    memcpy(node->key, key, klen);
+    node->key[klen] = '\0';
+    node->value_size = vlen;
+    node->value = hash_value_new(value, vlen);
+    if (node->value == NULL)
+    {
+        slab_free(node);
+        return -1;
+    }
+
+    /* the bucket belongs to the part of h, and so to the caller */
+    index = h & (cur->size - 1);
+    node->next = cur->buckets[index];
+    cur->buckets[index] = node;
+    cur->bucket_sizes[index]++;
+    hash_account(table, hash_entry_bytes(table, klen, vlen), 0);
+    if (expires)
+    {
+        hash_value_set_expires(node->value, expires);
+        timer_add(table->timers, node->key, expires);
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+void hash_bulk_end(hashtable_t *table, size_t n)
+{
+    TRACE_PRINT();
+
+    __atomic_add_fetch(&table->total_entries, n, __ATOMIC_RELAXED);
+    timer_release(table->timers);
+}
+/*---------------------------------------------------------------------------*/
+size_t hash_part_of(hashtable_t *table, uint64_t h)
+{
+    if (table->swiss)
+    {
+        return swiss_part_of(table, h);
+    }
+
+    return h & (table->num_locks - 1);
+}
+/*---------------------------------------------------------------------------*/
+int hash_part_bits(hashtable_t *table)
+{
+    int bits = __builtin_ctzl(table->num_locks);
+
+    /* the open addressing engine skips the bits of the control bytes */
+    return table->swiss ? SWISS_H2_BITS + bits : bits;
+}
+/*---------------------------------------------------------------------------*/
+/* visits the entries of one array */
+static int
+array_foreach(hash_array_t *array, hash_visit_t visit, void *arg)
+{
+    node_t *node;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < array->size; i++)
+    {
+        for (node = array->buckets[i]; node; node = node->next)
+        {
+            ret = visit(arg, node->key, node->key_size,
+                        node->value, node->value_size);
+            if (ret)
+            {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int hash_foreach(hashtable_t *table, hash_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    int ret;
+
+    if (table->swiss)
+    {
+        return swiss_foreach(table, visit, arg);
+    }
+    /* a moved old bucket is empty, so every entry is visited once */
+    if (table->old)
+    {
+        ret = array_foreach(table->old, visit, arg);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+
+    return array_foreach(table->cur, visit, arg);
+}
+/*---------------------------------------------------------------------------*/
+/* visits the live entries of one bucket for hash_scan() */
+static void
+bucket_scan(hashtable_t *table, node_t *head, hash_visit_t visit, void *arg)
+{
+    node_t *node;
+
+    for (node = head; node; node = node->next)
+    {
+        if (!hash_value_expired(table, node->value))
+        {
+            visit(arg, node->key, node->key_size,
+                  node->value, node->value_size);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+uint64_t hash_scan(hashtable_t *table, uint64_t cursor, size_t steps,
+                   hash_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    hash_array_t *small, *large;
+    uint64_t v = cursor, m0, m1;
+    rwlock_t *lock;
+    size_t n;
+
+    if (table->swiss)
+    {
+        return swiss_scan(table, cursor, steps, visit, arg);
+    }
+
+    for (n = 0; n < steps; n++)
+    {
+        /* every bucket of v shares its low bits, and so its stripe. the
+         * lock also keeps a resize from starting or ending meanwhile. */
+        lock = lock_of(table, v);
+        rwlock_read_lock(lock);
+        small = table->old ? table->old : table->cur;
+        large = table->cur;
+        m0 = small->size - 1;
+        m1 = large->size - 1;
+
+        /* during a resize a key is either in its old bucket, or in one of
+         * the current buckets that bucket is split into */
+        bucket_scan(table, small->buckets[v & m0], visit, arg);
+        if (small != large)
+        {
+            do
+            {
+                bucket_scan(table, large->buckets[v & m1], visit, arg);
+                /* next bucket of large with the low bits of v */
+                v = (((v | m0) + 1) & ~m0) | (v & m0);
+            } while (v & (m0 ^ m1));
+        }
+        rwlock_read_unlock(lock);
+
+        v = hash_scan_next(v, m0);
+        if (v == 0)
+        {
+            break;
+        }
+    }
+
+    return v;
+}
+/*---------------------------------------------------------------------------*/
+void hash_index_update(hashtable_t *table, int op, const char *key)
+{
+    int ret;
+
+    if (op == HASH_OP_INSERT)
+    {
+        ret = skiplist_insert(table->index, key, strlen(key));
+    }
+    else
+    {
+        ret = skiplist_delete(table->index, key, strlen(key));
+    }
+    if (ret < 0)
+    {
+        /* the key is still in the table, range queries miss it */
+        DEBUG_PRINT("Failed to update the ordered index");
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* a walk of hash_range() or hash_prefix() */
+struct range_walk
+{
+    hashtable_t *table;
+    const char *end;        // keys from here on are past the range, or NULL
+    size_t end_len;
+    const char *prefix;     // keys without it are past the range, or NULL
+    size_t prefix_len;
+    size_t limit;
+    long n;
+    skiplist_visit_t visit;
+    void *arg;
+};
+/*---------------------------------------------------------------------------*/
+/* returns 1 when key is in the table and did not expire. the index is
+ * only updated when an expired key is dropped, so ask the table. */
+static int
+range_live(hashtable_t *table, const char *key)
+{
+    const char *value;
+    node_t *node;
+
+    if (table->swiss)
+    {
+        return swiss_search(table, key, &value) == 1;
+    }
+    /* skiplist_range() is a read section */
+    node = hash_find(table, hash_key(table, key), key);
+    if (node == NULL)
+    {
+        return 0;
+    }
+    value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+
+    return !hash_value_expired(table, value);
+}
+/*---------------------------------------------------------------------------*/
+static int
+range_visit(void *arg, const char *key, size_t len)
+{
+    struct range_walk *w = arg;
+    char buf[MAX_KEY_LEN + 1];
+    int c;
+
+    if (w->end)
+    {
+        c = memcmp(key, w->end, len < w->end_len ? len : w->end_len);
+        if (c > 0 || (c == 0 && len >= w->end_len))
+        {
+            return 1;
+        }
+    }
+    if (w->prefix &&
+        (len < w->prefix_len || memcmp(key, w->prefix, w->prefix_len) != 0))
+    {
+        return 1;
+    }
+
+    memcpy(buf, key, len);
+    buf[len] = '\0';
+    if (!range_live(w->table, buf))
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
-        free(table);
-        return NULL;
+        return 0;
     }
+    w->n++;
 
-    table->locks = malloc(hash_size * sizeof(rwlock_t));
-    if (table->locks == NULL)
+    return w->visit(w->arg, buf, len) || (size_t)w->n >= w->limit;
+}
+/*---------------------------------------------------------------------------*/
+static long
+range_walk(struct range_walk *w, const char *start)
+{
+    if (w->table->index == NULL)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table locks");
-        free(table->buckets);
-        free(table);
-        return NULL;
+        return -1;
     }
-
-    table->bucket_sizes = malloc(hash_size * sizeof(*table->bucket_sizes));
-    if (table->bucket_sizes == NULL)
+    if (w->limit == 0)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table bucket sizes");
-        free(table->buckets);
-        free(table->locks);
-        free(table);
-        return NULL;
+        return 0;
     }
-
-    for (i = 0; i < hash_size; i++)
+    if (skiplist_range(w->table->index, start, strlen(start),
+                       range_visit, w) < 0)
     {
-        table->buckets[i] = NULL;
-        table->bucket_sizes[i] = 0;
-        ret = rwlock_init(&table->locks[i], delay);
-        if (ret != 0)
-        {
-            DEBUG_PRINT("Failed to initialize read-write lock");
-            for (j = 0; j < i; j++)
-            {
-                rwlock_destroy(&table->locks[j]);
-            }
-            free(table->buckets);
-            free(table->locks);
-            free(table->bucket_sizes);
-            free(table);
-            return NULL;
-        }
+        return -1;
     }
 
-    return table;
+    return w->n;
 }
 /*---------------------------------------------------------------------------*/
-int hash_destroy(hashtable_t *table)
+long hash_range(hashtable_t *table, const char *start, const char *end,
+                size_t limit, skiplist_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    struct range_walk w = {
+        .table = table,
+        .end = end,
+        .end_len = end ? strlen(end) : 0,
+        .limit = limit,
+        .visit = visit,
+        .arg = arg,
+    };
+
+    return range_walk(&w, start);
+}
+/*---------------------------------------------------------------------------*/
+long hash_prefix(hashtable_t *table, const char *prefix, size_t limit,
+                 skiplist_visit_t visit, void *arg)
 {
     TRACE_PRINT();
+    struct range_walk w = {
+        .table = table,
+        .prefix = prefix,
+        .prefix_len = strlen(prefix),
+        .limit = limit,
+        .visit = visit,
+        .arg = arg,
+    };
+
+    /* the keys with a prefix follow each other, from the prefix on */
+    return range_walk(&w, prefix);
+}
+/*---------------------------------------------------------------------------*/
+/* frees every node of an array and the array itself */
+static void
+array_destroy(hash_array_t *array)
+{
     node_t *node, *tmp;
-    int i;
+    size_t i;
 
-    for (i = 0; i < table->hash_size; i++)
+    for (i = 0; i < array->size; i++)
     {
-        node = table->buckets[i];
+        node = array->buckets[i];
         while (node)
         {
             tmp = node;
             node = node->next;
-            free(tmp->key);
-            free(tmp->value);
-            free(tmp);
+            hash_value_unpin(tmp->value);
+            slab_free(tmp);
         }
-        if (rwlock_destroy(&table->locks[i]) != 0)
+    }
+    array_retired(array);
+}
+/*---------------------------------------------------------------------------*/
+int hash_destroy(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct hash_counters *c;
+    int i;
+
+    /* the timer thread writes too, stop it first */
+    timer_close(table->timers);
+
+    /* no reader is left, release what they might have seen */
+    epoch_drain();
+
+    if (table->swiss)
+    {
+        swiss_destroy(table);
+    }
+    /* nodes left in old buckets have not been copied yet */
+    if (table->old)
+    {
+        array_destroy(table->old);
+    }
+    if (table->cur)
+    {
+        array_destroy(table->cur);
+    }
+    if (table->index)
+    {
+        skiplist_free(table->index);
+    }
+
+    for (i = 0; i < table->num_locks; i++)
+    {
+        if (rwlock_destroy(&table->locks[i].lock) != 0)
         {
             DEBUG_PRINT("Failed to destroy read-write lock");
             return -1;
         }
     }
+    pthread_mutex_destroy(&table->resize_lock);
 
-    free(table->buckets);
+    while (table->counters)
+    {
+        c = table->counters;
+        table->counters = c->next;
+        free(c);
+    }
     free(table->locks);
-    free(table->bucket_sizes);
     free(table);
-    
+
     return 0;
 }
 /*---------------------------------------------------------------------------*/
 int hash_insert(hashtable_t *table, const char *key, const char *value)
+{
+    TRACE_PRINT();
+
+    return hash_insert_ttl(table, key, value, 0);
+}
+/*---------------------------------------------------------------------------*/
+int hash_insert_ttl(hashtable_t *table, const char *key, const char *value,
+                    uint64_t expires)
 {
     TRACE_PRINT();
     node_t *node;
-    unsigned int index = hash(key, table->hash_size);
-    rwlock_t *lock = &table->locks[index];
+    hash_array_t *cur;
+    uint64_t h = hash_key(table, key);
+    size_t index;
+    rwlock_t *lock = lock_of(table, h);
+
+    if (table->swiss)
+    {
+        return swiss_insert(table, key, value, expires);
+    }
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    
+
     /* 쓰기 락 획득 */
     rwlock_write_lock(lock);
 
+    if (hash_prepare(table, h) < 0)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+
     /* 버킷에 같은 키가 있는지 검사 */
-    for (node = table->buckets[index]; node; node = node->next)
+    for (node = cur->buckets[index]; node; node = node->next)
     {
-        if (strcmp(node->key, key) == 0)
+        if (node->hash == h && strcmp(node->key, key) == 0)
         {
-            rwlock_write_unlock(lock);
-            return 0; // Collision (키가 이미 존재)
+            if (!hash_value_expired(table, node->value))
+            {
+                rwlock_write_unlock(lock);
+                return 0; // Collision (키가 이미 존재)
+            }
+            /* 만료된 키는 지우고 새로 삽입 */
+            chain_expire(table, cur, index, node);
+            break;
         }
     }
 
-    /* 새로운 노드 할당 및 데이터 삽입 */
-    node = malloc(sizeof(node_t));
+    /* 새로운 노드 할당 및 데이터 삽입 (키는 노드와 한 번에 할당) */
+    node = node_new(strlen(key));
     if (!node)
     {
         rwlock_write_unlock(lock);
         return -1; // 메모리 할당 실패
     }
-    node->key = strdup(key);
-    node->value = strdup(value);
-    node->next = table->buckets[index];
-    table->buckets[index] = node;
+    node->hash = h;
+    memcpy(node->key, key, node->key_size + 1);
+    node->value_size = strlen(value);
+    node->value = hash_value_new(value, node->value_size);
+    if (!node->value)
+    {
+        slab_free(node);
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    node->next = cur->buckets[index];
+    /* publish the initialized node to lock-free readers */
+    __atomic_store_n(&cur->buckets[index], node, __ATOMIC_RELEASE);
 
-    table->bucket_sizes[index]++;
-    table->total_entries++;
+    cur->bucket_sizes[index]++;
+    __atomic_add_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    hash_account(table, hash_entry_bytes(table, node->key_size,
+                                         node->value_size), 0);
+    hash_report(table, HASH_OP_INSERT, key, value);
+    if (expires)
+    {
+        hash_ttl_set(table, key, node->value, expires);
+    }
 
     /* 쓰기 락 해제 */
     rwlock_write_unlock(lock);
-    
+
+    hash_grow(table);
+    hash_evict(table);
+
 /*---------------------------------------------------------------------------*/
 
     /* inserted */
@@ -165,63 +1478,179 @@ int hash_search(hashtable_t *table, const char *key, const char **value)
 {
     TRACE_PRINT();
     node_t *node;
-    unsigned int index = hash(key, table->hash_size);
-    rwlock_t *lock = &table->locks[index];
+    const char *found;
+    uint64_t h = hash_key(table, key);
+
+    if (table->swiss)
+    {
+        return hash_count(table, swiss_search(table, key, value));
+    }
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    
-    /* 읽기 락 획득 */
-    rwlock_read_lock(lock);
+
+    /* no lock: writers publish with release stores,
+     * and unlinked nodes are freed after the caller's read section */
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
 
     /* 버킷에서 키 검색 */
-    for (node = table->buckets[index]; node; node = node->next)
+    node = hash_find(table, h, key);
+    if (node)
     {
-        if (strcmp(node->key, key) == 0)
+        found = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+        if (!hash_value_expired(table, found))
         {
-            *value = node->value;
-            rwlock_read_unlock(lock);
-            return 1; // 키를 찾음
+            *value = found;
+            hash_touch(table, &node->referenced);
+            epoch_exit();
+            return hash_count(table, 1); // 키를 찾음
         }
     }
 
-    /* 읽기 락 해제 */
-    rwlock_read_unlock(lock);
-    
+    epoch_exit();
+
 /*---------------------------------------------------------------------------*/
 
     /* key not found */
-    return 0;
+    return hash_count(table, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* the chaining part of hash_search_pin(), for a key of hash h.
+ * the caller is in a read section. */
+static int
+chain_search_pin(hashtable_t *table, uint64_t h, const char *key,
+                 const char **value, size_t *len)
+{
+    node_t *node;
+    char *found;
+
+    node = hash_find(table, h, key);
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    /* the table drops its reference only after our read section,
+     * so the count is still positive here. the pin makes the value
+     * outlive a concurrent update or delete. */
+    found = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+    if (hash_value_expired(table, found))
+    {
+        return 0;
+    }
+    hash_value_pin(found);
+    hash_touch(table, &node->referenced);
+    *value = found;
+    *len = hash_value_len(found);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int hash_search_pin(hashtable_t *table, const char *key,
+                    const char **value, size_t *len)
+{
+    TRACE_PRINT();
+    uint64_t h = hash_key(table, key);
+    int ret;
+
+    if (table->swiss)
+    {
+        return hash_count(table, swiss_search_pin(table, key, value, len));
+    }
+
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+    ret = chain_search_pin(table, h, key, value, len);
+    epoch_exit();
+
+    return hash_count(table, ret);
 }
 /*---------------------------------------------------------------------------*/
 int hash_update(hashtable_t *table, const char *key, const char *value)
+{
+    TRACE_PRINT();
+
+    return hash_update_ttl(table, key, value, 0);
+}
+/*---------------------------------------------------------------------------*/
+int hash_update_ttl(hashtable_t *table, const char *key, const char *value,
+                    uint64_t expires)
 {
     TRACE_PRINT();
     node_t *node;
-    unsigned int index = hash(key, table->hash_size);
-    rwlock_t *lock = &table->locks[index];
+    hash_array_t *cur;
+    uint64_t h = hash_key(table, key);
+    size_t index;
+    rwlock_t *lock = lock_of(table, h);
+
+    if (table->swiss)
+    {
+        return swiss_update(table, key, value, expires);
+    }
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    
+
     /* 쓰기 락 획득 */
     rwlock_write_lock(lock);
 
+    if (hash_prepare(table, h) < 0)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+
     /* 버킷에서 키 검색 후 값 갱신 */
-    for (node = table->buckets[index]; node; node = node->next)
+    for (node = cur->buckets[index]; node; node = node->next)
     {
-        if (strcmp(node->key, key) == 0)
+        if (node->hash == h && strcmp(node->key, key) == 0)
         {
-            free(node->value);           // 기존 값 메모리 해제
-            node->value = strdup(value); // 새 값 복사
+            size_t len = strlen(value);
+            char *new_value;
+            char *old_value;
+            if (hash_value_expired(table, node->value))
+            {
+                /* 만료된 키는 없는 키로 취급 */
+                chain_expire(table, cur, index, node);
+                break;
+            }
+            new_value = hash_value_new(value, len); // 새 값 복사
+            if (!new_value)
+            {
+                rwlock_write_unlock(lock);
+                return -1;
+            }
+            /* 새 값을 게시하고, 기존 값은 리더가 모두 떠난 뒤 해제 */
+            old_value = node->value;
+            hash_value_set_expires(new_value, hash_value_expires(old_value));
+            __atomic_store_n(&node->value, new_value, __ATOMIC_RELEASE);
+            hash_account(table, hash_entry_bytes(table, node->key_size, len),
+                         hash_entry_bytes(table, node->key_size,
+                                          node->value_size));
+            node->value_size = len;
+            hash_report(table, HASH_OP_UPDATE, key, value);
+            if (expires)
+            {
+                hash_ttl_set(table, key, new_value, expires);
+            }
+            epoch_retire(old_value, value_retired);
             rwlock_write_unlock(lock);
+            hash_grow(table);
+            hash_evict(table);
             return 1; // 값 갱신 성공
         }
     }
 
     /* 쓰기 락 해제 */
     rwlock_write_unlock(lock);
-    
+
 /*---------------------------------------------------------------------------*/
 
     /* key not found */
@@ -232,71 +1661,334 @@ int hash_delete(hashtable_t *table, const char *key)
 {
     TRACE_PRINT();
     node_t *node, *prev = NULL;
-    unsigned int index = hash(key, table->hash_size);
-    rwlock_t *lock = &table->locks[index];
+    hash_array_t *cur;
+    uint64_t h = hash_key(table, key);
+    size_t index;
+    rwlock_t *lock = lock_of(table, h);
+    int live;
+
+    if (table->swiss)
+    {
+        return swiss_delete(table, key);
+    }
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    
+
     /* 쓰기 락 획득 */
     rwlock_write_lock(lock);
 
+    if (hash_prepare(table, h) < 0)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+
     /* 버킷에서 노드 검색 및 삭제 */
-    for (node = table->buckets[index]; node; node = node->next)
+    for (node = cur->buckets[index]; node; node = node->next)
     {
-        if (strcmp(node->key, key) == 0)
+        if (node->hash == h && strcmp(node->key, key) == 0)
         {
+            /* 만료된 키도 지우지만, 없는 키로 취급 */
+            live = !hash_value_expired(table, node->value);
             if (prev)
             {
-                prev->next = node->next; // 이전 노드가 있을 경우 연결
+                // 이전 노드가 있을 경우 연결
+                __atomic_store_n(&prev->next, node->next, __ATOMIC_RELEASE);
             }
             else
             {
-                table->buckets[index] = node->next; // 버킷의 첫 노드 제거
+                // 버킷의 첫 노드 제거
+                __atomic_store_n(&cur->buckets[index], node->next,
+                                 __ATOMIC_RELEASE);
             }
 
-            free(node->key);
-            free(node->value);
-            free(node);
+            cur->bucket_sizes[index]--;
+            __atomic_sub_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+            hash_account(table, 0, hash_entry_bytes(table, node->key_size,
+                                                    node->value_size));
+            hash_report(table, HASH_OP_DELETE, key, NULL);
+            if (!live)
+            {
+                __atomic_add_fetch(&table->expired, 1, __ATOMIC_RELAXED);
+            }
 
-            table->bucket_sizes[index]--;
-            table->total_entries--;
+            /* 리더가 아직 노드를 보고 있을 수 있으므로 지연 해제 */
+            epoch_retire(node, node_retired);
 
             rwlock_write_unlock(lock);
-            return 1; // 삭제 성공
+            hash_grow(table);
+            return live; // 삭제 성공
         }
         prev = node;
     }
 
     /* 쓰기 락 해제 */
     rwlock_write_unlock(lock);
-    
+
 /*---------------------------------------------------------------------------*/
 
     /* key not found */
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-/* function to dump the contents of the hash table, including locks status */
-void hash_dump(hashtable_t *table)
+int hash_expire(hashtable_t *table, const char *key, uint64_t expires)
 {
     TRACE_PRINT();
     node_t *node;
-    int i;
+    hash_array_t *cur;
+    uint64_t h = hash_key(table, key);
+    size_t index;
+    rwlock_t *lock = lock_of(table, h);
+    int ret = 0;
 
-    printf("[Hash Table Dump]");
-    printf("Total Entries: %ld\n", table->total_entries);
+    if (table->swiss)
+    {
+        return swiss_expire(table, key, expires);
+    }
+
+    rwlock_write_lock(lock);
+    if (hash_prepare(table, h) < 0)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+
+    node = chain_find(&cur->buckets[index], h, key);
+    if (node && hash_value_expired(table, node->value))
+    {
+        chain_expire(table, cur, index, node);
+    }
+    else if (node)
+    {
+        hash_ttl_set(table, key, node->value, expires);
+        ret = 1;
+    }
+    rwlock_write_unlock(lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_search_many(hashtable_t *table, const char *const *keys, size_t n,
+                     const char **values, size_t *lens)
+{
+    TRACE_PRINT();
+    uint64_t hashes[MAX_BATCH_KEYS];
+    hash_array_t *cur;
+    size_t i, j;
+    int found = 0, ret = 0;
+
+    if (n > MAX_BATCH_KEYS)
+    {
+        return -1;
+    }
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+
+    /* start loading every bucket before the first chain is walked */
+    cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++)
+    {
+        hashes[i] = hash_key(table, keys[i]);
+        if (table->swiss)
+        {
+            swiss_prefetch(table, hashes[i]);
+        }
+        else
+        {
+            __builtin_prefetch(&cur->buckets[hashes[i] & (cur->size - 1)]);
+        }
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        values[i] = NULL;
+        if (table->swiss)
+        {
+            ret = swiss_search_pin(table, keys[i], &values[i], &lens[i]);
+        }
+        else
+        {
+            ret = chain_search_pin(table, hashes[i], keys[i],
+                                   &values[i], &lens[i]);
+        }
+        if (hash_count(table, ret) < 0)
+        {
+            break;
+        }
+        found += ret;
+    }
+    epoch_exit();
+
+    if (ret < 0)
+    {
+        for (j = 0; j < i; j++)
+        {
+            if (values[j])
+            {
+                hash_value_unpin(values[j]);
+            }
+        }
+        return -1;
+    }
+
+    return found;
+}
+/*---------------------------------------------------------------------------*/
+/* the chaining part of hash_set_many(), for a key of hash h.
+ * the caller holds the lock of h.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+chain_set(hashtable_t *table, uint64_t h, const char *key, const char *value)
+{
+    hash_array_t *cur;
+    node_t *node;
+    char *v, *old;
+    size_t index, len = strlen(value);
+
+    if (hash_prepare(table, h) < 0)
+    {
+        return -1;
+    }
+    cur = table->cur;
+    index = h & (cur->size - 1);
+
+    v = hash_value_new(value, len);
+    if (v == NULL)
+    {
+        return -1;
+    }
+    node = chain_find(&cur->buckets[index], h, key);
+    if (node && hash_value_expired(table, node->value))
+    {
+        chain_expire(table, cur, index, node);
+        node = NULL;
+    }
+
+    if (node)
+    {
+        /* the same as hash_update_ttl() */
+        old = node->value;
+        hash_value_set_expires(v, hash_value_expires(old));
+        __atomic_store_n(&node->value, v, __ATOMIC_RELEASE);
+        hash_account(table, hash_entry_bytes(table, node->key_size, len),
+                     hash_entry_bytes(table, node->key_size,
+                                      node->value_size));
+        node->value_size = len;
+        hash_report(table, HASH_OP_UPDATE, key, value);
+        epoch_retire(old, value_retired);
+        return 0;
+    }
+
+    /* the same as hash_insert_ttl() */
+    node = node_new(strlen(key));
+    if (node == NULL)
+    {
+        hash_value_unpin(v);
+        return -1;
+    }
+    node->hash = h;
+    memcpy(node->key, key, node->key_size + 1);
+    node->value = v;
+    node->value_size = len;
+    node->next = cur->buckets[index];
+    __atomic_store_n(&cur->buckets[index], node, __ATOMIC_RELEASE);
+    cur->bucket_sizes[index]++;
+    __atomic_add_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    hash_account(table, hash_entry_bytes(table, node->key_size, len), 0);
+    hash_report(table, HASH_OP_INSERT, key, value);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* orders the keys of hash_set_many() by stripe, then by their place in
+ * the batch */
+static int
+batch_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+/*---------------------------------------------------------------------------*/
+int hash_set_many(hashtable_t *table, const char *const *keys,
+                  const char *const *values, size_t n)
+{
+    TRACE_PRINT();
+    /* the stripe of each key in the high half and its index in the low
+     * one, so that a plain sort groups the stripes in batch order */
+    uint64_t order[MAX_BATCH_KEYS], hashes[MAX_BATCH_KEYS];
+    size_t i, j, k, stripe, locks = 0;
+    rwlock_t *lock;
+    int ret = 0;
+
+    if (n > MAX_BATCH_KEYS)
+    {
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        hashes[i] = hash_key(table, keys[i]);
+        stripe = table->swiss ? swiss_lock_of(table, hashes[i])
+                              : hashes[i] & (table->num_locks - 1);
+        order[i] = (uint64_t)stripe << 32 | i;
+    }
+    qsort(order, n, sizeof(order[0]), batch_cmp);
+
+    for (i = 0; i < n && ret == 0; i = j)
+    {
+        stripe = order[i] >> 32;
+        lock = &table->locks[stripe].lock;
+        rwlock_write_lock(lock);
+        locks++;
+        for (j = i; j < n && order[j] >> 32 == stripe; j++)
+        {
+            k = order[j] & 0xFFFFFFFF;
+            if (ret == 0)
+            {
+                ret = table->swiss
+                          ? swiss_set(table, hashes[k], keys[k], values[k])
+                          : chain_set(table, hashes[k], keys[k], values[k]);
+            }
+        }
+        rwlock_write_unlock(lock);
+        if (!table->swiss)
+        {
+            hash_grow(table);
+        }
+    }
+    __atomic_add_fetch(&table->batch_keys, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&table->batch_locks, locks, __ATOMIC_RELAXED);
+
+    hash_evict(table);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/* prints the non-empty buckets of one array */
+static void
+array_dump(hashtable_t *table, hash_array_t *array)
+{
+    node_t *node;
+    size_t i;
 
-    for (i = 0; i < table->hash_size; i++)
+    for (i = 0; i < array->size; i++)
     {
-        if (!table->bucket_sizes[i])
+        if (!array->bucket_sizes[i])
         {
             continue;
         }
-        printf("Bucket %d: %ld entries\n", i, table->bucket_sizes[i]);
+        printf("Bucket %ld: %ld entries\n", i, array->bucket_sizes[i]);
         printf("  Lock State -> Read Count: %d, Write Count: %d\n",
-               table->locks[i].read_count, table->locks[i].write_count);
-        node = table->buckets[i];
+               lock_of(table, i)->read_count, lock_of(table, i)->write_count);
+        node = array->buckets[i];
         while (node)
         {
             printf("    Key:   %s\n"
@@ -304,5 +1996,35 @@ void hash_dump(hashtable_t *table)
             node = node->next;
         }
     }
+}
+/*---------------------------------------------------------------------------*/
+/* function to dump the contents of the hash table, including locks status */
+void hash_dump(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct hash_stats stats;
+
+    printf("[Hash Table Dump]");
+    printf("Total Entries: %ld\n", table->total_entries);
+    slab_dump();
+    hash_stats(table, &stats);
+    printf("Memory: %zu KB of entries, limit %zu KB, %lu hits, %lu misses, "
+           "%lu evictions, %lu expired\n", stats.mem_used >> 10,
+           stats.mem_limit >> 10, stats.hits, stats.misses, stats.evictions,
+           stats.expired);
+
+    if (table->swiss)
+    {
+        swiss_dump(table);
+        printf("End of Dump\n");
+        return;
+    }
+    if (table->old)
+    {
+        printf("Resizing: %ld of %ld old buckets moved\n",
+               table->migrate_next, table->old->size);
+        array_dump(table, table->old);
+    }
+    array_dump(table, table->cur);
     printf("End of Dump\n");
-}
\ No newline at end of file
+}
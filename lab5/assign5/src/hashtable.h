@@ -8,27 +8,142 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "rwlock.h"
+#include "epoch.h"
 #include "common.h"
+#include "timer.h"
+#include "skiplist.h"
 /*---------------------------------------------------------------------------*/
 #define DEFAULT_HASH_SIZE 1024
+/* lock stripes when hash_opts_t leaves num_locks at 0 */
+#define DEFAULT_LOCK_STRIPES 1024
+/* grow the table once it holds more entries per bucket than this */
+#define HASH_MAX_LOAD 2
+/* old buckets moved to the grown table after each write */
+#define HASH_MIGRATE_STEP 4
+/* turns of the clock hand an eviction makes at most. the first turn
+ * may only clear the reference bits. */
+#define HASH_EVICT_TURNS 2
+/*---------------------------------------------------------------------------*/
+/* table engines */
+enum HASH_ENGINE
+{
+    HASH_ENGINE_CHAIN,  // separate chaining, one node per entry
+    HASH_ENGINE_SWISS,  // open addressing with inline keys (swiss.c)
+};
+/*---------------------------------------------------------------------------*/
+/* writes reported to the write hook */
+enum HASH_OP
+{
+    HASH_OP_INSERT,
+    HASH_OP_UPDATE,
+    HASH_OP_DELETE,
+    HASH_OP_EXPIRE,     // value is the new deadline in decimal, 0 for none
+};
+/* called after every successful write, under the lock of the key, so the
+ * calls for one key come in the order the writes took effect.
+ * value is NULL for HASH_OP_DELETE. */
+typedef void (*hash_write_hook_t)(void *arg, int op,
+                                  const char *key, const char *value);
+/* called by hash_foreach() for every entry. a non-zero return stops it,
+ * but not hash_scan(), which ignores it.
+ * key is not always null-terminated, so use key_len. value is a value
+ * of the table, see hash_value_expires(). */
+typedef int (*hash_visit_t)(void *arg, const char *key, size_t key_len,
+                            const char *value, size_t value_len);
+/*---------------------------------------------------------------------------*/
+/* options of hash_init_opts() */
+typedef struct hash_opts_t
+{
+    size_t hash_size;   // initial number of buckets
+    size_t num_locks;   // lock stripes, 0 picks DEFAULT_LOCK_STRIPES
+    int delay;          // rwlock delay for semantic tests
+    int lock_mode;      // enum RWLOCK_MODE of the stripes
+    int engine;         // enum HASH_ENGINE
+    uint64_t seed;      // hash seed, 0 picks a random one
+    size_t mem_limit;   // bytes of entries before eviction, 0 for no limit
+    int ordered;        // keep an ordered index for hash_range()
+} hash_opts_t;
 /*---------------------------------------------------------------------------*/
 typedef struct node_t
 {
-    char *key;
-    size_t key_size;
+    uint64_t hash;          // hash64() of the key, compared before the key
+    char *key;              // stored right behind the node
+    uint32_t key_size;      // at most MAX_KEY_LEN, leaves room for the bit
+    uint8_t referenced;     // set by readers, cleared by the clock hand
     char *value;
     size_t value_size;
     struct node_t *next;
 } node_t;
 /*---------------------------------------------------------------------------*/
-typedef struct hashtable_t
+/* a lock stripe, padded to a cache line of its own so that writers
+ * of neighbouring stripes do not bounce each other's line */
+typedef struct lock_stripe_t
+{
+    rwlock_t lock;
+} __attribute__((aligned(64))) lock_stripe_t;
+/*---------------------------------------------------------------------------*/
+/* one generation of buckets. the number of buckets is a power of two
+ * and a multiple of the number of locks, so bucket i is always guarded
+ * by locks[i % num_locks], whatever the generation. */
+typedef struct hash_array_t
 {
     node_t **buckets;
-    rwlock_t *locks;
     size_t *bucket_sizes; // number of entries in each bucket
+    size_t size;
+} hash_array_t;
+/*---------------------------------------------------------------------------*/
+struct swiss;
+struct hash_counters;
+/*---------------------------------------------------------------------------*/
+/* counters of hash_stats() */
+struct hash_stats
+{
+    size_t entries;
+    size_t mem_used;            // bytes of entries, see hash_entry_bytes()
+    size_t mem_limit;           // 0 without a limit
+    unsigned long hits;         // searches that found their key
+    unsigned long misses;       // searches that did not
+    unsigned long evictions;    // entries evicted to stay under the limit
+    unsigned long expired;      // entries dropped after their deadline
+    unsigned long batch_keys;   // keys written by hash_set_many()
+    unsigned long batch_locks;  // stripe locks it took for them
+};
+/*---------------------------------------------------------------------------*/
+typedef struct hashtable_t
+{
+    struct swiss *swiss;    // open addressing engine, or NULL for chaining
+
+    hash_array_t *cur;      // buckets new entries go to
+    hash_array_t *old;      // buckets being moved to cur, or NULL
+    size_t migrate_next;    // next old bucket to move
+    pthread_mutex_t resize_lock; // held while resizing or evicting
+
+    lock_stripe_t *locks;
+    size_t num_locks;       // power of two, at most hash_size
     size_t total_entries;
-    size_t hash_size;
+    size_t hash_size;       // initial number of buckets
+    uint64_t seed;          // seed of hash64()
+
+    size_t mem_limit;       // evict above this many bytes, 0 for no limit
+    size_t mem_used;        // bytes of all entries
+    size_t clock_hand;      // next bucket the eviction looks at
+    unsigned long evictions;
+    unsigned long id;       // tells the tables apart for the counters
+    struct hash_counters *counters; // search counters of every thread
+
+    timer_wheel_t *timers;  // deadlines of the keys, see hash_expire()
+    int expiry_held;        // see hash_expiry_hold()
+    unsigned long expired;
+    unsigned long batch_keys;   // see hash_set_many()
+    unsigned long batch_locks;
+
+    hash_write_hook_t write_hook;   // see hash_set_write_hook()
+    void *write_arg;
+
+    skiplist_t *index;      // keys in order, or NULL, see hash_range()
 } hashtable_t;
 /*---------------------------------------------------------------------------*/
 /**
@@ -37,10 +152,264 @@ typedef struct hashtable_t
 int hash(const char *key, size_t hash_size);
 /*---------------------------------------------------------------------------*/
 /**
- * initializes a hash table
+ * calculates a seeded 64-bit hash of len bytes, 16 bytes per step.
+ * bucket indices are taken from the low bits, and so are the
+ * fingerprints of the open addressing engine.
+ */
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+/*---------------------------------------------------------------------------*/
+/**
+ * initializes a hash table with hash_size buckets rounded up to a power
+ * of two, guarded by DEFAULT_LOCK_STRIPES locks or fewer. the table
+ * doubles its buckets whenever it holds more than HASH_MAX_LOAD entries
+ * per bucket, and the writers move the entries over a few buckets at a
+ * time.
  */
 hashtable_t *hash_init(size_t hash_size, int delay);
 /*---------------------------------------------------------------------------*/
+/**
+ * same as hash_init(), but also selects the engine, the number of
+ * lock stripes and their implementation. the stripes are rounded up to
+ * a power of two and capped at the number of buckets. with a memory
+ * limit, writes evict entries once the entries take more bytes than
+ * that (hash_evict()).
+ * every other function works the same for both engines.
+ */
+hashtable_t *hash_init_opts(const hash_opts_t *opts);
+/*---------------------------------------------------------------------------*/
+/**
+ * makes every later successful insert, update and delete call
+ * hook(arg, ...), or no hook when hook is NULL. it returns once no
+ * expiry of the timer thread still calls the previous hook.
+ * otherwise only call it while no other thread uses the table.
+ */
+void hash_set_write_hook(hashtable_t *table, hash_write_hook_t hook,
+                         void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds a key to the ordered index of table, or removes it.
+ */
+void hash_index_update(hashtable_t *table, int op, const char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * reports a write to the ordered index and the write hook of table,
+ * if any. the table engines call it while they hold the lock of key,
+ * so the index sees the writes of a key in order too.
+ */
+static inline void
+hash_report(hashtable_t *table, int op, const char *key, const char *value)
+{
+    /* the timer thread may write while the hook is being set */
+    hash_write_hook_t hook = __atomic_load_n(&table->write_hook,
+                                             __ATOMIC_ACQUIRE);
+
+    if (table->index && (op == HASH_OP_INSERT || op == HASH_OP_DELETE))
+    {
+        hash_index_update(table, op, key);
+    }
+    if (hook)
+    {
+        hook(table->write_arg, op, key, value);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the bytes an entry takes in table, the node or slot, the key
+ * and the value, without the rounding of the allocator.
+ */
+size_t hash_entry_bytes(hashtable_t *table, size_t key_len, size_t value_len);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds the bytes of a written entry to the memory of table, and takes
+ * away the bytes of the entry it replaced. the table engines call it for
+ * every insert, update, delete and eviction.
+ */
+static inline void
+hash_account(hashtable_t *table, size_t added, size_t removed)
+{
+    /* wraps around when removed is larger, which subtracts */
+    __atomic_add_fetch(&table->mem_used, added - removed, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * returns 1 when the entries of table take more bytes than its limit.
+ */
+static inline int
+hash_over_limit(hashtable_t *table)
+{
+    return table->mem_limit &&
+           __atomic_load_n(&table->mem_used, __ATOMIC_RELAXED) >
+               table->mem_limit;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * counts an entry of bytes evicted by the table engine, and reports it
+ * to the write hook as a delete. the engine calls it while it holds the
+ * lock of key, after the entry is unlinked.
+ */
+void hash_evicted(hashtable_t *table, const char *key, size_t bytes);
+/*---------------------------------------------------------------------------*/
+/**
+ * same as hash_evicted(), for an entry dropped because its deadline
+ * passed, by a write that found it or by the timer thread.
+ */
+void hash_expired(hashtable_t *table, const char *key, size_t bytes);
+/*---------------------------------------------------------------------------*/
+/**
+ * gives the value of key the deadline expires, reports it to the write
+ * hook and schedules its timer. the table engines call it while they hold
+ * the lock of key, after value is in the table.
+ */
+void hash_ttl_set(hashtable_t *table, const char *key, const char *value,
+                  uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * marks an entry as recently used for the clock hand of hash_evict().
+ * readers only write the bit when it is clear, so that a hot entry does
+ * not bounce its cache line between them.
+ */
+static inline void
+hash_touch(hashtable_t *table, uint8_t *referenced)
+{
+    if (table->mem_limit && !__atomic_load_n(referenced, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(referenced, 1, __ATOMIC_RELAXED);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * evicts entries until the table is under its memory limit, with CLOCK:
+ * a hand sweeps the entries, clears the bit of a recently read one and
+ * evicts one that was not read since the hand last passed it. evictions
+ * are reported to the write hook as deletes. only one thread evicts at
+ * a time; the others skip it. the table engines call it after a write
+ * that added memory released its lock.
+ */
+void hash_evict(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * fills stats with the counters of table. searches are counted per
+ * thread, so a READ never writes a shared cache line for them.
+ */
+void hash_stats(hashtable_t *table, struct hash_stats *stats);
+/*---------------------------------------------------------------------------*/
+/**
+ * takes the write lock of every stripe, and stops resizing, so that no
+ * write is in flight and none starts until hash_unlock_all().
+ * lock-free readers are not affected.
+ */
+void hash_lock_all(hashtable_t *table);
+void hash_unlock_all(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * calls visit for every entry, bucket by bucket (shard by shard for the
+ * open addressing engine). it takes no lock, so only call it while no
+ * thread writes the table, e.g. under hash_lock_all() or in a child
+ * forked under it.
+ * returns the non-zero value of visit that stopped the walk.
+ * returns 0 when every entry was visited.
+ */
+int hash_foreach(hashtable_t *table, hash_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * visits the entries of up to steps buckets, starting at cursor, which
+ * is 0 for the first call. each bucket is visited under the read lock of
+ * its stripe, so writers of the other stripes never wait. with the open
+ * addressing engine a step is a group of slots of one shard.
+ * the buckets are taken in the order of their reversed index bits, so
+ * that an entry that stays in the table for the whole scan is visited
+ * at least once, even when the table grows between the calls. an entry
+ * may be visited more than once.
+ * returns the cursor of the next call, 0 once the scan is complete.
+ */
+uint64_t hash_scan(hashtable_t *table, uint64_t cursor, size_t steps,
+                   hash_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * calls visit for the keys from start up to end, end excluded, in the
+ * byte order of the keys, until visit returns non-zero or limit keys
+ * were visited. end may be NULL for no end. the table must have been
+ * created with an ordered index (hash_opts_t). keys written meanwhile
+ * may or may not be visited, and nothing is locked.
+ * returns -1 without an index or when any internal errors occur.
+ * returns the number of keys visited on success.
+ */
+long hash_range(hashtable_t *table, const char *start, const char *end,
+                size_t limit, skiplist_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * same as hash_range(), for the keys that start with prefix.
+ */
+long hash_prefix(hashtable_t *table, const char *prefix, size_t limit,
+                 skiplist_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/* reverses the bits of v */
+static inline uint64_t
+hash_rev64(uint64_t v)
+{
+    v = (v >> 1 & 0x5555555555555555ULL) | (v & 0x5555555555555555ULL) << 1;
+    v = (v >> 2 & 0x3333333333333333ULL) | (v & 0x3333333333333333ULL) << 2;
+    v = (v >> 4 & 0x0F0F0F0F0F0F0F0FULL) | (v & 0x0F0F0F0F0F0F0F0FULL) << 4;
+
+    return __builtin_bswap64(v);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the cursor that follows cursor for hash_scan() over a power of
+ * two buckets, mask being their number minus one. it increments the high
+ * bits of the index first, so the buckets that a doubling splits off a
+ * visited bucket come after it, and 0 follows the last bucket.
+ */
+static inline uint64_t
+hash_scan_next(uint64_t cursor, uint64_t mask)
+{
+    uint64_t v = cursor | ~mask;
+
+    /* reverse the bits, increment and reverse them back */
+    v = hash_rev64(v);
+    v++;
+
+    return hash_rev64(v);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * prepares an empty table for hash_bulk_insert(). the table adopts seed,
+ * so that keys hash the way they did where the loaded data was built,
+ * and makes room for entries without resizing.
+ * returns -1 when any internal errors occur, or the table is not empty.
+ * returns 0 on success.
+ */
+int hash_bulk_begin(hashtable_t *table, size_t entries, uint64_t seed);
+/*---------------------------------------------------------------------------*/
+/**
+ * inserts a key of klen bytes whose hash64() is h, with a value of vlen
+ * bytes. neither needs a NUL. it takes no lock, checks no collision and
+ * reports nothing to the write hook, only to the ordered index, so only
+ * use it to load a table nobody serves yet, with unique keys. threads
+ * may insert at the same time as long as no two insert keys of the same
+ * part (hash_part_of()).
+ * returns -1 when any internal errors occur.
+ * returns 1 on success.
+ */
+int hash_bulk_insert(hashtable_t *table, uint64_t h, const char *key,
+                     size_t klen, const char *value, size_t vlen,
+                     uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds the n entries inserted by hash_bulk_insert() to the entry count,
+ * and lets their deadlines expire. the loader calls it once, after every
+ * loading thread is done.
+ */
+void hash_bulk_end(hashtable_t *table, size_t n);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the part of the table that holds keys of hash h. there is one
+ * part per lock stripe, and writes to different parts never touch the
+ * same memory. the part only depends on the low hash_part_bits() bits.
+ */
+size_t hash_part_of(hashtable_t *table, uint64_t h);
+int hash_part_bits(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
 /**
  * destroys a hash table
  */
@@ -55,14 +424,85 @@ int hash_destroy(hashtable_t *table);
 int hash_insert(hashtable_t *table, const char *key, const char *value);
 /*---------------------------------------------------------------------------*/
 /**
- * searches a key-value pair in the hash table,
+ * same as hash_insert(), but the key expires at the deadline expires,
+ * in milliseconds of timer_now(), or never when it is 0. a key whose
+ * deadline passed is not found by any function, and is replaced here.
+ */
+int hash_insert_ttl(hashtable_t *table, const char *key, const char *value,
+                    uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * searches a key-value pair in the hash table without taking a lock,
  * and modify the given value pointer to point found value.
+ * the value may be freed by a concurrent update or delete as soon as
+ * the caller leaves its read section, so call it between epoch_enter()
+ * and epoch_exit(), or use hash_search_pin() instead.
  * returns -1 when any internal errors occur.
  * returns 1 when successfully found.
  * returns 0 when there is no such key found.
  */
 int hash_search(hashtable_t *table, const char *key, const char **value);
 /*---------------------------------------------------------------------------*/
+/**
+ * same as hash_search(), but also pins the found value and returns
+ * its length. needs no read section of the caller. a pinned value
+ * stays valid even if the key is updated or deleted, until it is
+ * released by hash_value_unpin().
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully found.
+ * returns 0 when there is no such key found.
+ */
+int hash_search_pin(hashtable_t *table, const char *key,
+                    const char **value, size_t *len);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases a value pinned by hash_search_pin().
+ */
+void hash_value_unpin(const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates a reference-counted copy of value for the table engines.
+ * the caller owns the only reference.
+ * returns NULL when any internal errors occur.
+ */
+char *hash_value_new(const char *value, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds a reference to a value, like hash_search_pin() does.
+ */
+void hash_value_pin(const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the length of a value.
+ */
+size_t hash_value_len(const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * sets the deadline of a value before it goes into the table, without
+ * reporting it like hash_ttl_set() does.
+ */
+void hash_value_set_expires(char *value, uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the deadline of a value of the table, 0 for none.
+ */
+uint64_t hash_value_expires(const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns 1 when the deadline of a value of table has passed,
+ * unless expiry is held (hash_expiry_hold()).
+ */
+int hash_value_expired(hashtable_t *table, const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * keeps every key from expiring, by the timer thread or on access, until
+ * hash_expiry_release(), so that replaying writes finds each key the way
+ * the writes left it, whatever the clock says. holds nest.
+ * only call it while no other thread uses the table.
+ */
+void hash_expiry_hold(hashtable_t *table);
+void hash_expiry_release(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
 /**
  * updates a key-value pair in the hash table.
  * returns -1 when any internal errors occur.
@@ -71,6 +511,24 @@ int hash_search(hashtable_t *table, const char *key, const char **value);
  */
 int hash_update(hashtable_t *table, const char *key, const char *value);
 /*---------------------------------------------------------------------------*/
+/**
+ * same as hash_update(), but also sets a new deadline, like
+ * hash_insert_ttl(). the key keeps its deadline when expires is 0.
+ */
+int hash_update_ttl(hashtable_t *table, const char *key, const char *value,
+                    uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * sets the deadline of a key, or removes it when expires is 0.
+ * the timer thread deletes the key once the deadline passed, in O(1)
+ * with a timer wheel (timer.h), and every access before that treats
+ * it as gone.
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully set.
+ * returns 0 when there is no such key found.
+ */
+int hash_expire(hashtable_t *table, const char *key, uint64_t expires);
+/*---------------------------------------------------------------------------*/
 /**
  * deletes a key-value pair from the hash table.
  * returns -1 when any internal errors occur.
@@ -79,6 +537,33 @@ int hash_update(hashtable_t *table, const char *key, const char *value);
  */
 int hash_delete(hashtable_t *table, const char *key);
 /*---------------------------------------------------------------------------*/
+/**
+ * searches n keys like hash_search_pin() does for each, in one read
+ * section. all keys are hashed and their buckets prefetched before the
+ * first is walked, so that the cache misses of the batch overlap.
+ * values[i] is set to the pinned value of keys[i] and lens[i] to its
+ * length, or values[i] to NULL when keys[i] is not found.
+ * n is at most MAX_BATCH_KEYS.
+ * returns -1 when any internal errors occur; nothing is pinned then.
+ * returns the number of keys found on success.
+ */
+int hash_search_many(hashtable_t *table, const char *const *keys, size_t n,
+                     const char **values, size_t *lens);
+/*---------------------------------------------------------------------------*/
+/**
+ * sets n keys to their values, inserting the missing ones and updating
+ * the others like hash_update(), so a key keeps its deadline.
+ * the keys are grouped by lock stripe, and each stripe is locked once
+ * for all of its keys, which are set in the given order, so the last
+ * of equal keys wins. the batch is not atomic: a reader may find some
+ * of its keys set and others not yet. n is at most MAX_BATCH_KEYS.
+ * returns -1 when any internal errors occur; keys of other stripes
+ * may have been set.
+ * returns 0 on success.
+ */
+int hash_set_many(hashtable_t *table, const char *const *keys,
+                  const char *const *values, size_t n);
+/*---------------------------------------------------------------------------*/
 /**
  * dump the hash table
  */
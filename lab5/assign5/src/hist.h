@@ -0,0 +1,69 @@
+/*---------------------------------------------------------------------------*/
+/* hist.h                                                                    */
+/* Latency histograms of the benchmarks                                      */
+/*---------------------------------------------------------------------------*/
+#ifndef _HIST_H
+#define _HIST_H
+/*---------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdint.h>
+/*---------------------------------------------------------------------------*/
+/* latency histogram, in the manner of HdrHistogram: values below
+ * 2^HIST_SUB_BITS are exact, and every power of two above is split into
+ * 2^(HIST_SUB_BITS - 1) buckets, so a bucket is within 1/128 of its
+ * values, from nanoseconds up to hours. */
+#define HIST_SUB_BITS 8
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * HIST_HALF)
+/*---------------------------------------------------------------------------*/
+static inline int
+hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < 2 * HIST_HALF)
+    {
+        return v;
+    }
+    shift = 63 - __builtin_clzll(v) - (HIST_SUB_BITS - 1);
+
+    return shift * HIST_HALF + (v >> shift);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the highest value of bucket idx */
+static inline uint64_t
+hist_value(int idx)
+{
+    int shift;
+
+    if (idx < 2 * HIST_HALF)
+    {
+        return idx;
+    }
+    shift = idx / HIST_HALF - 1;
+
+    return ((uint64_t)(idx % HIST_HALF + HIST_HALF) << shift) +
+           ((1ULL << shift) - 1);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the value at or below which the fraction q of the values lie */
+static inline uint64_t
+hist_percentile(const uint64_t *hist, uint64_t total, double q)
+{
+    uint64_t rank = (uint64_t)ceil(q * total), seen = 0;
+    int i;
+
+    rank = rank ? rank : 1;
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist[i];
+        if (seen >= rank)
+        {
+            return hist_value(i);
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+#endif // _HIST_H
@@ -0,0 +1,606 @@
+/*---------------------------------------------------------------------------*/
+/* reactor.c                                                                 */
+/* Edge-triggered epoll event loop for SKVS worker threads                   */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "reactor.h"
+/*---------------------------------------------------------------------------*/
+/* per-connection state, owned by exactly one worker */
+struct conn
+{
+    int fd;
+    int rblocked;           // input left unread because of pending output
+
+    /* input, may end with an incomplete command */
+    char rbuf[SKVS_RBUF_SIZE];
+    size_t rlen;
+
+    /* pending output */
+    struct skvs_resp out;
+
+    /* requests of a sharded worker, answered in this order. a ring of
+     * SHARD_MAX_INFLIGHT, allocated on first use. */
+    struct skvs_req **queue;
+    int qhead;
+    int qcount;
+    int remote;             // requests of the queue at other shards
+    int closed;             // freed once the remote requests are back
+    struct conn *dirty;     // next connection with answers back, or self
+
+    /* list of the worker's connections */
+    struct conn *prev;
+    struct conn *next;
+};
+/*---------------------------------------------------------------------------*/
+static int
+set_nonblocking(int fd)
+{
+    TRACE_PRINT();
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0)
+    {
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int reactor_setup(int listenfd)
+{
+    TRACE_PRINT();
+    struct rlimit rl;
+
+    if (set_nonblocking(listenfd) < 0)
+    {
+        DEBUG_PRINT("Failed to make listening socket non-blocking");
+        return -1;
+    }
+
+    /* one fd per connection: allow as many as the hard limit permits */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        {
+            DEBUG_PRINT("Failed to raise the open file limit");
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+conn_close(struct conn **head, struct conn *c, int force)
+{
+    TRACE_PRINT();
+    int i;
+
+    /* closing the fd also removes it from the epoll interest list */
+    if (!c->closed)
+    {
+        close(c->fd);
+        c->closed = 1;
+    }
+    if (c->remote > 0 && !force)
+    {
+        /* other shards still hold requests of the connection, and will
+         * send them back to it */
+        return;
+    }
+
+    /* requests still at other shards are freed by shard_group_free() */
+    for (i = 0; i < c->qcount; i++)
+    {
+        if (c->queue[(c->qhead + i) % SHARD_MAX_INFLIGHT]->done)
+        {
+            skvs_req_free(c->queue[(c->qhead + i) % SHARD_MAX_INFLIGHT]);
+        }
+    }
+    free(c->queue);
+
+    if (c->prev)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        *head = c->next;
+    }
+    if (c->next)
+    {
+        c->next->prev = c->prev;
+    }
+
+    skvs_resp_free(&c->out);
+    free(c);
+}
+/*---------------------------------------------------------------------------*/
+/* sends as much pending output as the socket accepts.
+ * returns -1 when the connection is broken, 0 otherwise. */
+static int
+conn_flush(struct conn *c)
+{
+    TRACE_PRINT();
+    struct msghdr msg;
+    ssize_t sent;
+    int cnt;
+
+    memset(&msg, 0, sizeof(msg));
+    while (c->out.len > 0)
+    {
+        /* gather the responses straight from messages and pinned values */
+        cnt = c->out.cnt - c->out.head;
+        msg.msg_iov = c->out.iov + c->out.head;
+        msg.msg_iovlen = cnt < IOV_MAX ? cnt : IOV_MAX;
+        sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* wait for EPOLLOUT */
+                return 0;
+            }
+            return -1;
+        }
+        skvs_resp_consume(&c->out, sent);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* appends the answers at the front of the queue of c that are back.
+ * returns -1 when any internal errors occur, 0 otherwise. */
+static int
+conn_answer(struct conn *c)
+{
+    TRACE_PRINT();
+    struct skvs_req *req;
+    int ret;
+
+    while (c->qcount > 0 && c->queue[c->qhead]->done)
+    {
+        req = c->queue[c->qhead];
+        c->qhead = (c->qhead + 1) % SHARD_MAX_INFLIGHT;
+        c->qcount--;
+        ret = skvs_resp_req(&c->out, req);
+        skvs_req_free(req);
+        if (ret < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* serves the complete requests in the input of c on a sharded worker.
+ * a request for a key of another shard is sent there, and the requests
+ * behind it are queued until its answer is back, so that the answers
+ * keep their order. requests for keys of this shard still run at once,
+ * since they cannot touch the same key.
+ * returns -1 when the connection should be closed, 0 otherwise. */
+static int
+conn_serve_shard(struct shard *shard, struct conn *c)
+{
+    TRACE_PRINT();
+    static __thread union
+    {
+        struct skvs_req req;
+        char mem[SKVS_REQ_MAX];
+    } scratch;
+    struct skvs_req *req = &scratch.req, *copy;
+    struct shard *owner;
+    size_t off = 0;
+    ssize_t used;
+
+    while (off < c->rlen && c->qcount < SHARD_MAX_INFLIGHT)
+    {
+        used = skvs_parse_req(c->rbuf + off, c->rlen - off, req);
+        if (used < 0)
+        {
+            return -1;
+        }
+        if (used == 0)
+        {
+            break;
+        }
+        off += used;
+
+        owner = req->key[0] ? shard_owner(shard->group, req->key) : shard;
+        if (owner == shard && c->qcount == 0)
+        {
+            /* nothing to wait for */
+            skvs_exec_req(shard->ctx, req);
+            if (skvs_resp_req(&c->out, req) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        if (c->queue == NULL)
+        {
+            c->queue = malloc(SHARD_MAX_INFLIGHT * sizeof(*c->queue));
+            if (c->queue == NULL)
+            {
+                return -1;
+            }
+        }
+        copy = skvs_req_dup(req);
+        if (copy == NULL)
+        {
+            return -1;
+        }
+        c->queue[(c->qhead + c->qcount) % SHARD_MAX_INFLIGHT] = copy;
+        c->qcount++;
+
+        if (owner == shard)
+        {
+            skvs_exec_req(shard->ctx, copy);
+            copy->done = 1;
+        }
+        else
+        {
+            copy->conn = c;
+            copy->from = shard->idx;
+            c->remote++;
+            shard->forwarded++;
+            shard_post(shard, owner, copy);
+        }
+    }
+
+    /* keep the incomplete command at the front */
+    c->rlen -= off;
+    memmove(c->rbuf, c->rbuf + off, c->rlen);
+
+    return conn_answer(c);
+}
+/*---------------------------------------------------------------------------*/
+/* drains the socket (edge-triggered) and serves every complete request.
+ * the responses to everything read are sent together at the end.
+ * returns -1 when the connection should be closed, 0 otherwise. */
+static int
+conn_on_readable(struct skvs_ctx *ctx, struct shard *shard, struct conn *c)
+{
+    TRACE_PRINT();
+    ssize_t len, used;
+
+    c->rblocked = 0;
+    if (shard && conn_serve_shard(shard, c) < 0)
+    {
+        /* the requests left behind when the queue was full */
+        return -1;
+    }
+    while (1)
+    {
+        if (c->out.len >= REACTOR_MAX_PENDING)
+        {
+            if (conn_flush(c) < 0)
+            {
+                return -1;
+            }
+            if (c->out.len >= REACTOR_MAX_PENDING)
+            {
+                /* the peer does not read its responses, resume on EPOLLOUT */
+                c->rblocked = 1;
+                return 0;
+            }
+        }
+        if (c->qcount >= SHARD_MAX_INFLIGHT)
+        {
+            /* resume once answers are back from the other shards */
+            c->rblocked = 1;
+            break;
+        }
+
+        len = recv(c->fd, c->rbuf + c->rlen, SKVS_RBUF_SIZE - c->rlen, 0);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return -1;
+        }
+        if (len == 0)
+        {
+            /* peer closed the connection */
+            return -1;
+        }
+
+        c->rlen += len;
+        if (shard)
+        {
+            if (conn_serve_shard(shard, c) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        used = skvs_serve_iov(ctx, c->rbuf, c->rlen, &c->out, NULL);
+        if (used < 0)
+        {
+            return -1;
+        }
+
+        /* keep the incomplete command at the front */
+        c->rlen -= used;
+        memmove(c->rbuf, c->rbuf + used, c->rlen);
+    }
+
+    return conn_flush(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+accept_all(int epfd, int listenfd, struct conn **head, int nodelay)
+{
+    TRACE_PRINT();
+    struct epoll_event ev;
+    struct conn *c;
+    int fd;
+
+    while (1)
+    {
+        fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept failed");
+            }
+            return;
+        }
+
+        c = calloc(1, sizeof(struct conn));
+        if (c == NULL)
+        {
+            DEBUG_PRINT("Failed to allocate connection");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        /* answers from other shards leave in several small sends, which
+         * Nagle would hold back until the client acknowledges the first */
+        if (nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1},
+                                  sizeof(int)) < 0)
+        {
+            DEBUG_PRINT("Failed to set TCP_NODELAY");
+        }
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            perror("epoll_ctl failed");
+            close(fd);
+            free(c);
+            continue;
+        }
+
+        c->next = *head;
+        if (*head)
+        {
+            (*head)->prev = c;
+        }
+        *head = c;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* handles the inbox of a sharded worker: serves the requests other
+ * shards sent for its keys, and answers the connections whose requests
+ * came back. */
+static void
+shard_on_inbox(struct shard *shard, struct conn **head)
+{
+    TRACE_PRINT();
+    struct skvs_req *req, *next;
+    struct conn *dirty = NULL, *c;
+
+    for (req = shard_receive(shard); req; req = next)
+    {
+        next = req->next;
+        if (req->from != shard->idx)
+        {
+            /* a request for a key of this shard, answer it at once */
+            skvs_exec_req(shard->ctx, req);
+            shard->served++;
+            shard_post(shard, &shard->group->shards[req->from], req);
+            continue;
+        }
+
+        /* the answer to a request of ours */
+        c = req->conn;
+        req->done = 1;
+        c->remote--;
+        if (c->dirty == NULL)
+        {
+            /* the last one points at itself */
+            c->dirty = dirty ? dirty : c;
+            dirty = c;
+        }
+    }
+
+    /* one send per connection for all of its answers */
+    while (dirty)
+    {
+        c = dirty;
+        dirty = c->dirty != c ? c->dirty : NULL;
+        c->dirty = NULL;
+        if (c->closed)
+        {
+            if (c->remote == 0)
+            {
+                conn_close(head, c, 0);
+            }
+            continue;
+        }
+        if (conn_answer(c) < 0 || conn_flush(c) < 0)
+        {
+            conn_close(head, c, 0);
+            continue;
+        }
+        if (c->rblocked && c->qcount < SHARD_MAX_INFLIGHT &&
+            c->out.len < REACTOR_MAX_PENDING &&
+            conn_on_readable(shard->ctx, shard, c) < 0)
+        {
+            conn_close(head, c, 0);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* runs the event loop of reactor_run() or reactor_run_shard() */
+static int
+reactor_loop(struct skvs_ctx *ctx, struct shard *shard, int listenfd,
+             int idx, volatile sig_atomic_t *shutdown)
+{
+    TRACE_PRINT();
+    struct epoll_event ev, events[REACTOR_MAX_EVENTS];
+    struct conn *head = NULL, *c;
+    int epfd, n, i, inbox, ret = 0;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        perror("epoll_create1 failed");
+        return -1;
+    }
+
+    /* wake up only one of the workers per incoming connection */
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+    {
+        perror("epoll_ctl failed");
+        close(epfd);
+        return -1;
+    }
+    if (shard)
+    {
+        /* the inbox is told apart from the connections by its pointer */
+        ev.events = EPOLLIN;
+        ev.data.ptr = shard;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, shard->efd, &ev) < 0)
+        {
+            perror("epoll_ctl failed");
+            close(epfd);
+            return -1;
+        }
+    }
+
+    while (!*shutdown)
+    {
+        n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, TIMEOUT * 1000);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait failed");
+            ret = -1;
+            break;
+        }
+
+        inbox = 0;
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                accept_all(epfd, listenfd, &head, shard != NULL);
+                continue;
+            }
+            if (shard && c == (struct conn *)shard)
+            {
+                /* last, since it may free connections with events */
+                inbox = 1;
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                conn_close(&head, c, 0);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                if (conn_flush(c) < 0)
+                {
+                    conn_close(&head, c, 0);
+                    continue;
+                }
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) ||
+                (c->rblocked && c->out.len == 0))
+            {
+                if (conn_on_readable(ctx, shard, c) < 0)
+                {
+                    conn_close(&head, c, 0);
+                }
+            }
+        }
+        if (inbox)
+        {
+            shard_on_inbox(shard, &head);
+        }
+        if (shard)
+        {
+            /* everything this round sent to a shard, in one go */
+            shard_flush(shard);
+        }
+    }
+
+    DEBUG_PRINT("Worker %d: closing connections", idx);
+    while (head)
+    {
+        conn_close(&head, head, 1);
+    }
+    close(epfd);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int reactor_run(struct skvs_ctx *ctx, int listenfd, int idx,
+                volatile sig_atomic_t *shutdown)
+{
+    TRACE_PRINT();
+
+    return reactor_loop(ctx, NULL, listenfd, idx, shutdown);
+}
+/*---------------------------------------------------------------------------*/
+int reactor_run_shard(struct shard *shard, int listenfd,
+                      volatile sig_atomic_t *shutdown)
+{
+    TRACE_PRINT();
+
+    return reactor_loop(shard->ctx, shard, listenfd, shard->idx, shutdown);
+}
@@ -0,0 +1,48 @@
+/*---------------------------------------------------------------------------*/
+/* reactor.h                                                                 */
+/* Edge-triggered epoll event loop for SKVS worker threads                   */
+/*---------------------------------------------------------------------------*/
+#ifndef _REACTOR_H
+#define _REACTOR_H
+/*---------------------------------------------------------------------------*/
+#include <signal.h>
+#include "skvslib.h"
+#include "shard.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* max events fetched by one epoll_wait() */
+#define REACTOR_MAX_EVENTS 256
+/* stop reading from a connection while this many bytes wait to be sent */
+#define REACTOR_MAX_PENDING (1 << 20)
+/*---------------------------------------------------------------------------*/
+/**
+ * prepares the shared listening socket for the event-driven modes.
+ * the socket is switched to non-blocking mode and the fd limit
+ * is raised so that a worker can hold thousands of connections.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int reactor_setup(int listenfd);
+/*---------------------------------------------------------------------------*/
+/**
+ * runs the event loop of one worker until *shutdown becomes non-zero.
+ * every worker polls the shared listening socket (EPOLLEXCLUSIVE),
+ * and multiplexes all connections it accepted on its own epoll instance.
+ * returns -1 when any internal errors occur.
+ * returns 0 on shutdown.
+ */
+int reactor_run(struct skvs_ctx *ctx, int listenfd, int idx,
+                volatile sig_atomic_t *shutdown);
+/*---------------------------------------------------------------------------*/
+/**
+ * same as reactor_run(), for the worker of a shard. listenfd is the
+ * shard's own listening socket. requests are served on the shard's
+ * table when it owns their keys, and sent to the owning shard
+ * otherwise (shard.h).
+ * returns -1 when any internal errors occur.
+ * returns 0 on shutdown.
+ */
+int reactor_run_shard(struct shard *shard, int listenfd,
+                      volatile sig_atomic_t *shutdown);
+/*---------------------------------------------------------------------------*/
+#endif // _REACTOR_H
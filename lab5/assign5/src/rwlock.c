@@ -3,20 +3,424 @@
 /* Author: Junghan Yoon, KyoungSoo Park                                      */
 /* Modified by: (Your Name)                                                  */
 /*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "rwlock.h"
 /*---------------------------------------------------------------------------*/
+/* futex lock state: active readers in the low bits, then a flag for
+ * sleeping readers, the writer bit, and the number of waiting writers */
+#define RW_READERS      0x0000ffffu
+#define RW_READER_WAIT  0x00010000u
+#define RW_WRITER       0x00020000u
+#define RW_WAITER       0x00040000u
+#define RW_WAITERS      (~0u - (RW_WAITER - 1))
+/*---------------------------------------------------------------------------*/
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+futex_wait(unsigned int *addr, unsigned int val)
+{
+    /* returns at once when *addr != val, the callers recheck anyway */
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+futex_wake(unsigned int *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* hands the lock over to one waiting writer */
+static inline void
+futex_wake_writer(rwlock_t *rw)
+{
+    __atomic_add_fetch(&rw->writer_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&rw->writer_seq, 1);
+}
+/*---------------------------------------------------------------------------*/
+static int
+futex_read_lock(rwlock_t *rw)
+{
+    unsigned int s;
+    int spin = 0;
+
+    s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    while (1)
+    {
+        if (!(s & (RW_WRITER | RW_WAITERS)))
+        {
+            if (__atomic_compare_exchange_n(&rw->state, &s, s + 1, 1,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+            {
+                return 0;
+            }
+            continue;
+        }
+        if (spin++ < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+            continue;
+        }
+        /* the last writer to leave wakes everybody sleeping on state */
+        if (!(s & RW_READER_WAIT) &&
+            !__atomic_compare_exchange_n(&rw->state, &s, s | RW_READER_WAIT,
+                                         0, __ATOMIC_SEQ_CST,
+                                         __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+        futex_wait(&rw->state, s | RW_READER_WAIT);
+        s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int
+futex_read_unlock(rwlock_t *rw)
+{
+    unsigned int s = __atomic_fetch_sub(&rw->state, 1, __ATOMIC_SEQ_CST);
+
+    if ((s & RW_READERS) == 1 && (s & RW_WAITERS))
+    {
+        futex_wake_writer(rw);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+futex_write_lock(rwlock_t *rw)
+{
+    unsigned int s, seq;
+    int spin;
+
+    s = 0;
+    if (__atomic_compare_exchange_n(&rw->state, &s, RW_WRITER, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    for (spin = 0; spin < RWLOCK_SPIN; spin++)
+    {
+        if (!(s & (RW_WRITER | RW_READERS)) &&
+            __atomic_compare_exchange_n(&rw->state, &s, s | RW_WRITER, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+        cpu_relax();
+        s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    }
+
+    /* from now on new readers wait behind us */
+    __atomic_add_fetch(&rw->state, RW_WAITER, __ATOMIC_SEQ_CST);
+    while (1)
+    {
+        seq = __atomic_load_n(&rw->writer_seq, __ATOMIC_SEQ_CST);
+        s = __atomic_load_n(&rw->state, __ATOMIC_SEQ_CST);
+        while (!(s & (RW_WRITER | RW_READERS)))
+        {
+            if (__atomic_compare_exchange_n(&rw->state, &s,
+                                            (s - RW_WAITER) | RW_WRITER, 0,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+            {
+                return 0;
+            }
+        }
+        /* an unlock after the load of state also bumped writer_seq */
+        futex_wait(&rw->writer_seq, seq);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int
+futex_write_unlock(rwlock_t *rw)
+{
+    unsigned int s, next;
+
+    s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    do
+    {
+        /* sleeping readers stay flagged until no writer waits anymore */
+        next = s & RW_WAITERS ? s & ~RW_WRITER
+                              : s & ~(RW_WRITER | RW_READER_WAIT);
+    } while (!__atomic_compare_exchange_n(&rw->state, &s, next, 0,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+
+    if (s & RW_WAITERS)
+    {
+        futex_wake_writer(rw);
+    }
+    else if (s & RW_READER_WAIT)
+    {
+        futex_wake(&rw->state, INT_MAX);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* visible readers of all biased locks. a fast reader owns the slot it
+ * filled with its lock, and remembers the slot in t_bias_slots. */
+static rwlock_t *g_bias_readers[RWLOCK_BIAS_SLOTS];
+static unsigned int g_bias_threads = 0;
+static __thread unsigned int t_bias_id = 0;
+static __thread unsigned int t_bias_slots[RWLOCK_BIAS_HELD];
+static __thread int t_bias_held = 0;
+/*---------------------------------------------------------------------------*/
+static inline unsigned long
+bias_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* spreads the readers of one lock, and the locks of one reader */
+static inline unsigned int
+bias_slot(rwlock_t *rw)
+{
+    uint64_t h;
+
+    if (t_bias_id == 0)
+    {
+        t_bias_id = __atomic_add_fetch(&g_bias_threads, 1, __ATOMIC_RELAXED);
+    }
+    h = ((uint64_t)(uintptr_t)rw ^ t_bias_id * 0x9e3779b97f4a7c15ULL)
+        * 0xbf58476d1ce4e5b9ULL;
+
+    return (unsigned int)(h >> 32) & (RWLOCK_BIAS_SLOTS - 1);
+}
+/*---------------------------------------------------------------------------*/
+static int
+bias_read_lock(rwlock_t *rw)
+{
+    rwlock_t *expected = NULL;
+    unsigned int i;
+
+    if (__atomic_load_n(&rw->rbias, __ATOMIC_RELAXED) &&
+        t_bias_held < RWLOCK_BIAS_HELD)
+    {
+        i = bias_slot(rw);
+        if (__atomic_compare_exchange_n(&g_bias_readers[i], &expected, rw, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            /* a writer clears the bias before it scans the slots */
+            if (__atomic_load_n(&rw->rbias, __ATOMIC_SEQ_CST))
+            {
+                t_bias_slots[t_bias_held++] = i;
+                return 0;
+            }
+            __atomic_store_n(&g_bias_readers[i], NULL, __ATOMIC_RELEASE);
+        }
+    }
+
+    futex_read_lock(rw);
+    /* no writer can revoke while we hold the lock */
+    if (!__atomic_load_n(&rw->rbias, __ATOMIC_RELAXED) &&
+        bias_now() >= __atomic_load_n(&rw->inhibit_until, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&rw->rbias, 1, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+bias_read_unlock(rwlock_t *rw)
+{
+    int j;
+
+    for (j = t_bias_held - 1; j >= 0; j--)
+    {
+        if (__atomic_load_n(&g_bias_readers[t_bias_slots[j]],
+                            __ATOMIC_RELAXED) == rw)
+        {
+            __atomic_store_n(&g_bias_readers[t_bias_slots[j]], NULL,
+                             __ATOMIC_RELEASE);
+            t_bias_slots[j] = t_bias_slots[--t_bias_held];
+            return 0;
+        }
+    }
+
+    return futex_read_unlock(rw);
+}
+/*---------------------------------------------------------------------------*/
+static int
+bias_write_lock(rwlock_t *rw)
+{
+    unsigned long start, now;
+    int i;
+
+    futex_write_lock(rw);
+    if (!__atomic_load_n(&rw->rbias, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    /* revoke the bias and wait for the fast readers to drain */
+    __atomic_store_n(&rw->rbias, 0, __ATOMIC_SEQ_CST);
+    start = bias_now();
+    for (i = 0; i < RWLOCK_BIAS_SLOTS; i++)
+    {
+        while (__atomic_load_n(&g_bias_readers[i], __ATOMIC_SEQ_CST) == rw)
+        {
+            cpu_relax();
+        }
+    }
+    now = bias_now();
+    __atomic_store_n(&rw->inhibit_until,
+                     now + (now - start) * RWLOCK_BIAS_INHIBIT,
+                     __ATOMIC_RELAXED);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+fair_read_lock(rwlock_t *rw)
+{
+    unsigned long phase;
+
+    pthread_mutex_lock(&rw->lock);
+
+    if (rw->writing || rw->write_count > 0)
+    {
+        /* the writer that ends this phase counts us in read_count */
+        rw->readers_waiting++;
+        phase = rw->write_phase;
+        while (rw->write_phase == phase)
+        {
+            pthread_cond_wait(&rw->readers, &rw->lock);
+        }
+    }
+    else
+    {
+        rw->read_count++;
+    }
+
+    pthread_mutex_unlock(&rw->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+fair_read_unlock(rwlock_t *rw)
+{
+    pthread_mutex_lock(&rw->lock);
+
+    if (--rw->read_count == 0 && rw->write_count > 0)
+    {
+        pthread_cond_broadcast(&rw->writers);
+    }
+
+    pthread_mutex_unlock(&rw->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+fair_write_lock(rwlock_t *rw)
+{
+    pthread_t self = pthread_self();
+
+    pthread_mutex_lock(&rw->lock);
+
+    /* with more waiting writers than ring slots, the extra ones
+     * are not ordered until they get a slot */
+    while (rw->write_count == WRITER_RING_SIZE)
+    {
+        pthread_cond_wait(&rw->writers, &rw->lock);
+    }
+    rw->writer_ring[rw->writer_ring_head] = self;
+    rw->writer_ring_head = (rw->writer_ring_head + 1) % WRITER_RING_SIZE;
+    rw->write_count++;
+
+    while (!pthread_equal(rw->writer_ring[rw->writer_ring_tail], self) ||
+           rw->writing || rw->read_count > 0)
+    {
+        pthread_cond_wait(&rw->writers, &rw->lock);
+    }
+    rw->writing = 1;
+
+    pthread_mutex_unlock(&rw->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+fair_write_unlock(rwlock_t *rw)
+{
+    pthread_mutex_lock(&rw->lock);
+
+    rw->writing = 0;
+    rw->writer_ring_tail = (rw->writer_ring_tail + 1) % WRITER_RING_SIZE;
+    rw->write_count--;
+
+    /* end the phase: readers that waited for it go before the next writer */
+    if (rw->readers_waiting > 0)
+    {
+        rw->read_count += rw->readers_waiting;
+        rw->readers_waiting = 0;
+        rw->write_phase++;
+        pthread_cond_broadcast(&rw->readers);
+    }
+    /* only the writer at the tail of the ring can go */
+    if (rw->write_count > 0)
+    {
+        pthread_cond_broadcast(&rw->writers);
+    }
+
+    pthread_mutex_unlock(&rw->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
 int rwlock_init(rwlock_t *rw, int delay)
+{
+    TRACE_PRINT();
+
+    return rwlock_init_mode(rw, delay, RWLOCK_MODE_COND);
+}
+/*---------------------------------------------------------------------------*/
+int rwlock_init_mode(rwlock_t *rw, int delay, int mode)
 {
     TRACE_PRINT();
     int ret, destroy_ret;
+    rw->mode = mode;
+    rw->state = 0;
+    rw->writer_seq = 0;
+    rw->rbias = mode == RWLOCK_MODE_BIAS;
+    rw->inhibit_until = 0;
+    rw->readers_waiting = 0;
+    rw->write_phase = 0;
     rw->read_count = 0;
     rw->write_count = 0;
+    rw->writing = 0;
     rw->writer_ring_head = 0;
     rw->writer_ring_tail = 0;
     rw->delay = delay;
     if (rw->writer_ring)
     {
         free(rw->writer_ring);
+        rw->writer_ring = NULL;
+    }
+    if (mode == RWLOCK_MODE_FUTEX || mode == RWLOCK_MODE_BIAS)
+    {
+        /* needs nothing but the state word */
+        return 0;
     }
     rw->writer_ring = calloc(WRITER_RING_SIZE, sizeof(pthread_t));
     if (!rw->writer_ring)
@@ -80,6 +484,18 @@ int rwlock_init(rwlock_t *rw, int delay)
 int rwlock_read_lock(rwlock_t *rw)
 {
     TRACE_PRINT();
+    if (rw->mode == RWLOCK_MODE_FAIR)
+    {
+        return fair_read_lock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_BIAS)
+    {
+        return bias_read_lock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_FUTEX)
+    {
+        return futex_read_lock(rw);
+    }
 /*---------------------------------------------------------------------------*/
     /* edit here */
 
@@ -99,8 +515,24 @@ int rwlock_read_lock(rwlock_t *rw)
 /*---------------------------------------------------------------------------*/
 int rwlock_read_unlock(rwlock_t *rw)
 {
-    sleep(rw->delay);
+    if (rw->delay)
+    {
+        /* sleep(0) is still a system call */
+        sleep(rw->delay);
+    }
     TRACE_PRINT();
+    if (rw->mode == RWLOCK_MODE_FAIR)
+    {
+        return fair_read_unlock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_BIAS)
+    {
+        return bias_read_unlock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_FUTEX)
+    {
+        return futex_read_unlock(rw);
+    }
 /*---------------------------------------------------------------------------*/
     /* edit here */
 
@@ -122,6 +554,18 @@ int rwlock_read_unlock(rwlock_t *rw)
 int rwlock_write_lock(rwlock_t *rw)
 {
     TRACE_PRINT();
+    if (rw->mode == RWLOCK_MODE_FAIR)
+    {
+        return fair_write_lock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_BIAS)
+    {
+        return bias_write_lock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_FUTEX)
+    {
+        return futex_write_lock(rw);
+    }
 /*---------------------------------------------------------------------------*/
     /* edit here */
 
@@ -129,10 +573,11 @@ int rwlock_write_lock(rwlock_t *rw)
 
     rw->write_count++; // 쓰기 대기 중인 쓰레드 수 증가
 
-    while (rw->read_count > 0 || rw->write_count > 1)
+    while (rw->read_count > 0 || rw->writing)
     {
         pthread_cond_wait(&rw->writers, &rw->lock);
     }
+    rw->writing = 1;
 
     pthread_mutex_unlock(&rw->lock);
 
@@ -142,18 +587,34 @@ int rwlock_write_lock(rwlock_t *rw)
 /*---------------------------------------------------------------------------*/
 int rwlock_write_unlock(rwlock_t *rw)
 {
-    sleep(rw->delay);
+    if (rw->delay)
+    {
+        /* sleep(0) is still a system call */
+        sleep(rw->delay);
+    }
     TRACE_PRINT();
+    if (rw->mode == RWLOCK_MODE_FAIR)
+    {
+        return fair_write_unlock(rw);
+    }
+    if (rw->mode == RWLOCK_MODE_FUTEX || rw->mode == RWLOCK_MODE_BIAS)
+    {
+        return futex_write_unlock(rw);
+    }
 /*---------------------------------------------------------------------------*/
     /* edit here */
 
     pthread_mutex_lock(&rw->lock);
 
+    rw->writing = 0;
     rw->write_count--;
 
     if (rw->write_count == 0)
     {
         pthread_cond_broadcast(&rw->readers); // 모든 리더를 깨움
+    }
+    else
+    {
         pthread_cond_signal(&rw->writers);    // 대기 중인 쓰기 쓰레드를 깨움
     }
 
@@ -168,6 +629,11 @@ int rwlock_destroy(rwlock_t *rw)
     TRACE_PRINT();
     int ret;
 
+    if (rw->mode == RWLOCK_MODE_FUTEX || rw->mode == RWLOCK_MODE_BIAS)
+    {
+        return 0;
+    }
+
     /* destroy the mutex */
     ret = pthread_mutex_destroy(&rw->lock);
     if (ret != 0)
@@ -12,11 +12,32 @@
 #include <unistd.h>
 #include "common.h"
 #define WRITER_RING_SIZE NUM_THREADS
+/* times a contended futex lock is retried before it sleeps */
+#define RWLOCK_SPIN 128
+/* slots of the visible reader table shared by all biased locks */
+#define RWLOCK_BIAS_SLOTS 4096
+/* biased read locks a thread may hold at the same time */
+#define RWLOCK_BIAS_HELD 4
+/* after a revocation, keep the bias off this many times as long
+ * as the revocation took */
+#define RWLOCK_BIAS_INHIBIT 9
+/*---------------------------------------------------------------------------*/
+/* lock implementations */
+enum RWLOCK_MODE
+{
+    RWLOCK_MODE_COND,   // mutex and condition variables
+    RWLOCK_MODE_FUTEX,  // one atomic state word, sleeps on futexes
+    RWLOCK_MODE_BIAS,   // futex lock with reader bias (BRAVO)
+    RWLOCK_MODE_FAIR,   // phase-fair, writers queued in writer_ring
+};
 /*---------------------------------------------------------------------------*/
 typedef struct
 {
+    int mode;               // enum RWLOCK_MODE
+
     int read_count;         // number of current/pending read threads
     int write_count;        // number of write threads
+    int writing;            // whether a writer holds the lock
     pthread_mutex_t lock;   // mutex lock for protection
     pthread_cond_t readers; // condvar for threads waiting read
     pthread_cond_t writers; // condvar for threads waiting write
@@ -26,6 +47,21 @@ typedef struct
     int writer_ring_head;   // position to insert
     int writer_ring_tail;   // position to evict
 
+    /* fair mode: readers waiting for the current writer phase to end,
+     * and the number of writer phases ended so far */
+    int readers_waiting;
+    unsigned long write_phase;
+
+    /* futex mode: readers, waiting writers and flags in one word.
+     * writers sleep on writer_seq, which every hand-over bumps. */
+    unsigned int state;
+    unsigned int writer_seq;
+
+    /* bias mode: whether readers may skip the state word, and the
+     * time in ns before which a slow reader must not turn it back on */
+    int rbias;
+    unsigned long inhibit_until;
+
     /* delay for semantic test */
     int delay;
 } rwlock_t;
@@ -37,6 +73,25 @@ typedef struct
  */
 int rwlock_init(rwlock_t *rw, int delay);
 /*---------------------------------------------------------------------------*/
+/**
+ * same as rwlock_init(), but selects the implementation.
+ * a futex lock takes and releases an uncontended lock with a single
+ * atomic instruction, and spins RWLOCK_SPIN times before it sleeps.
+ * like the condvar lock, it lets waiting writers go before new readers.
+ * a biased lock is a futex lock whose readers normally only claim a
+ * slot of a global table, so they never write to the lock itself.
+ * a writer turns the bias off and waits until no slot names the lock,
+ * and the bias stays off for a while after such a revocation.
+ * a fair lock queues its writers in writer_ring and serves them in
+ * arrival order. a reader waits for at most one writer, because a
+ * leaving writer lets in every reader waiting for it before the next
+ * writer goes, and a writer waits only for the readers let in before it.
+ * read_count and write_count are only kept by the condvar and fair locks.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int rwlock_init_mode(rwlock_t *rw, int delay, int mode);
+/*---------------------------------------------------------------------------*/
 /**
  * acquires read lock.
  * returns -1 when any internal errors occur.
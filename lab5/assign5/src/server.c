@@ -11,11 +11,14 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include <getopt.h>
 #include <signal.h>
 #include <sys/time.h>
 #include "common.h"
 #include "skvslib.h"
+#include "reactor.h"
+#include "uring.h"
 /*---------------------------------------------------------------------------*/
 struct thread_args
 {
@@ -25,7 +28,9 @@ struct thread_args
 
 /*---------------------------------------------------------------------------*/
     /* free to use */
-
+    int reactor; // serve connections with the epoll event loop
+    int uring;   // serve connections with the io_uring loop
+    struct shard *shard; // serve this shard only, or NULL
 /*---------------------------------------------------------------------------*/
 };
 /*---------------------------------------------------------------------------*/
@@ -38,12 +43,18 @@ void *handle_client(void *arg)
     struct skvs_ctx *ctx = args->ctx;
     int idx = args->idx;
     int listenfd = args->listenfd;
+    int reactor = args->reactor;
+    int uring = args->uring;
+    struct shard *shard = args->shard;
 /*---------------------------------------------------------------------------*/
     /* free to declare any variables */
     
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
-    int clientfd;
+    char buffer[SKVS_RBUF_SIZE];
+    struct skvs_resp out = {0};
+    struct msghdr msg = {0};
+    ssize_t bytes_received, used, sent;
+    size_t len;
+    int clientfd, cnt;
 
 /*---------------------------------------------------------------------------*/
 
@@ -53,6 +64,30 @@ void *handle_client(void *arg)
 /*---------------------------------------------------------------------------*/
     /* edit here */
 
+    if (shard) {
+        if (reactor_run_shard(shard, listenfd, &g_shutdown) < 0) {
+            fprintf(stderr, "Worker %d: event loop failed.\n", idx);
+        }
+        printf("Worker %d: Shutting down.\n", idx);
+        return NULL;
+    }
+
+    if (uring) {
+        if (uring_run(ctx, listenfd, idx, &g_shutdown) < 0) {
+            fprintf(stderr, "Worker %d: io_uring loop failed.\n", idx);
+        }
+        printf("Worker %d: Shutting down.\n", idx);
+        return NULL;
+    }
+
+    if (reactor) {
+        if (reactor_run(ctx, listenfd, idx, &g_shutdown) < 0) {
+            fprintf(stderr, "Worker %d: event loop failed.\n", idx);
+        }
+        printf("Worker %d: Shutting down.\n", idx);
+        return NULL;
+    }
+
     while (!g_shutdown) {
         // 클라이언트 연결 수락
         clientfd = accept(listenfd, NULL, NULL);
@@ -67,15 +102,40 @@ void *handle_client(void *arg)
         printf("Worker %d: Accepted new connection.\n", idx);
 
         // 클라이언트와 통신
-        while ((bytes_received = recv(clientfd, buffer, BUFFER_SIZE, 0)) > 0) {
-            buffer[bytes_received] = '\0'; // Null-terminate buffer
-            const char *response = skvs_serve(ctx, buffer, bytes_received);
-            if (response) {
-                char send_buf[BUFFER_SIZE];
-                snprintf(send_buf, sizeof(send_buf), "%s\n", response);
-                send(clientfd, send_buf, strlen(send_buf), 0);
+        len = 0;
+        while ((bytes_received = recv(clientfd, buffer + len,
+                                      sizeof(buffer) - len, 0)) > 0) {
+            /* serve every complete command, keep the incomplete tail */
+            len += bytes_received;
+            used = skvs_serve_iov(ctx, buffer, len, &out, NULL);
+            if (used < 0) {
+                fprintf(stderr, "Worker %d: failed to serve.\n", idx);
+                break;
+            }
+            len -= used;
+            memmove(buffer, buffer + used, len);
+
+            /* all responses of this read go out together, without copy */
+            while (out.len > 0) {
+                cnt = out.cnt - out.head;
+                msg.msg_iov = out.iov + out.head;
+                msg.msg_iovlen = cnt < IOV_MAX ? cnt : IOV_MAX;
+                sent = sendmsg(clientfd, &msg, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                skvs_resp_consume(&out, sent);
+            }
+            if (out.len > 0) {
+                perror("send failed");
+                break;
             }
         }
+        /* release values pinned for unsent responses */
+        skvs_resp_free(&out);
 
         // 클라이언트 연결 종료
         if (bytes_received == 0) {
@@ -104,16 +164,33 @@ void handle_sigint(int sig)
 int main(int argc, char *argv[])
 {
     size_t hash_size = DEFAULT_HASH_SIZE;
+    size_t num_locks = DEFAULT_LOCK_STRIPES;
     char *ip = DEFAULT_ANY_IP;
     int port = DEFAULT_PORT, opt;
     int num_threads = NUM_THREADS;
     int delay = RWLOCK_DELAY;
+    int reactor = 0;
+    int uring = 0;
+    int engine = HASH_ENGINE_CHAIN;
+    int lock_mode = RWLOCK_MODE_COND;
+    const char *wal_path = NULL;
+    int wal_sync = WAL_SYNC_ALWAYS;
+    int wal_interval = 0;
+    const char *snap_path = NULL;
+    int snap_interval = 0;
+    size_t mem_limit = 0;
+    int ordered = 0;
+    int sharded = 0;
+    char *unit;
 /*---------------------------------------------------------------------------*/
     /* free to declare any variables */
 
     int listenfd;
     struct sockaddr_in server_addr;
-    struct skvs_ctx *ctx;
+    struct skvs_ctx *ctx = NULL;
+    struct shard_group *group = NULL;
+    int *listenfds;
+    hash_opts_t opts = {0};
 
     pthread_t *threads;
     struct thread_args *args;
@@ -123,7 +200,7 @@ int main(int argc, char *argv[])
 /*---------------------------------------------------------------------------*/
 
     /* parse command line options */
-    while ((opt = getopt(argc, argv, "p:t:s:d:h")) != -1)
+    while ((opt = getopt(argc, argv, "p:t:s:l:d:w:y:c:i:m:euofrqxkh")) != -1)
     {
         switch (opt)
         {
@@ -141,20 +218,112 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'l':
+            num_locks = atoi(optarg);
+            if (num_locks <= 0)
+            {
+                perror("Invalid number of lock stripes");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'd':
             delay = atoi(optarg);
             break;
+        case 'w':
+            wal_path = optarg;
+            break;
+        case 'y':
+            if (strcmp(optarg, "always") == 0)
+            {
+                wal_sync = WAL_SYNC_ALWAYS;
+            }
+            else if (strcmp(optarg, "never") == 0)
+            {
+                wal_sync = WAL_SYNC_NEVER;
+            }
+            else
+            {
+                wal_sync = WAL_SYNC_INTERVAL;
+                wal_interval = atoi(optarg);
+                if (wal_interval <= 0)
+                {
+                    fprintf(stderr, "Invalid log sync policy\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+        case 'c':
+            snap_path = optarg;
+            break;
+        case 'i':
+            snap_interval = atoi(optarg);
+            break;
+        case 'm':
+            /* bytes, or K, M or G of them */
+            mem_limit = strtoull(optarg, &unit, 10);
+            switch (*unit)
+            {
+            case 'G':
+            case 'g':
+                mem_limit <<= 10;
+                /* fall through */
+            case 'M':
+            case 'm':
+                mem_limit <<= 10;
+                /* fall through */
+            case 'K':
+            case 'k':
+                mem_limit <<= 10;
+                unit++;
+                break;
+            }
+            if (mem_limit == 0 || *unit != '\0')
+            {
+                fprintf(stderr, "Invalid memory limit\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'e':
+            reactor = 1;
+            break;
+        case 'u':
+            uring = 1;
+            break;
+        case 'o':
+            engine = HASH_ENGINE_SWISS;
+            break;
+        case 'f':
+            lock_mode = RWLOCK_MODE_FUTEX;
+            break;
+        case 'r':
+            lock_mode = RWLOCK_MODE_BIAS;
+            break;
+        case 'q':
+            lock_mode = RWLOCK_MODE_FAIR;
+            break;
+        case 'x':
+            ordered = 1;
+            break;
+        case 'k':
+            sharded = 1;
+            break;
         case 'h':
         default:
             printf("Usage: %s [-p port (%d)] "
                    "[-t num_threads (%d)] "
                    "[-d rwlock_delay (%d)] "
-                   "[-s hash_size (%d)]\n",
+                   "[-s hash_size (%d)] "
+                   "[-l lock_stripes (%d)] "
+                   "[-w wal_path] [-y always|never|sync_ms (always)] "
+                   "[-c snapshot_path] [-i snapshot_interval_s] "
+                   "[-m mem_limit[K|M|G]] "
+                   "[-e] [-u] [-o] [-f] [-r] [-q] [-x] [-k]\n",
                    argv[0],
                    DEFAULT_PORT,
                    NUM_THREADS,
                    RWLOCK_DELAY,
-                   DEFAULT_HASH_SIZE);
+                   DEFAULT_HASH_SIZE,
+                   DEFAULT_LOCK_STRIPES);
             exit(EXIT_FAILURE);
         }
     }
@@ -163,42 +332,103 @@ int main(int argc, char *argv[])
     /* edit here */
     
     /* SKVS 초기화 */
-    ctx = skvs_init(hash_size, delay);
-    if (!ctx) {
+    opts.hash_size = hash_size;
+    opts.num_locks = num_locks;
+    opts.delay = delay;
+    opts.engine = engine;
+    opts.lock_mode = lock_mode;
+    opts.mem_limit = mem_limit;
+    opts.ordered = ordered;
+    if (sharded && (wal_path || snap_path || ordered || uring)) {
+        /* a command may only touch the keys of one shard */
+        fprintf(stderr, "-k does not go with -w, -c, -x or -u.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (sharded) {
+        group = shard_group_new(num_threads, &opts);
+        if (!group) {
+            fprintf(stderr, "Failed to initialize the shards.\n");
+            exit(EXIT_FAILURE);
+        }
+        reactor = 1;
+    } else if (!(ctx = skvs_init_opts(&opts))) {
         fprintf(stderr, "Failed to initialize SKVS.\n");
         exit(EXIT_FAILURE);
     }
-
-    /* 서버 소켓 생성 */
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket failed");
+    /* the log holds every write since it was created, so it goes last */
+    if (snap_path && skvs_open_snapshot(ctx, snap_path, snap_interval) < 0) {
+        fprintf(stderr, "Failed to load the snapshot %s.\n", snap_path);
+        exit(EXIT_FAILURE);
+    }
+    if (wal_path && skvs_open_wal(ctx, wal_path, wal_sync, wal_interval) < 0) {
+        fprintf(stderr, "Failed to open the log %s.\n", wal_path);
         exit(EXIT_FAILURE);
     }
+    if (ctx) {
+        skvs_recovered(ctx);
+    }
+
+    if (uring && !uring_supported()) {
+        fprintf(stderr, "io_uring is not available, "
+                "falling back to the socket loop.\n");
+        uring = 0;
+    }
 
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = inet_addr(ip);
     server_addr.sin_port = htons(port);
 
-    if (bind(listenfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind failed");
-        exit(EXIT_FAILURE);
-    }
+    /* every shard listens on a socket of its own, and the kernel spreads
+     * the connections over them */
+    listenfds = malloc(num_threads * sizeof(int));
+    for (int i = 0; i < (sharded ? num_threads : 1); i++) {
+        /* 서버 소켓 생성 */
+        if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+            perror("socket failed");
+            exit(EXIT_FAILURE);
+        }
+        if (sharded &&
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       &(int){1}, sizeof(int)) < 0) {
+            perror("setsockopt failed");
+            exit(EXIT_FAILURE);
+        }
 
-    if (listen(listenfd, NUM_BACKLOG) < 0) {
-        perror("listen failed");
-        exit(EXIT_FAILURE);
+        if (bind(listenfd, (struct sockaddr *)&server_addr,
+                 sizeof(server_addr)) < 0) {
+            perror("bind failed");
+            exit(EXIT_FAILURE);
+        }
+
+        /* an event-driven worker keeps thousands of clients, so let them
+         * queue */
+        if (listen(listenfd,
+                   (reactor || uring) ? SOMAXCONN : NUM_BACKLOG) < 0) {
+            perror("listen failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if ((reactor || uring) && reactor_setup(listenfd) < 0) {
+            fprintf(stderr, "Failed to set up event loop.\n");
+            exit(EXIT_FAILURE);
+        }
+        listenfds[i] = listenfd;
     }
 
-    printf("Server started on port %d with %d threads.\n", port, num_threads);
+    printf("Server started on port %d with %d threads%s.\n", port,
+           num_threads, sharded ? ", one shard each" : "");
 
     /* 쓰레드 풀 생성 */
     threads = malloc(num_threads * sizeof(pthread_t));
     for (int i = 0; i < num_threads; i++) {
         args = malloc(sizeof(struct thread_args));
-        args->listenfd = listenfd;
+        args->listenfd = listenfds[sharded ? i : 0];
         args->idx = i;
-        args->ctx = ctx;
+        args->ctx = sharded ? group->shards[i].ctx : ctx;
+        args->reactor = reactor;
+        args->uring = uring;
+        args->shard = sharded ? &group->shards[i] : NULL;
 
         if (pthread_create(&threads[i], NULL, handle_client, args) != 0) {
             perror("pthread_create failed");
@@ -212,8 +442,15 @@ int main(int argc, char *argv[])
     }
 
     /* SKVS 종료 */
-    skvs_destroy(ctx, 1);
-    close(listenfd);
+    if (sharded) {
+        shard_group_free(group, 1);
+    } else {
+        skvs_destroy(ctx, 1);
+    }
+    for (int i = 0; i < (sharded ? num_threads : 1); i++) {
+        close(listenfds[i]);
+    }
+    free(listenfds);
     free(threads);
 
     printf("Server shut down successfully.\n");
@@ -0,0 +1,185 @@
+/*---------------------------------------------------------------------------*/
+/* shard.c                                                                   */
+/* Shared-nothing shards of the server, one table and event loop per core    */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include "shard.h"
+/*---------------------------------------------------------------------------*/
+struct shard_group *shard_group_new(int num_shards, const hash_opts_t *opts)
+{
+    TRACE_PRINT();
+    struct shard_group *group;
+    hash_opts_t shard_opts = *opts;
+    void *mem;
+    int i;
+
+    group = calloc(1, sizeof(struct shard_group));
+    if (group == NULL)
+    {
+        return NULL;
+    }
+    if (posix_memalign(&mem, 64, num_shards * sizeof(struct shard)) != 0)
+    {
+        free(group);
+        return NULL;
+    }
+    group->shards = memset(mem, 0, num_shards * sizeof(struct shard));
+    group->num_shards = num_shards;
+    if (getrandom(&group->seed, sizeof(group->seed), 0) !=
+        sizeof(group->seed))
+    {
+        group->seed = (uint64_t)time(NULL) ^ (uint64_t)getpid();
+    }
+
+    /* the keys spread evenly, and so do the buckets and the memory */
+    shard_opts.hash_size = (opts->hash_size + num_shards - 1) / num_shards;
+    shard_opts.mem_limit = opts->mem_limit / num_shards;
+    if (opts->mem_limit && shard_opts.mem_limit == 0)
+    {
+        shard_opts.mem_limit = 1;
+    }
+
+    for (i = 0; i < num_shards; i++)
+    {
+        group->shards[i].efd = -1;
+    }
+    for (i = 0; i < num_shards; i++)
+    {
+        group->shards[i].idx = i;
+        group->shards[i].group = group;
+        group->shards[i].efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        group->shards[i].out = calloc(num_shards, sizeof(struct shard_batch));
+        group->shards[i].ctx = skvs_init_opts(&shard_opts);
+        if (group->shards[i].efd < 0 || group->shards[i].out == NULL ||
+            group->shards[i].ctx == NULL)
+        {
+            DEBUG_PRINT("Failed to create shard %d", i);
+            shard_group_free(group, 0);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+/*---------------------------------------------------------------------------*/
+void shard_group_free(struct shard_group *group, int dump)
+{
+    TRACE_PRINT();
+    struct shard *s;
+    struct skvs_req *req, *next;
+    int i;
+
+    /* requests and answers nobody took, their connections are gone */
+    for (i = 0; i < group->num_shards; i++)
+    {
+        if (group->shards[i].out)
+        {
+            shard_flush(&group->shards[i]);
+        }
+    }
+    for (i = 0; i < group->num_shards; i++)
+    {
+        if (group->shards[i].efd < 0)
+        {
+            continue;
+        }
+        for (req = shard_receive(&group->shards[i]); req; req = next)
+        {
+            next = req->next;
+            skvs_req_free(req);
+        }
+    }
+
+    for (i = 0; i < group->num_shards; i++)
+    {
+        s = &group->shards[i];
+        if (s->forwarded || s->served)
+        {
+            printf("Shard %d: %lu requests forwarded, %lu served for "
+                   "other shards\n", i, s->forwarded, s->served);
+        }
+        if (s->ctx)
+        {
+            skvs_destroy(s->ctx, dump);
+            free(s->ctx);
+        }
+        if (s->efd >= 0)
+        {
+            close(s->efd);
+        }
+        free(s->out);
+    }
+    free(group->shards);
+    free(group);
+}
+/*---------------------------------------------------------------------------*/
+void shard_flush(struct shard *shard)
+{
+    TRACE_PRINT();
+    struct shard_group *group = shard->group;
+    struct shard_batch *b;
+    struct shard *to;
+    struct skvs_req *head;
+    uint64_t one = 1;
+    int i;
+
+    for (i = 0; i < group->num_shards; i++)
+    {
+        b = &shard->out[i];
+        if (b->newest == NULL)
+        {
+            continue;
+        }
+        to = &group->shards[i];
+
+        /* the batch goes on top of the stack as it is, newest first, and
+         * the receiver takes it whole and reverses it */
+        head = __atomic_load_n(&to->inbox, __ATOMIC_RELAXED);
+        do
+        {
+            b->oldest->next = head;
+        } while (!__atomic_compare_exchange_n(&to->inbox, &head, b->newest,
+                                              1, __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        b->newest = NULL;
+        b->oldest = NULL;
+
+        /* the receiver empties the inbox after it read the eventfd, so
+         * only the first batch after that needs to wake it */
+        if (head == NULL && write(to->efd, &one, sizeof(one)) < 0)
+        {
+            DEBUG_PRINT("Failed to wake shard %d", i);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+struct skvs_req *shard_receive(struct shard *shard)
+{
+    TRACE_PRINT();
+    struct skvs_req *req, *next, *oldest = NULL;
+    uint64_t count;
+
+    /* reset the eventfd first, so that a request pushed from now on
+     * wakes the worker again */
+    if (read(shard->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        DEBUG_PRINT("Failed to reset the eventfd of shard %d", shard->idx);
+    }
+
+    req = __atomic_exchange_n(&shard->inbox, NULL, __ATOMIC_ACQUIRE);
+    for (; req; req = next)
+    {
+        next = req->next;
+        req->next = oldest;
+        oldest = req;
+    }
+
+    return oldest;
+}
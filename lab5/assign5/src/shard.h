@@ -0,0 +1,105 @@
+/*---------------------------------------------------------------------------*/
+/* shard.h                                                                   */
+/* Shared-nothing shards of the server, one table and event loop per core    */
+/*---------------------------------------------------------------------------*/
+#ifndef _SHARD_H
+#define _SHARD_H
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+#include "skvslib.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* requests a connection may have in flight before its worker stops
+ * reading from it */
+#define SHARD_MAX_INFLIGHT 1024
+/*---------------------------------------------------------------------------*/
+/* requests a worker posted to one other shard, pushed together by
+ * shard_flush(). newest first, like the inbox. */
+struct shard_batch
+{
+    struct skvs_req *newest;
+    struct skvs_req *oldest;
+};
+/*---------------------------------------------------------------------------*/
+/* one shard. it owns the keys that shard_owner() maps to it, and only
+ * its worker touches its table. requests for its keys from the other
+ * shards, and the answers to the requests it sent them, arrive in its
+ * inbox. */
+struct shard
+{
+    int idx;
+    struct skvs_ctx *ctx;       // the keys of this shard
+    int efd;                    // eventfd, readable once the inbox fills
+    struct skvs_req *inbox;     // pushed by the other shards, newest first
+    struct shard_group *group;
+    struct shard_batch *out;    // posted by its worker, one per shard
+    unsigned long forwarded;    // requests sent to the other shards
+    unsigned long served;       // requests served for the other shards
+} __attribute__((aligned(64)));
+/*---------------------------------------------------------------------------*/
+struct shard_group
+{
+    int num_shards;
+    uint64_t seed;              // of shard_owner()
+    struct shard *shards;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * creates num_shards shards, each with a table of its own. the table
+ * options are shared, with the buckets and the memory limit split
+ * evenly between the shards.
+ * returns NULL when any internal errors occur.
+ */
+struct shard_group *shard_group_new(int num_shards, const hash_opts_t *opts);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees the requests left in the inboxes, and destroys the tables and
+ * the group. only call it once every worker stopped.
+ */
+void shard_group_free(struct shard_group *group, int dump);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the shard that owns key. every shard maps a key the same way.
+ */
+static inline struct shard *
+shard_owner(struct shard_group *group, const char *key)
+{
+    uint64_t h = hash64(key, strlen(key), group->seed);
+
+    /* the high half of the hash, scaled to the number of shards */
+    return &group->shards[((h >> 32) * group->num_shards) >> 32];
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues req for the inbox of shard to. only the worker of shard calls
+ * it; the request leaves with the next shard_flush().
+ */
+static inline void
+shard_post(struct shard *shard, struct shard *to, struct skvs_req *req)
+{
+    struct shard_batch *b = &shard->out[to->idx];
+
+    req->next = b->newest;
+    b->newest = req;
+    if (b->oldest == NULL)
+    {
+        b->oldest = req;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * pushes the requests the worker of shard posted, one batch per shard,
+ * and wakes a worker when its inbox was empty. it takes no lock and
+ * never waits, and the requests of one sender arrive in the order they
+ * were posted.
+ */
+void shard_flush(struct shard *shard);
+/*---------------------------------------------------------------------------*/
+/**
+ * takes every request in the inbox of shard, oldest first. call it when
+ * shard->efd is readable.
+ * returns NULL when the inbox is empty.
+ */
+struct skvs_req *shard_receive(struct shard *shard);
+/*---------------------------------------------------------------------------*/
+#endif // _SHARD_H
@@ -0,0 +1,393 @@
+/*---------------------------------------------------------------------------*/
+/* skiplist.c                                                                */
+/* Concurrent skiplist of keys, the ordered index of the hash table          */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "skiplist.h"
+#include "epoch.h"
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+/* a key and its links. the lazy skiplist of Herlihy et al.: a node is
+ * marked before it is unlinked, and only counts as present once it is
+ * linked at every level. */
+struct skip_node
+{
+    uint8_t level;              // top level, next has level + 1 links
+    uint8_t len;
+    uint8_t marked;             // being deleted
+    uint8_t linked;             // linked at every level
+    int lock;                   // held while linking next to the node
+    char key[MAX_KEY_LEN];
+    struct skip_node *next[];
+};
+/*---------------------------------------------------------------------------*/
+struct skiplist
+{
+    struct skip_node *head;     // before every key, at every level
+    size_t count;
+};
+/*---------------------------------------------------------------------------*/
+static inline void
+skip_lock(struct skip_node *node)
+{
+    while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE))
+    {
+        /* the holder links a few pointers, unless it was preempted */
+        while (__atomic_load_n(&node->lock, __ATOMIC_RELAXED))
+        {
+            sched_yield();
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+skip_unlock(struct skip_node *node)
+{
+    __atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------------*/
+/* unlocks the predecessors locked by levels 0 to top, each once */
+static void
+skip_unlock_preds(struct skip_node **preds, int top)
+{
+    struct skip_node *prev = NULL;
+    int l;
+
+    for (l = 0; l <= top; l++)
+    {
+        if (preds[l] != prev)
+        {
+            skip_unlock(preds[l]);
+            prev = preds[l];
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* compares the key of node with key, as bytes, a prefix first */
+static inline int
+skip_cmp(const struct skip_node *node, const char *key, size_t len)
+{
+    int c = memcmp(node->key, key, node->len < len ? node->len : len);
+
+    return c ? c : (int)node->len - (int)len;
+}
+/*---------------------------------------------------------------------------*/
+/* returns the top level of a new node, 0 with probability 3/4 */
+static int
+skip_level(void)
+{
+    static __thread uint64_t state = 0;
+    uint64_t x = state;
+    int level = 0;
+
+    if (x == 0)
+    {
+        x = (uintptr_t)&state ^ (uint64_t)time(NULL) ^ 0x9E3779B97F4A7C15ULL;
+    }
+    /* xorshift64 */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    state = x;
+
+    while (level < SKIPLIST_LEVELS - 1 && (x & 3) == 0)
+    {
+        level++;
+        x >>= 2;
+    }
+
+    return level;
+}
+/*---------------------------------------------------------------------------*/
+static struct skip_node *
+skip_node_new(const char *key, size_t len, int level)
+{
+    struct skip_node *node = slab_alloc(sizeof(struct skip_node) +
+                                        (level + 1) * sizeof(node->next[0]));
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    node->level = level;
+    node->len = len;
+    node->marked = 0;
+    node->linked = 0;
+    node->lock = 0;
+    memcpy(node->key, key, len);
+
+    return node;
+}
+/*---------------------------------------------------------------------------*/
+/* fills the predecessors and successors of key at every level.
+ * the caller is in a read section.
+ * returns the highest level the key was found at, or -1. */
+static int
+skip_find(skiplist_t *list, const char *key, size_t len,
+          struct skip_node **preds, struct skip_node **succs)
+{
+    struct skip_node *pred = list->head, *cur;
+    int found = -1, l, c = 1;
+
+    for (l = SKIPLIST_LEVELS - 1; l >= 0; l--)
+    {
+        cur = __atomic_load_n(&pred->next[l], __ATOMIC_ACQUIRE);
+        while (cur && (c = skip_cmp(cur, key, len)) < 0)
+        {
+            pred = cur;
+            cur = __atomic_load_n(&pred->next[l], __ATOMIC_ACQUIRE);
+        }
+        if (found < 0 && cur && c == 0)
+        {
+            found = l;
+        }
+        preds[l] = pred;
+        succs[l] = cur;
+    }
+
+    return found;
+}
+/*---------------------------------------------------------------------------*/
+skiplist_t *skiplist_new(void)
+{
+    TRACE_PRINT();
+    skiplist_t *list = malloc(sizeof(skiplist_t));
+
+    if (list == NULL)
+    {
+        return NULL;
+    }
+    list->head = calloc(1, sizeof(struct skip_node) +
+                               SKIPLIST_LEVELS * sizeof(list->head->next[0]));
+    if (list->head == NULL)
+    {
+        free(list);
+        return NULL;
+    }
+    list->head->level = SKIPLIST_LEVELS - 1;
+    list->head->linked = 1;
+    list->count = 0;
+
+    return list;
+}
+/*---------------------------------------------------------------------------*/
+void skiplist_free(skiplist_t *list)
+{
+    TRACE_PRINT();
+    struct skip_node *node, *next;
+
+    for (node = list->head->next[0]; node; node = next)
+    {
+        next = node->next[0];
+        slab_free(node);
+    }
+    free(list->head);
+    free(list);
+}
+/*---------------------------------------------------------------------------*/
+int skiplist_insert(skiplist_t *list, const char *key, size_t len)
+{
+    TRACE_PRINT();
+    struct skip_node *preds[SKIPLIST_LEVELS], *succs[SKIPLIST_LEVELS];
+    struct skip_node *node, *found, *prev;
+    int top, l, valid;
+
+    if (len > MAX_KEY_LEN)
+    {
+        return -1;
+    }
+    /* allocated before any lock is taken */
+    top = skip_level();
+    node = skip_node_new(key, len, top);
+    if (node == NULL)
+    {
+        return -1;
+    }
+    if (epoch_enter() < 0)
+    {
+        slab_free(node);
+        return -1;
+    }
+
+    while (1)
+    {
+        l = skip_find(list, key, len, preds, succs);
+        if (l >= 0)
+        {
+            found = succs[l];
+            if (!__atomic_load_n(&found->marked, __ATOMIC_ACQUIRE))
+            {
+                /* there already, or about to be */
+                while (!__atomic_load_n(&found->linked, __ATOMIC_ACQUIRE))
+                {
+                    sched_yield();
+                }
+                epoch_exit();
+                slab_free(node);
+                return 0;
+            }
+            /* being deleted, find it again once it is gone */
+            sched_yield();
+            continue;
+        }
+
+        /* lock the predecessors bottom up, which is the order of
+         * decreasing keys, and check nothing changed around them */
+        valid = 1;
+        prev = NULL;
+        for (l = 0; valid && l <= top; l++)
+        {
+            if (preds[l] != prev)
+            {
+                skip_lock(preds[l]);
+                prev = preds[l];
+            }
+            valid = !__atomic_load_n(&preds[l]->marked, __ATOMIC_RELAXED) &&
+                    (succs[l] == NULL ||
+                     !__atomic_load_n(&succs[l]->marked, __ATOMIC_RELAXED)) &&
+                    preds[l]->next[l] == succs[l];
+        }
+        if (!valid)
+        {
+            skip_unlock_preds(preds, l - 1);
+            continue;
+        }
+
+        for (l = 0; l <= top; l++)
+        {
+            node->next[l] = succs[l];
+        }
+        /* publish it bottom up, so that a reader finding it at a level
+         * can also follow it below */
+        for (l = 0; l <= top; l++)
+        {
+            __atomic_store_n(&preds[l]->next[l], node, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&node->linked, 1, __ATOMIC_RELEASE);
+        skip_unlock_preds(preds, top);
+        __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED);
+        epoch_exit();
+
+        return 1;
+    }
+}
+/*---------------------------------------------------------------------------*/
+int skiplist_delete(skiplist_t *list, const char *key, size_t len)
+{
+    TRACE_PRINT();
+    struct skip_node *preds[SKIPLIST_LEVELS], *succs[SKIPLIST_LEVELS];
+    struct skip_node *victim = NULL, *prev;
+    int top = -1, l, valid;
+
+    if (len > MAX_KEY_LEN)
+    {
+        return 0;
+    }
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        l = skip_find(list, key, len, preds, succs);
+        if (victim == NULL)
+        {
+            /* only a fully linked node found at its top level */
+            if (l < 0 || succs[l]->level != l ||
+                !__atomic_load_n(&succs[l]->linked, __ATOMIC_ACQUIRE) ||
+                __atomic_load_n(&succs[l]->marked, __ATOMIC_ACQUIRE))
+            {
+                epoch_exit();
+                return 0;
+            }
+            victim = succs[l];
+            top = victim->level;
+            skip_lock(victim);
+            if (victim->marked)
+            {
+                /* another thread is deleting it */
+                skip_unlock(victim);
+                epoch_exit();
+                return 0;
+            }
+            __atomic_store_n(&victim->marked, 1, __ATOMIC_RELEASE);
+        }
+
+        valid = 1;
+        prev = NULL;
+        for (l = 0; valid && l <= top; l++)
+        {
+            if (preds[l] != prev)
+            {
+                skip_lock(preds[l]);
+                prev = preds[l];
+            }
+            valid = !__atomic_load_n(&preds[l]->marked, __ATOMIC_RELAXED) &&
+                    preds[l]->next[l] == victim;
+        }
+        if (!valid)
+        {
+            skip_unlock_preds(preds, l - 1);
+            continue;
+        }
+
+        for (l = top; l >= 0; l--)
+        {
+            __atomic_store_n(&preds[l]->next[l], victim->next[l],
+                             __ATOMIC_RELEASE);
+        }
+        skip_unlock(victim);
+        skip_unlock_preds(preds, top);
+        __atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+        epoch_exit();
+
+        /* readers may still be on it */
+        epoch_retire(victim, slab_free);
+
+        return 1;
+    }
+}
+/*---------------------------------------------------------------------------*/
+long skiplist_range(skiplist_t *list, const char *start, size_t len,
+                    skiplist_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    struct skip_node *preds[SKIPLIST_LEVELS], *succs[SKIPLIST_LEVELS];
+    struct skip_node *node;
+    long n = 0;
+
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+
+    skip_find(list, start, len > MAX_KEY_LEN ? MAX_KEY_LEN : len,
+              preds, succs);
+    for (node = succs[0]; node;
+         node = __atomic_load_n(&node->next[0], __ATOMIC_ACQUIRE))
+    {
+        if (__atomic_load_n(&node->marked, __ATOMIC_ACQUIRE) ||
+            !__atomic_load_n(&node->linked, __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
+        n++;
+        if (visit(arg, node->key, node->len))
+        {
+            break;
+        }
+    }
+    epoch_exit();
+
+    return n;
+}
+/*---------------------------------------------------------------------------*/
+size_t skiplist_count(skiplist_t *list)
+{
+    return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,68 @@
+/*---------------------------------------------------------------------------*/
+/* skiplist.h                                                                */
+/* Concurrent skiplist of keys, the ordered index of the hash table          */
+/*---------------------------------------------------------------------------*/
+#ifndef _SKIPLIST_H
+#define _SKIPLIST_H
+/*---------------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* levels of the list. a key reaches each next level with probability
+ * 1/4, so 16 levels keep searches short up to about 4^16 keys. */
+#define SKIPLIST_LEVELS 16
+/*---------------------------------------------------------------------------*/
+/* called by skiplist_range() for each key, in order. key is not
+ * null-terminated. a non-zero return stops the walk. */
+typedef int (*skiplist_visit_t)(void *arg, const char *key, size_t len);
+/*---------------------------------------------------------------------------*/
+typedef struct skiplist skiplist_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * creates an empty list.
+ * returns NULL when any internal errors occur.
+ */
+skiplist_t *skiplist_new(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees the list and its keys. only call it while no other thread uses
+ * the list.
+ */
+void skiplist_free(skiplist_t *list);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds a key of len bytes, compared as bytes. searches take no lock;
+ * a writer only locks the nodes it links the key behind, so writers of
+ * distant keys never wait for each other.
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully inserted.
+ * returns 0 when the key is already there.
+ */
+int skiplist_insert(skiplist_t *list, const char *key, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * removes a key. its node is freed once no reader can still see it
+ * (epoch.h). must not be called inside a read section.
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully deleted.
+ * returns 0 when there is no such key found.
+ */
+int skiplist_delete(skiplist_t *list, const char *key, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * calls visit for every key from start on, in order, until visit
+ * returns non-zero, in one read section. keys inserted or deleted
+ * meanwhile may or may not be visited.
+ * returns -1 when any internal errors occur.
+ * returns the number of keys visited on success.
+ */
+long skiplist_range(skiplist_t *list, const char *start, size_t len,
+                    skiplist_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the number of keys in the list.
+ */
+size_t skiplist_count(skiplist_t *list);
+/*---------------------------------------------------------------------------*/
+#endif // _SKIPLIST_H
@@ -12,54 +12,118 @@ const char *g_msgs[MSG_COUNT] = {
     "NOT FOUND",
     "UPDATE OK",
     "DELETE OK",
-    "INTERNAL ERR"};
+    "INTERNAL ERR",
+    "SNAPSHOT OK",
+    "SNAPSHOT BUSY",
+    "EXPIRE OK",
+    "MSET OK"};
 const char *g_cmds[CMD_COUNT] = {
     "CREATE",
     "READ",
     "UPDATE",
-    "DELETE"};
+    "DELETE",
+    "SNAPSHOT",
+    "STATS",
+    "EXPIRE",
+    "MGET",
+    "MSET",
+    "SCAN",
+    "RANGE",
+    "PREFIX"};
 // const char *g_crlf = "\r\n";
 const char *g_crlf = "\n";
+/* keys of the MGET or MSET being served, set by skvs_parse_line() */
+static __thread struct
+{
+    const char *keys[MAX_BATCH_KEYS];
+    const char *values[MAX_BATCH_KEYS]; // of MSET, or found by MGET
+    size_t lens[MAX_BATCH_KEYS];
+    size_t n;
+} t_batch;
 /*---------------------------------------------------------------------------*/
-static inline enum CMD
-skvs_parse(char *buffer, size_t len, const char **key, const char **value)
+/* splits the keys of MGET, or the key-value pairs of MSET when pairs is
+ * set, into t_batch.
+ * returns 0 when args hold no key, a too large key, or a key without
+ * its value. returns the number of keys on success. */
+static size_t
+skvs_parse_batch(char *args, int pairs)
 {
-    TRACE_PRINT();
-    char *cmd;
-    int i;
+    char *tok, *saveptr;
+    size_t n = 0;
 
-    if (len > BUFFER_SIZE)
-    {
-        /* too large message */
-        return CMD_INVALID;
-    }
-    if (len == BUFFER_SIZE)
+    for (tok = strtok_r(args, " ", &saveptr); tok;
+         tok = strtok_r(NULL, " ", &saveptr))
     {
-        if (memcmp(&buffer[BUFFER_SIZE - 1], g_crlf, strlen(g_crlf)))
+        if (n == MAX_BATCH_KEYS || strlen(tok) > MAX_KEY_LEN)
         {
-            /* too large message */
-            return CMD_INVALID;
+            return 0;
         }
-
-        /* remove line feed */
-        buffer[BUFFER_SIZE - 1] = '\0';
-    }
-    else
-    {
-        /* make it null-terminated */
-        buffer[len] = '\0';
-
-        char *crlf_ptr = strstr(buffer, g_crlf);
-        if (crlf_ptr == NULL)
+        t_batch.keys[n] = tok;
+        if (pairs)
         {
-            return CMD_INCOMPLETE;
+            t_batch.values[n] = strtok_r(NULL, " ", &saveptr);
+            if (t_batch.values[n] == NULL)
+            {
+                return 0;
+            }
         }
+        n++;
+    }
+    t_batch.n = n;
 
-        /* remove line feed */
-        *crlf_ptr = '\0';
+    return n;
+}
+/*---------------------------------------------------------------------------*/
+/* returns 1 when ttl is a TTL in seconds of at most SKVS_TTL_DIGITS
+ * digits, which may only be 0 when zero_ok is set */
+static inline int
+skvs_ttl_valid(const char *ttl, int zero_ok)
+{
+    size_t len = strspn(ttl, "0123456789");
+
+    return len > 0 && len <= SKVS_TTL_DIGITS && ttl[len] == '\0' &&
+           (zero_ok || strtoul(ttl, NULL, 10) > 0);
+}
+/*---------------------------------------------------------------------------*/
+/* returns 1 when s is a decimal number from min to max */
+static inline int
+skvs_number_valid(const char *s, unsigned long long min,
+                  unsigned long long max)
+{
+    size_t len = strspn(s, "0123456789");
+    unsigned long long n;
+
+    if (len == 0 || s[len] != '\0')
+    {
+        return 0;
     }
+    errno = 0;
+    n = strtoull(s, NULL, 10);
+
+    return errno == 0 && n >= min && n <= max;
+}
+/*---------------------------------------------------------------------------*/
+/* returns the deadline of a valid TTL, 0 for no TTL or a TTL of 0 */
+static inline uint64_t
+skvs_deadline(const char *ttl)
+{
+    unsigned long secs = ttl ? strtoul(ttl, NULL, 10) : 0;
+
+    return secs ? timer_now() + secs * 1000 : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* tokenizes one null-terminated command line without its line feed.
+ * ttl is set to the TTL of CREATE or UPDATE, or NULL without one.
+ * the keys of MGET and MSET go to t_batch. */
+static inline enum CMD
+skvs_parse_line(char *line, const char **key, const char **value,
+                const char **ttl)
+{
+    TRACE_PRINT();
+    char *cmd, *args, *saveptr;
+    int i;
 
-    cmd = strtok(buffer, " ");
+    cmd = strtok_r(line, " ", &saveptr);
     if (cmd == NULL)
     {
         /* no command found */
@@ -76,7 +140,25 @@ skvs_parse(char *buffer, size_t len, const char **key, const char **value)
     {
         if (strcmp(cmd, g_cmds[i]) == 0)
         {
-            *key = strtok(NULL, " ");
+            if (i == CMD_SNAPSHOT || i == CMD_STATS)
+            {
+                /* SNAPSHOT and STATS take no key */
+                return strtok_r(NULL, " ", &saveptr) ? CMD_INVALID : i;
+            }
+            if (i == CMD_MGET || i == CMD_MSET)
+            {
+                /* the rest of the line is a list of keys, or of pairs */
+                *key = *value = *ttl = NULL;
+                args = strtok_r(NULL, "", &saveptr);
+                if (args == NULL ||
+                    skvs_parse_batch(args, i == CMD_MSET) == 0)
+                {
+                    return CMD_INVALID;
+                }
+                return i;
+            }
+
+            *key = strtok_r(NULL, " ", &saveptr);
             if (*key == NULL)
             {
                 /* no key found */
@@ -88,7 +170,8 @@ skvs_parse(char *buffer, size_t len, const char **key, const char **value)
                 return CMD_INVALID;
             }
 
-            *value = strtok(NULL, " ");
+            *value = strtok_r(NULL, " ", &saveptr);
+            *ttl = NULL;
 
             /* handle specific cases for READ and DELETE */
             if ((i == CMD_READ || i == CMD_DELETE) && *value != NULL)
@@ -103,9 +186,50 @@ skvs_parse(char *buffer, size_t len, const char **key, const char **value)
                 /* CREATE or UPDATE must have a value */
                 return CMD_INVALID;
             }
+            if (i == CMD_CREATE || i == CMD_UPDATE)
+            {
+                /* and may have a TTL in seconds */
+                *ttl = strtok_r(NULL, " ", &saveptr);
+                if (*ttl && !skvs_ttl_valid(*ttl, 0))
+                {
+                    return CMD_INVALID;
+                }
+            }
+
+            /* EXPIRE must have a TTL, where 0 removes it */
+            if (i == CMD_EXPIRE &&
+                (*value == NULL || !skvs_ttl_valid(*value, 1)))
+            {
+                return CMD_INVALID;
+            }
+
+            /* SCAN must have a cursor, and may have a count */
+            if (i == CMD_SCAN &&
+                (!skvs_number_valid(*key, 0, UINT64_MAX) ||
+                 (*value && !skvs_number_valid(*value, 1, SKVS_SCAN_MAX))))
+            {
+                return CMD_INVALID;
+            }
+
+            /* RANGE must have an end, and may have a limit, which comes
+             * as the TTL. PREFIX may have a limit. */
+            if (i == CMD_RANGE)
+            {
+                *ttl = strtok_r(NULL, " ", &saveptr);
+                if (*value == NULL || strlen(*value) > MAX_KEY_LEN ||
+                    (*ttl && !skvs_number_valid(*ttl, 1, SKVS_RANGE_MAX)))
+                {
+                    return CMD_INVALID;
+                }
+            }
+            if (i == CMD_PREFIX &&
+                *value && !skvs_number_valid(*value, 1, SKVS_RANGE_MAX))
+            {
+                return CMD_INVALID;
+            }
 
             /* check for extra tokens after value */
-            if (strtok(NULL, " ") != NULL)
+            if (strtok_r(NULL, " ", &saveptr) != NULL)
             {
                 /* extra tokens found */
                 return CMD_INVALID;
@@ -120,18 +244,72 @@ skvs_parse(char *buffer, size_t len, const char **key, const char **value)
     return CMD_INVALID;
 }
 /*---------------------------------------------------------------------------*/
+static inline enum CMD
+skvs_parse(char *buffer, size_t len, const char **key, const char **value,
+           const char **ttl)
+{
+    TRACE_PRINT();
+
+    if (len > BUFFER_SIZE)
+    {
+        /* too large message */
+        return CMD_INVALID;
+    }
+    if (len == BUFFER_SIZE)
+    {
+        if (memcmp(&buffer[BUFFER_SIZE - 1], g_crlf, strlen(g_crlf)))
+        {
+            /* too large message */
+            return CMD_INVALID;
+        }
+
+        /* remove line feed */
+        buffer[BUFFER_SIZE - 1] = '\0';
+    }
+    else
+    {
+        /* make it null-terminated */
+        buffer[len] = '\0';
+
+        char *crlf_ptr = strstr(buffer, g_crlf);
+        if (crlf_ptr == NULL)
+        {
+            return CMD_INCOMPLETE;
+        }
+
+        /* remove line feed */
+        *crlf_ptr = '\0';
+    }
+
+    return skvs_parse_line(buffer, key, value, ttl);
+}
+/*---------------------------------------------------------------------------*/
 struct skvs_ctx *
 skvs_init(size_t hash_size, int delay)
+{
+    TRACE_PRINT();
+    hash_opts_t opts = {
+        .hash_size = hash_size,
+        .delay = delay,
+        .engine = HASH_ENGINE_CHAIN,
+    };
+
+    return skvs_init_opts(&opts);
+}
+/*---------------------------------------------------------------------------*/
+struct skvs_ctx *
+skvs_init_opts(const hash_opts_t *opts)
 {
     TRACE_PRINT();
     struct skvs_ctx *ctx = calloc(1, sizeof(struct skvs_ctx));
     /* initialize the global hash table */
-    ctx->table = hash_init(hash_size, delay);
+    ctx->table = hash_init_opts(opts);
     if (ctx->table == NULL)
     {
         DEBUG_PRINT("Failed to initialize global hash table");
         return NULL;
     }
+    clock_gettime(CLOCK_MONOTONIC, &ctx->started);
 
     return ctx;
 }
@@ -143,6 +321,20 @@ int skvs_destroy(struct skvs_ctx *ctx, int dump)
     {
         hash_dump(ctx->table);
     }
+    if (ctx->snap)
+    {
+        snapshot_close(ctx->snap);
+        ctx->snap = NULL;
+    }
+    if (ctx->wal)
+    {
+        hash_set_write_hook(ctx->table, NULL, NULL);
+        if (wal_close(ctx->wal) < 0)
+        {
+            DEBUG_PRINT("Failed to close the log");
+        }
+        ctx->wal = NULL;
+    }
     if (hash_destroy(ctx->table) < 0)
     {
         return -1;
@@ -151,25 +343,266 @@ int skvs_destroy(struct skvs_ctx *ctx, int dump)
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-const char *
-skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen)
+/* holds expiry while the table is recovered, see skvs_recovered() */
+static void
+skvs_recovering(struct skvs_ctx *ctx)
+{
+    if (!ctx->recovering)
+    {
+        hash_expiry_hold(ctx->table);
+        ctx->recovering = 1;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void skvs_recovered(struct skvs_ctx *ctx)
 {
     TRACE_PRINT();
-    const char *resp, *key = NULL, *value = NULL;
-    enum CMD cmd;
+
+    if (ctx->recovering)
+    {
+        hash_expiry_release(ctx->table);
+        ctx->recovering = 0;
+    }
+}
+/*---------------------------------------------------------------------------*/
+int skvs_open_wal(struct skvs_ctx *ctx, const char *path,
+                  int sync, int interval_ms)
+{
+    TRACE_PRINT();
+    long applied;
+
+    ctx->wal = wal_open(path, sync, interval_ms);
+    if (ctx->wal == NULL)
+    {
+        return -1;
+    }
+    skvs_recovering(ctx);
+    applied = wal_replay(ctx->wal, ctx->table);
+    if (applied < 0)
+    {
+        wal_close(ctx->wal);
+        ctx->wal = NULL;
+        return -1;
+    }
+    printf("Log: replayed %ld records from %s\n", applied, path);
+    hash_set_write_hook(ctx->table, wal_append, ctx->wal);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int skvs_open_snapshot(struct skvs_ctx *ctx, const char *path,
+                       int interval_s)
+{
+    TRACE_PRINT();
+    long loaded;
+
+    skvs_recovering(ctx);
+    loaded = snapshot_load(ctx->table, path);
+    if (loaded < 0)
+    {
+        return -1;
+    }
+    ctx->snap = snapshot_open(ctx->table, path, interval_s);
+    if (ctx->snap == NULL)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* makes the writes of the calling thread durable before they are acked.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static inline int
+skvs_commit(struct skvs_ctx *ctx)
+{
+    return ctx->wal ? wal_commit(ctx->wal) : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* formats the counters of the table and the allocator as one line of
+ * name=value pairs into buf.
+ * returns the length of the line. */
+static int
+skvs_stats(struct skvs_ctx *ctx, char *buf, size_t size)
+{
+    struct hash_stats hs;
+    struct slab_stats ss;
+    struct timespec now;
+    unsigned long reads;
+    double secs;
+    int len;
+
+    hash_stats(ctx->table, &hs);
+    slab_stats(&ss);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    secs = (now.tv_sec - ctx->started.tv_sec) +
+           (now.tv_nsec - ctx->started.tv_nsec) / 1e9;
+    reads = hs.hits + hs.misses;
+
+    len = snprintf(buf, size,
+                   "entries=%zu mem_used=%zu mem_limit=%zu "
+                   "hits=%lu misses=%lu hit_ratio=%.4f "
+                   "evictions=%lu evictions_per_s=%.1f expired=%lu "
+                   "batch_keys=%lu batch_locks=%lu "
+                   "slab_reserved=%zu slab_in_use=%zu uptime_s=%.1f",
+                   hs.entries, hs.mem_used, hs.mem_limit,
+                   hs.hits, hs.misses, reads ? (double)hs.hits / reads : 0,
+                   hs.evictions, secs > 0 ? hs.evictions / secs : 0,
+                   hs.expired, hs.batch_keys, hs.batch_locks,
+                   ss.reserved, ss.in_use, secs);
+
+    return len < (int)size ? len : (int)size - 1;
+}
+/*---------------------------------------------------------------------------*/
+/* keys found by a SCAN, RANGE or PREFIX, a line feed before each */
+struct skvs_scan
+{
+    struct skvs_buf keys;
+    unsigned long n;
+    int err;
+};
+/*---------------------------------------------------------------------------*/
+static int
+skvs_scan_visit(void *arg, const char *key, size_t key_len,
+                const char *value, size_t value_len)
+{
+    struct skvs_scan *scan = arg;
+
+    if (skvs_buf_append(&scan->keys, g_crlf, strlen(g_crlf)) < 0 ||
+        skvs_buf_append(&scan->keys, key, key_len) < 0)
+    {
+        scan->err = 1;
+        return 0;
+    }
+    scan->n++;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* scans the table from cursor for count steps, or SKVS_SCAN_COUNT when
+ * count is NULL, and formats the response into out: the next cursor and
+ * the number of keys found, then a line for each key.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+skvs_scan(struct skvs_ctx *ctx, const char *cursor, const char *count,
+          struct skvs_buf *out)
+{
+    /* the keys are kept until the next SCAN of the thread */
+    static __thread struct skvs_scan scan;
+    char line[64];
+    uint64_t next;
+    int len;
+
+    scan.keys.len = 0;
+    scan.n = 0;
+    scan.err = 0;
+    next = hash_scan(ctx->table, strtoull(cursor, NULL, 10),
+                     count ? strtoul(count, NULL, 10) : SKVS_SCAN_COUNT,
+                     skvs_scan_visit, &scan);
+    if (scan.err)
+    {
+        return -1;
+    }
+
+    len = snprintf(line, sizeof(line), "%llu %lu",
+                   (unsigned long long)next, scan.n);
+    out->len = 0;
+    if (skvs_buf_append(out, line, len) < 0 ||
+        skvs_buf_append(out, scan.keys.data, scan.keys.len) < 0 ||
+        skvs_buf_append(out, "", 1) < 0)
+    {
+        return -1;
+    }
+    /* the null byte is only there for skvs_serve() */
+    out->len--;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+skvs_range_visit(void *arg, const char *key, size_t len)
+{
+    return skvs_scan_visit(arg, key, len, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* looks up the keys of a RANGE from start up to end, or of a PREFIX
+ * when end is NULL, at most limit of them or SKVS_RANGE_LIMIT when limit
+ * is NULL, and formats the response into out: the number of keys found,
+ * then a line for each key, in order.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+skvs_range(struct skvs_ctx *ctx, const char *start, const char *end,
+           const char *limit, struct skvs_buf *out)
+{
+    /* the keys are kept until the next RANGE or PREFIX of the thread */
+    static __thread struct skvs_scan range;
+    size_t max = limit ? strtoul(limit, NULL, 10) : SKVS_RANGE_LIMIT;
+    char line[32];
+    long n;
+    int len;
+
+    range.keys.len = 0;
+    range.n = 0;
+    range.err = 0;
+    if (end)
+    {
+        n = hash_range(ctx->table, start, end, max, skvs_range_visit, &range);
+    }
+    else
+    {
+        n = hash_prefix(ctx->table, start, max, skvs_range_visit, &range);
+    }
+    if (n < 0 || range.err)
+    {
+        return -1;
+    }
+
+    len = snprintf(line, sizeof(line), "%lu", range.n);
+    out->len = 0;
+    if (skvs_buf_append(out, line, len) < 0 ||
+        skvs_buf_append(out, range.keys.data, range.keys.len) < 0 ||
+        skvs_buf_append(out, "", 1) < 0)
+    {
+        return -1;
+    }
+    out->len--;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* executes a parsed command and returns its response. ttl is the TTL of
+ * CREATE or UPDATE, the limit of RANGE, or NULL.
+ * when pinned is not NULL, a value returned for READ or STATS is pinned,
+ * *pinned is set to it (or NULL for a static message),
+ * and *len to the length of the response. */
+static const char *
+skvs_exec(struct skvs_ctx *ctx, enum CMD cmd,
+          const char *key, const char *value, const char *ttl,
+          const char **pinned, size_t *len)
+{
+    TRACE_PRINT();
+    /* the STATS line of skvs_serve() stays until the next one */
+    static __thread char stats[BUFFER_SIZE];
+    /* and so does the response of SCAN, RANGE or PREFIX */
+    static __thread struct skvs_buf scan;
+    const char *resp;
     int ret;
 
-    /* parse the command */
-    cmd = skvs_parse(rbuf, rlen, &key, &value);
+    if (pinned)
+    {
+        *pinned = NULL;
+    }
 
-    /* handle request */
     switch (cmd)
     {
     case CMD_INCOMPLETE:
         resp = NULL;
         break;
     case CMD_CREATE:
-        ret = hash_insert(ctx->table, key, value);
+        ret = hash_insert_ttl(ctx->table, key, value, skvs_deadline(ttl));
         if (ret > 0)
         {
             resp = g_msgs[MSG_CREATE_OK];
@@ -184,7 +617,19 @@ skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen)
         }
         break;
     case CMD_READ:
-        ret = hash_search(ctx->table, key, &value);
+        if (pinned)
+        {
+            ret = hash_search_pin(ctx->table, key, &value, len);
+            if (ret > 0)
+            {
+                *pinned = value;
+                return value;
+            }
+        }
+        else
+        {
+            ret = hash_search(ctx->table, key, &value);
+        }
         if (ret > 0)
         {
             resp = (const char *)value;
@@ -199,7 +644,7 @@ skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen)
         }
         break;
     case CMD_UPDATE:
-        ret = hash_update(ctx->table, key, value);
+        ret = hash_update_ttl(ctx->table, key, value, skvs_deadline(ttl));
         if (ret > 0)
         {
             resp = g_msgs[MSG_UPDATE_OK];
@@ -228,11 +673,921 @@ skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen)
             resp = g_msgs[MSG_INTERNAL_ERR];
         }
         break;
-    case CMD_INVALID:
-    default:
+    case CMD_EXPIRE:
+        /* the TTL comes as the value */
+        ret = hash_expire(ctx->table, key, skvs_deadline(value));
+        if (ret > 0)
+        {
+            resp = g_msgs[MSG_EXPIRE_OK];
+        }
+        else if (ret == 0)
+        {
+            resp = g_msgs[MSG_NOT_FOUND];
+        }
+        else
+        {
+            resp = g_msgs[MSG_INTERNAL_ERR];
+        }
+        break;
+    case CMD_MSET:
+        ret = hash_set_many(ctx->table, t_batch.keys, t_batch.values,
+                            t_batch.n);
+        resp = g_msgs[ret == 0 ? MSG_MSET_OK : MSG_INTERNAL_ERR];
+        break;
+    case CMD_MGET:
+        /* answered with a line per key by skvs_serve_all() and
+         * skvs_serve_iov() */
         resp = g_msgs[MSG_INVALID];
         break;
-    }
-
-    return resp;
+    case CMD_SCAN:
+    case CMD_RANGE:
+    case CMD_PREFIX:
+        /* the cursor, start or prefix comes as the key, and the count,
+         * end or limit as the value */
+        if (cmd == CMD_SCAN)
+        {
+            ret = skvs_scan(ctx, key, value, &scan);
+        }
+        else if (ctx->table->index == NULL)
+        {
+            /* the server keeps no ordered index */
+            resp = g_msgs[MSG_INVALID];
+            break;
+        }
+        else if (cmd == CMD_RANGE)
+        {
+            ret = skvs_range(ctx, key, value, ttl, &scan);
+        }
+        else
+        {
+            ret = skvs_range(ctx, key, NULL, value, &scan);
+        }
+        if (ret < 0)
+        {
+            resp = g_msgs[MSG_INTERNAL_ERR];
+        }
+        else if (pinned)
+        {
+            /* sent like a value, as STATS is */
+            resp = hash_value_new(scan.data, scan.len);
+            if (resp)
+            {
+                *pinned = resp;
+                *len = scan.len;
+                return resp;
+            }
+            resp = g_msgs[MSG_INTERNAL_ERR];
+        }
+        else
+        {
+            resp = scan.data;
+        }
+        break;
+    case CMD_SNAPSHOT:
+        if (ctx->snap == NULL)
+        {
+            /* the server keeps no snapshot file */
+            resp = g_msgs[MSG_INVALID];
+        }
+        else if ((ret = snapshot_request(ctx->snap)) > 0)
+        {
+            resp = g_msgs[MSG_SNAPSHOT_OK];
+        }
+        else if (ret == 0)
+        {
+            resp = g_msgs[MSG_SNAPSHOT_BUSY];
+        }
+        else
+        {
+            resp = g_msgs[MSG_INTERNAL_ERR];
+        }
+        break;
+    case CMD_STATS:
+        ret = skvs_stats(ctx, stats, sizeof(stats));
+        if (pinned)
+        {
+            /* sent like a value, so that a later STATS of the same
+             * batch does not overwrite it */
+            resp = hash_value_new(stats, ret);
+            if (resp)
+            {
+                *pinned = resp;
+                *len = ret;
+                return resp;
+            }
+            resp = g_msgs[MSG_INTERNAL_ERR];
+        }
+        else
+        {
+            resp = stats;
+        }
+        break;
+    case CMD_INVALID:
+    default:
+        resp = g_msgs[MSG_INVALID];
+        break;
+    }
+
+    if (pinned && resp)
+    {
+        *len = strlen(resp);
+    }
+
+    return resp;
+}
+/*---------------------------------------------------------------------------*/
+const char *
+skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen)
+{
+    TRACE_PRINT();
+    const char *key = NULL, *value = NULL, *ttl = NULL;
+    const char *resp;
+    enum CMD cmd;
+
+    /* parse the command */
+    cmd = skvs_parse(rbuf, rlen, &key, &value, &ttl);
+
+    /* handle request */
+    resp = skvs_exec(ctx, cmd, key, value, ttl, NULL, NULL);
+    if (skvs_commit(ctx) < 0)
+    {
+        return g_msgs[MSG_INTERNAL_ERR];
+    }
+
+    return resp;
+}
+/*---------------------------------------------------------------------------*/
+/* looks up the keys of the MGET in t_batch, pinning the found values.
+ * returns the message for the keys not found: NOT FOUND, or INTERNAL ERR
+ * for every key when the lookup failed. */
+static const char *
+skvs_mget(struct skvs_ctx *ctx)
+{
+    if (hash_search_many(ctx->table, t_batch.keys, t_batch.n,
+                         t_batch.values, t_batch.lens) < 0)
+    {
+        memset(t_batch.values, 0, t_batch.n * sizeof(t_batch.values[0]));
+        return g_msgs[MSG_INTERNAL_ERR];
+    }
+
+    return g_msgs[MSG_NOT_FOUND];
+}
+/*---------------------------------------------------------------------------*/
+/* answers the MGET in t_batch with a line per key, as READ would answer
+ * it, appended to out.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+skvs_mget_buf(struct skvs_ctx *ctx, struct skvs_buf *out)
+{
+    const char *missing = skvs_mget(ctx), *v;
+    size_t i, crlf_len = strlen(g_crlf);
+    int ret = 0;
+
+    for (i = 0; i < t_batch.n; i++)
+    {
+        v = t_batch.values[i];
+        if (ret == 0)
+        {
+            ret = v ? skvs_buf_append(out, v, t_batch.lens[i])
+                    : skvs_buf_append(out, missing, strlen(missing));
+        }
+        if (ret == 0)
+        {
+            ret = skvs_buf_append(out, g_crlf, crlf_len);
+        }
+        /* copied, or not sent at all */
+        if (v)
+        {
+            hash_value_unpin(v);
+        }
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+ssize_t
+skvs_serve_all(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
+               struct skvs_buf *out, unsigned long *served)
+{
+    TRACE_PRINT();
+    const char *resp, *key, *value, *ttl, *pinned;
+    char *line, *lf, *end = rbuf + rlen;
+    size_t crlf_len = strlen(g_crlf), len;
+    enum CMD cmd;
+    int ret;
+
+    line = rbuf;
+    while (line < end)
+    {
+        lf = memchr(line, '\n', end - line);
+        if (lf == NULL)
+        {
+            if (end - line < BUFFER_SIZE)
+            {
+                /* incomplete command, keep it for the next read */
+                break;
+            }
+
+            /* too large message */
+            if (skvs_buf_append(out, g_msgs[MSG_INVALID],
+                                strlen(g_msgs[MSG_INVALID])) < 0 ||
+                skvs_buf_append(out, g_crlf, crlf_len) < 0)
+            {
+                return -1;
+            }
+            line = end;
+            break;
+        }
+
+        key = value = ttl = NULL;
+        if (lf + 1 - line > BUFFER_SIZE)
+        {
+            /* too large message */
+            cmd = CMD_INVALID;
+        }
+        else
+        {
+            /* remove line feed */
+            *lf = '\0';
+            cmd = skvs_parse_line(line, &key, &value, &ttl);
+        }
+        line = lf + 1;
+
+        if (cmd == CMD_MGET)
+        {
+            if (skvs_mget_buf(ctx, out) < 0)
+            {
+                return -1;
+            }
+            if (served)
+            {
+                (*served)++;
+            }
+            continue;
+        }
+
+        /* a value found by READ is pinned until it is copied. writes
+         * retire memory, so they must not run in a read section. */
+        resp = skvs_exec(ctx, cmd, key, value, ttl, &pinned, &len);
+        ret = skvs_buf_append(out, resp, len);
+        if (pinned)
+        {
+            hash_value_unpin(pinned);
+        }
+        if (ret < 0 || skvs_buf_append(out, g_crlf, crlf_len) < 0)
+        {
+            return -1;
+        }
+        if (served)
+        {
+            (*served)++;
+        }
+    }
+
+    /* one commit for the whole batch, before any response is sent */
+    if (skvs_commit(ctx) < 0)
+    {
+        return -1;
+    }
+
+    return line - rbuf;
+}
+/*---------------------------------------------------------------------------*/
+static void
+skvs_chunks_free(struct skvs_chunk *chunk)
+{
+    struct skvs_chunk *next;
+
+    while (chunk)
+    {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* appends one iovec; pin is the pinned value it points into, if any */
+static int
+skvs_resp_add(struct skvs_resp *resp, const char *data, size_t len,
+              const char *pin)
+{
+    struct iovec *iov;
+    const char **pins;
+    int cap;
+
+    if (resp->cnt == resp->cap)
+    {
+        cap = resp->cap ? resp->cap * 2 : SKVS_RESP_IOV;
+        iov = realloc(resp->iov, cap * sizeof(*iov));
+        if (iov == NULL)
+        {
+            return -1;
+        }
+        resp->iov = iov;
+        pins = realloc(resp->pins, cap * sizeof(*pins));
+        if (pins == NULL)
+        {
+            return -1;
+        }
+        resp->pins = pins;
+        resp->cap = cap;
+    }
+
+    resp->iov[resp->cnt].iov_base = (void *)data;
+    resp->iov[resp->cnt].iov_len = len;
+    resp->pins[resp->cnt] = pin;
+    resp->cnt++;
+    resp->len += len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* returns scratch memory that stays in place until resp is drained */
+static void *
+skvs_resp_scratch(struct skvs_resp *resp, size_t size)
+{
+    struct skvs_chunk *chunk = resp->chunks;
+
+    if (chunk == NULL || chunk->used + size > SKVS_CHUNK_SIZE)
+    {
+        chunk = malloc(sizeof(struct skvs_chunk));
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->next = resp->chunks;
+        resp->chunks = chunk;
+    }
+
+    chunk->used += size;
+
+    return chunk->data + chunk->used - size;
+}
+/*---------------------------------------------------------------------------*/
+/* answers the MGET in t_batch with a line per key, as READ would answer
+ * it, appended to resp. a found value is pinned until it is sent.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+skvs_mget_iov(struct skvs_ctx *ctx, struct skvs_resp *resp)
+{
+    const char *missing = skvs_mget(ctx), *v;
+    size_t i, crlf_len = strlen(g_crlf);
+    int ret = 0;
+
+    for (i = 0; i < t_batch.n; i++)
+    {
+        v = t_batch.values[i];
+        if (ret < 0)
+        {
+            /* not sent, so drop the pins of the rest */
+            if (v)
+            {
+                hash_value_unpin(v);
+            }
+            continue;
+        }
+        if ((v ? skvs_resp_add(resp, v, t_batch.lens[i], v)
+               : skvs_resp_add(resp, missing, strlen(missing), NULL)) < 0)
+        {
+            if (v)
+            {
+                hash_value_unpin(v);
+            }
+            ret = -1;
+            continue;
+        }
+        if (skvs_resp_add(resp, g_crlf, crlf_len, NULL) < 0)
+        {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/* parses one binary frame at the beginning of buf into its command, its
+ * id, and its key and value, null-terminated. value has room for
+ * BUFFER_SIZE bytes. the command is CMD_INVALID when the frame is not a
+ * valid request.
+ * returns the frame length when parsed,
+ * 0 when the frame is incomplete,
+ * -1 when the frame is malformed. */
+static ssize_t
+skvs_parse_bin(const char *buf, size_t avail, enum CMD *cmd, uint32_t *id,
+               char *key, char *value)
+{
+    TRACE_PRINT();
+    struct bin_hdr req;
+    size_t klen, vlen, total;
+
+    if (avail < sizeof(req))
+    {
+        return 0;
+    }
+    memcpy(&req, buf, sizeof(req));
+    klen = ntohs(req.klen);
+    vlen = ntohl(req.vlen);
+    total = sizeof(req) + klen + vlen;
+    if (total > BUFFER_SIZE || klen > MAX_KEY_LEN)
+    {
+        /* too large message, no way to find the next frame */
+        return -1;
+    }
+    if (avail < total)
+    {
+        return 0;
+    }
+
+    /* the hash table takes null-terminated strings */
+    memcpy(key, buf + sizeof(req), klen);
+    key[klen] = '\0';
+    memcpy(value, buf + sizeof(req) + klen, vlen);
+    value[vlen] = '\0';
+    *id = req.id;
+    *cmd = CMD_INVALID;
+
+    if (req.op == CMD_SNAPSHOT || req.op == CMD_STATS)
+    {
+        /* SNAPSHOT and STATS take no key */
+        *cmd = klen == 0 && vlen == 0 ? req.op : CMD_INVALID;
+    }
+    else if (req.op < CMD_COUNT && klen > 0 && strlen(key) == klen &&
+             strlen(value) == vlen)
+    {
+        *cmd = req.op;
+        if ((*cmd == CMD_READ || *cmd == CMD_DELETE) && vlen > 0)
+        {
+            /* READ or DELETE should not have a value */
+            *cmd = CMD_INVALID;
+        }
+        if ((*cmd == CMD_CREATE || *cmd == CMD_UPDATE) && vlen == 0)
+        {
+            /* CREATE or UPDATE must have a value */
+            *cmd = CMD_INVALID;
+        }
+        if (*cmd == CMD_EXPIRE && !skvs_ttl_valid(value, 1))
+        {
+            /* EXPIRE must have a TTL */
+            *cmd = CMD_INVALID;
+        }
+        if (*cmd == CMD_MGET || *cmd == CMD_MSET || *cmd == CMD_SCAN ||
+            *cmd == CMD_RANGE || *cmd == CMD_PREFIX)
+        {
+            /* a frame carries one key, and SCAN, RANGE and PREFIX may
+             * answer more than a frame holds */
+            *cmd = CMD_INVALID;
+        }
+    }
+
+    return total;
+}
+/*---------------------------------------------------------------------------*/
+/* appends the answer msg of len bytes returned by skvs_exec() to resp,
+ * as a line, or as a binary frame of id when bin is set. pinned is the
+ * pinned value of the answer, or NULL. resp releases the pin once the
+ * answer is sent, or right away on failure.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+skvs_resp_answer(struct skvs_resp *resp, int bin, uint32_t id,
+                 const char *msg, size_t len, const char *pinned)
+{
+    struct bin_hdr *hdr;
+    int i;
+
+    if (!bin)
+    {
+        /* no copy: the iovec points at the message or the pinned value */
+        if (skvs_resp_add(resp, msg, len, pinned) < 0)
+        {
+            if (pinned)
+            {
+                hash_value_unpin(pinned);
+            }
+            return -1;
+        }
+        return skvs_resp_add(resp, g_crlf, strlen(g_crlf), NULL);
+    }
+
+    hdr = skvs_resp_scratch(resp, sizeof(*hdr));
+    if (hdr == NULL)
+    {
+        if (pinned)
+        {
+            hash_value_unpin(pinned);
+        }
+        return -1;
+    }
+    hdr->magic = BIN_MAGIC;
+    hdr->op = BIN_ST_VALUE;
+    hdr->klen = 0;
+    hdr->vlen = htonl(pinned ? len : 0);
+    hdr->id = id;
+    if (!pinned)
+    {
+        /* fixed messages are sent by their index */
+        i = 0;
+        while (i < MSG_COUNT && msg != g_msgs[i])
+        {
+            i++;
+        }
+        hdr->op = i < MSG_COUNT ? i : MSG_INTERNAL_ERR;
+    }
+
+    if (skvs_resp_add(resp, (const char *)hdr, sizeof(*hdr), NULL) < 0)
+    {
+        if (pinned)
+        {
+            hash_value_unpin(pinned);
+        }
+        return -1;
+    }
+    if (pinned && skvs_resp_add(resp, pinned, len, pinned) < 0)
+    {
+        hash_value_unpin(pinned);
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* serves one binary frame at the beginning of buf.
+ * returns the frame length when served,
+ * 0 when the frame is incomplete,
+ * -1 when the frame is malformed or any internal errors occur. */
+static ssize_t
+skvs_serve_bin(struct skvs_ctx *ctx, const char *buf, size_t avail,
+               struct skvs_resp *resp)
+{
+    TRACE_PRINT();
+    char key[MAX_KEY_LEN + 1], value[BUFFER_SIZE];
+    const char *msg, *pinned;
+    ssize_t total;
+    size_t len;
+    uint32_t id;
+    enum CMD cmd;
+
+    total = skvs_parse_bin(buf, avail, &cmd, &id, key, value);
+    if (total <= 0)
+    {
+        return total;
+    }
+
+    msg = skvs_exec(ctx, cmd, key, value, NULL, &pinned, &len);
+    if (skvs_resp_answer(resp, 1, id, msg, len, pinned) < 0)
+    {
+        return -1;
+    }
+
+    return total;
+}
+/*---------------------------------------------------------------------------*/
+ssize_t
+skvs_serve_iov(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
+               struct skvs_resp *resp, unsigned long *served)
+{
+    TRACE_PRINT();
+    const char *msg, *key, *value, *ttl, *pinned;
+    char *line, *lf, *end = rbuf + rlen;
+    size_t len, crlf_len = strlen(g_crlf);
+    ssize_t flen;
+    enum CMD cmd;
+
+    line = rbuf;
+    while (line < end)
+    {
+        if ((unsigned char)*line == BIN_MAGIC)
+        {
+            flen = skvs_serve_bin(ctx, line, end - line, resp);
+            if (flen < 0)
+            {
+                return -1;
+            }
+            if (flen == 0)
+            {
+                /* incomplete frame, keep it for the next read */
+                break;
+            }
+            line += flen;
+            if (served)
+            {
+                (*served)++;
+            }
+            continue;
+        }
+
+        lf = memchr(line, '\n', end - line);
+        if (lf == NULL)
+        {
+            if (end - line < BUFFER_SIZE)
+            {
+                /* incomplete command, keep it for the next read */
+                break;
+            }
+
+            /* too large message */
+            if (skvs_resp_add(resp, g_msgs[MSG_INVALID],
+                              strlen(g_msgs[MSG_INVALID]), NULL) < 0 ||
+                skvs_resp_add(resp, g_crlf, crlf_len, NULL) < 0)
+            {
+                return -1;
+            }
+            line = end;
+            break;
+        }
+
+        key = value = ttl = NULL;
+        if (lf + 1 - line > BUFFER_SIZE)
+        {
+            /* too large message */
+            cmd = CMD_INVALID;
+        }
+        else
+        {
+            /* remove line feed */
+            *lf = '\0';
+            cmd = skvs_parse_line(line, &key, &value, &ttl);
+        }
+        line = lf + 1;
+
+        if (cmd == CMD_MGET)
+        {
+            if (skvs_mget_iov(ctx, resp) < 0)
+            {
+                return -1;
+            }
+            if (served)
+            {
+                (*served)++;
+            }
+            continue;
+        }
+
+        msg = skvs_exec(ctx, cmd, key, value, ttl, &pinned, &len);
+        if (skvs_resp_answer(resp, 0, 0, msg, len, pinned) < 0)
+        {
+            return -1;
+        }
+        if (served)
+        {
+            (*served)++;
+        }
+    }
+
+    /* one commit for the whole batch, before any response is sent */
+    if (skvs_commit(ctx) < 0)
+    {
+        return -1;
+    }
+
+    return line - rbuf;
+}
+/*---------------------------------------------------------------------------*/
+ssize_t skvs_parse_req(char *buf, size_t len, struct skvs_req *req)
+{
+    TRACE_PRINT();
+    const char *key = NULL, *value = NULL, *ttl = NULL;
+    char *lf;
+    ssize_t used;
+    size_t ttl_len;
+
+    req->next = NULL;
+    req->done = 0;
+    req->pinned = NULL;
+    req->has_value = 0;
+    req->has_ttl = 0;
+    req->value_len = 0;
+    req->key[0] = '\0';
+    req->data[0] = '\0';
+
+    if ((unsigned char)*buf == BIN_MAGIC)
+    {
+        req->bin = 1;
+        used = skvs_parse_bin(buf, len, &req->cmd, &req->id,
+                              req->key, req->data);
+        if (used > 0)
+        {
+            req->has_value = 1;
+            req->value_len = strlen(req->data);
+        }
+        return used;
+    }
+
+    req->bin = 0;
+    req->id = 0;
+    lf = memchr(buf, '\n', len);
+    if (lf == NULL)
+    {
+        if (len < BUFFER_SIZE)
+        {
+            /* incomplete command */
+            return 0;
+        }
+        /* too large message */
+        req->cmd = CMD_INVALID;
+        return len;
+    }
+    used = lf + 1 - buf;
+    if (used > BUFFER_SIZE)
+    {
+        /* too large message */
+        req->cmd = CMD_INVALID;
+        return used;
+    }
+
+    *lf = '\0';
+    req->cmd = skvs_parse_line(buf, &key, &value, &ttl);
+    if (req->cmd == CMD_MGET || req->cmd == CMD_MSET ||
+        req->cmd == CMD_SCAN || req->cmd == CMD_RANGE ||
+        req->cmd == CMD_PREFIX)
+    {
+        /* their keys belong to any shard */
+        req->cmd = CMD_INVALID;
+        return used;
+    }
+
+    /* the tokens point into buf, which is reused for the next read */
+    if (key)
+    {
+        strcpy(req->key, key);
+    }
+    if (value)
+    {
+        req->has_value = 1;
+        req->value_len = strlen(value);
+        memcpy(req->data, value, req->value_len + 1);
+    }
+    if (ttl)
+    {
+        ttl_len = strlen(ttl);
+        req->has_ttl = 1;
+        memcpy(req->data + req->value_len + 1, ttl, ttl_len + 1);
+    }
+
+    return used;
+}
+/*---------------------------------------------------------------------------*/
+struct skvs_req *skvs_req_dup(const struct skvs_req *req)
+{
+    TRACE_PRINT();
+    size_t size = sizeof(*req) + req->value_len + 1;
+    struct skvs_req *copy;
+
+    if (req->has_ttl)
+    {
+        size += strlen(req->data + req->value_len + 1) + 1;
+    }
+    copy = malloc(size);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    memcpy(copy, req, size);
+
+    return copy;
+}
+/*---------------------------------------------------------------------------*/
+void skvs_exec_req(struct skvs_ctx *ctx, struct skvs_req *req)
+{
+    TRACE_PRINT();
+
+    req->msg = skvs_exec(ctx, req->cmd, req->key,
+                         req->has_value ? req->data : NULL,
+                         req->has_ttl ? req->data + req->value_len + 1
+                                      : NULL,
+                         &req->pinned, &req->len);
+    if (skvs_commit(ctx) < 0)
+    {
+        if (req->pinned)
+        {
+            hash_value_unpin(req->pinned);
+            req->pinned = NULL;
+        }
+        req->msg = g_msgs[MSG_INTERNAL_ERR];
+        req->len = strlen(req->msg);
+    }
+}
+/*---------------------------------------------------------------------------*/
+int skvs_resp_req(struct skvs_resp *resp, struct skvs_req *req)
+{
+    TRACE_PRINT();
+    const char *pinned = req->pinned;
+
+    /* the answer releases the pin from now on */
+    req->pinned = NULL;
+
+    return skvs_resp_answer(resp, req->bin, req->id, req->msg, req->len,
+                            pinned);
+}
+/*---------------------------------------------------------------------------*/
+void skvs_req_free(struct skvs_req *req)
+{
+    TRACE_PRINT();
+
+    if (req->pinned)
+    {
+        hash_value_unpin(req->pinned);
+    }
+    free(req);
+}
+/*---------------------------------------------------------------------------*/
+void skvs_resp_consume(struct skvs_resp *resp, size_t sent)
+{
+    struct iovec *iov;
+
+    resp->len -= sent;
+    while (sent > 0)
+    {
+        iov = &resp->iov[resp->head];
+        if (sent < iov->iov_len)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+            break;
+        }
+
+        sent -= iov->iov_len;
+        if (resp->pins[resp->head])
+        {
+            hash_value_unpin(resp->pins[resp->head]);
+        }
+        resp->head++;
+    }
+
+    /* skip empty iovecs so that head always has bytes to send */
+    while (resp->head < resp->cnt && resp->iov[resp->head].iov_len == 0)
+    {
+        if (resp->pins[resp->head])
+        {
+            hash_value_unpin(resp->pins[resp->head]);
+        }
+        resp->head++;
+    }
+
+    if (resp->head == resp->cnt)
+    {
+        resp->head = resp->cnt = 0;
+
+        /* nothing points into the scratch chunks anymore, keep one */
+        if (resp->chunks)
+        {
+            skvs_chunks_free(resp->chunks->next);
+            resp->chunks->next = NULL;
+            resp->chunks->used = 0;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+void skvs_resp_free(struct skvs_resp *resp)
+{
+    int i;
+
+    for (i = resp->head; i < resp->cnt; i++)
+    {
+        if (resp->pins[i])
+        {
+            hash_value_unpin(resp->pins[i]);
+        }
+    }
+    free(resp->iov);
+    free(resp->pins);
+    skvs_chunks_free(resp->chunks);
+    memset(resp, 0, sizeof(*resp));
+}
+/*---------------------------------------------------------------------------*/
+int skvs_buf_append(struct skvs_buf *buf, const char *data, size_t len)
+{
+    size_t cap;
+    char *tmp;
+
+    if (buf->len + len > buf->cap)
+    {
+        cap = buf->cap ? buf->cap : BUFFER_SIZE;
+        while (cap < buf->len + len)
+        {
+            cap *= 2;
+        }
+        tmp = realloc(buf->data, cap);
+        if (tmp == NULL)
+        {
+            return -1;
+        }
+        buf->data = tmp;
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void skvs_buf_free(struct skvs_buf *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
 }
\ No newline at end of file
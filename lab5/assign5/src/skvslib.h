@@ -8,7 +8,14 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 #include "hashtable.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "slab.h"
 #include "common.h"
 /*---------------------------------------------------------------------------*/
 /* response message indices */
@@ -21,6 +28,10 @@ enum MSG
     MSG_UPDATE_OK,
     MSG_DELETE_OK,
     MSG_INTERNAL_ERR,
+    MSG_SNAPSHOT_OK,
+    MSG_SNAPSHOT_BUSY,
+    MSG_EXPIRE_OK,
+    MSG_MSET_OK,
     MSG_COUNT
 };
 /* command indices */
@@ -32,13 +43,95 @@ enum CMD
     CMD_READ,
     CMD_UPDATE,
     CMD_DELETE,
+    CMD_SNAPSHOT,
+    CMD_STATS,
+    CMD_EXPIRE,
+    CMD_MGET,
+    CMD_MSET,
+    CMD_SCAN,
+    CMD_RANGE,
+    CMD_PREFIX,
     CMD_COUNT
 };
 /*---------------------------------------------------------------------------*/
+/* digits of a TTL in seconds, so that it stays below about 31 years */
+#define SKVS_TTL_DIGITS 9
+/* steps of the cursor a SCAN takes without a count, and at most */
+#define SKVS_SCAN_COUNT 16
+#define SKVS_SCAN_MAX 1024
+/* keys a RANGE or PREFIX answers without a limit, and at most */
+#define SKVS_RANGE_LIMIT 100
+#define SKVS_RANGE_MAX 1000
+/*---------------------------------------------------------------------------*/
+/* per-connection input buffer: a pending partial command (< BUFFER_SIZE)
+ * plus one full read always fit */
+#define SKVS_RBUF_SIZE (2 * BUFFER_SIZE)
+/*---------------------------------------------------------------------------*/
+/* growable output buffer */
+struct skvs_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+/*---------------------------------------------------------------------------*/
+/* initial number of iovecs of a response */
+#define SKVS_RESP_IOV 64
+/* size of a scratch chunk for response headers */
+#define SKVS_CHUNK_SIZE 4096
+/*---------------------------------------------------------------------------*/
+/* scratch memory for small response parts, e.g. binary headers.
+ * chunks never move, so iovecs may point into them. */
+struct skvs_chunk {
+    struct skvs_chunk *next;
+    size_t used;
+    char data[SKVS_CHUNK_SIZE];
+};
+/*---------------------------------------------------------------------------*/
+/* responses under construction as an iovec list. each iovec points at
+ * a static message, the line feed, a binary header in the scratch chunks,
+ * or a value pinned in the hash table, so nothing is copied until
+ * the kernel reads it. */
+struct skvs_resp {
+    struct iovec *iov;
+    const char **pins;  // pinned value of each iovec, or NULL
+    int head;           // first iovec not sent completely
+    int cnt;            // number of iovecs
+    int cap;
+    size_t len;         // bytes not sent yet
+    struct skvs_chunk *chunks;
+};
+/*---------------------------------------------------------------------------*/
+/* a request of a sharded server (shard.h). it is executed by the shard
+ * that owns its key, which may not be the shard of its connection, and
+ * answered on the connection in the order the requests came. */
+struct skvs_req {
+    struct skvs_req *next;  // in an inbox, or in the queue of a connection
+    void *conn;             // connection to answer
+    int from;               // shard of the connection
+    int done;               // answered, set by the shard of the connection
+    enum CMD cmd;
+    int bin;                // answered with a binary frame of id
+    uint32_t id;
+    const char *msg;        // answer of the command, see skvs_exec_req()
+    const char *pinned;
+    size_t len;
+    int has_value;
+    int has_ttl;
+    size_t value_len;
+    char key[MAX_KEY_LEN + 1];  // empty for a command without a key
+    char data[];            // value and then ttl, each null-terminated
+};
+/* bytes of the largest request skvs_parse_req() fills */
+#define SKVS_REQ_MAX (sizeof(struct skvs_req) + BUFFER_SIZE + 1)
+/*---------------------------------------------------------------------------*/
 /* SKVS context */
 struct skvs_ctx {
     int sock;
     hashtable_t *table;
+    wal_t *wal;         // NULL without a write-ahead log
+    snapshot_t *snap;   // NULL without a snapshot file
+    struct timespec started; // for the rates of STATS
+    int recovering;     // expiry is held until skvs_recovered()
 };
 /*---------------------------------------------------------------------------*/
 /**
@@ -48,6 +141,13 @@ struct skvs_ctx {
  */
 struct skvs_ctx *skvs_init(size_t hash_size, int delay);
 /*---------------------------------------------------------------------------*/
+/**
+ * same as skvs_init(), but passes all table options to hash_init_opts().
+ * returns NULL when any internal errors occur.
+ * returns the SKVS context pointer on success.
+ */
+struct skvs_ctx *skvs_init_opts(const hash_opts_t *opts);
+/*---------------------------------------------------------------------------*/
 /**
  * destroys SKVS context and the hash table.
  * when set dump, dumps the hash table before destroy it.
@@ -56,6 +156,37 @@ struct skvs_ctx *skvs_init(size_t hash_size, int delay);
  */
 int skvs_destroy(struct skvs_ctx *ctx, int dump);
 /*---------------------------------------------------------------------------*/
+/**
+ * opens the write-ahead log at path, replays it into the hash table,
+ * and logs every later write. writes are acknowledged only after
+ * wal_commit() with the given sync policy (enum WAL_SYNC).
+ * call it before serving any request.
+ * keys do not expire from here until skvs_recovered().
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int skvs_open_wal(struct skvs_ctx *ctx, const char *path,
+                  int sync, int interval_ms);
+/*---------------------------------------------------------------------------*/
+/**
+ * loads the snapshot at path into the hash table, and takes a new one
+ * on every SNAPSHOT command and every interval_s seconds when
+ * interval_s is positive. call it before skvs_open_wal().
+ * keys do not expire from here until skvs_recovered().
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int skvs_open_snapshot(struct skvs_ctx *ctx, const char *path,
+                       int interval_s);
+/*---------------------------------------------------------------------------*/
+/**
+ * lets keys expire again once the snapshot and the log are loaded, so
+ * that a key whose deadline passed during the downtime is only dropped
+ * after every later write of the log was applied to it.
+ * call it before serving any request.
+ */
+void skvs_recovered(struct skvs_ctx *ctx);
+/*---------------------------------------------------------------------------*/
 /**
  * returns the complete SKVS commands for the given request on success
  * returns NULL when the request is incomplete.
@@ -64,7 +195,97 @@ int skvs_destroy(struct skvs_ctx *ctx, int dump);
  * The return value has no line feed.
  * You should copy the return value to application buffer,
  * and add a line feed at the end.
+ * A value returned for READ is only valid until epoch_exit(),
+ * so call this between epoch_enter() and epoch_exit().
+ * MGET answers a line per key, so it is INVALID CMD here.
  */
 const char *skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen);
 /*---------------------------------------------------------------------------*/
+/**
+ * serves every complete text command in rbuf in order, and appends
+ * their responses (each with a line feed) to out. MGET appends one
+ * response per key, as READ would answer it.
+ * a command longer than BUFFER_SIZE is answered with INVALID CMD.
+ * when served is not NULL, the number of answered commands is added to it.
+ * returns the number of consumed bytes on success.
+ * the remaining bytes are an incomplete command to be kept
+ * for the next read.
+ * returns -1 when any internal errors occur.
+ */
+ssize_t skvs_serve_all(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
+                       struct skvs_buf *out, unsigned long *served);
+/*---------------------------------------------------------------------------*/
+/**
+ * same as skvs_serve_all(), but appends the responses to resp as iovecs.
+ * values returned for READ are pinned until the iovec pointing at
+ * them is consumed, so the caller can writev() resp->iov + resp->head.
+ * a command starting with BIN_MAGIC is a binary frame (see common.h),
+ * and is answered with a binary frame.
+ * returns the number of consumed bytes on success.
+ * returns -1 when any internal errors occur, or when a binary frame
+ * is malformed and the stream cannot be resynchronized.
+ */
+ssize_t skvs_serve_iov(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
+                       struct skvs_resp *resp, unsigned long *served);
+/*---------------------------------------------------------------------------*/
+/**
+ * parses the first command of buf, text or binary, into req, which has
+ * room for SKVS_REQ_MAX bytes. a sharded server only serves commands of
+ * one key and STATS, so MGET, MSET, SCAN, RANGE and PREFIX are parsed
+ * as INVALID CMD.
+ * returns the number of consumed bytes on success.
+ * returns 0 when the command is incomplete.
+ * returns -1 when a binary frame is malformed and the stream cannot be
+ * resynchronized.
+ */
+ssize_t skvs_parse_req(char *buf, size_t len, struct skvs_req *req);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns a copy of req in its own memory, released by skvs_req_free().
+ * returns NULL when any internal errors occur.
+ */
+struct skvs_req *skvs_req_dup(const struct skvs_req *req);
+/*---------------------------------------------------------------------------*/
+/**
+ * executes req on the table of ctx, and sets its answer. a value of the
+ * answer is pinned, so any thread may send it.
+ */
+void skvs_exec_req(struct skvs_ctx *ctx, struct skvs_req *req);
+/*---------------------------------------------------------------------------*/
+/**
+ * appends the answer of an executed req to resp, as skvs_serve_iov()
+ * would. the pin of the answer moves to resp.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int skvs_resp_req(struct skvs_resp *resp, struct skvs_req *req);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases req from skvs_req_dup(), and the pin of its answer, if any.
+ */
+void skvs_req_free(struct skvs_req *req);
+/*---------------------------------------------------------------------------*/
+/**
+ * marks sent bytes of resp as consumed,
+ * and releases the values they pointed at.
+ */
+void skvs_resp_consume(struct skvs_resp *resp, size_t sent);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases all pinned values and the memory of resp.
+ */
+void skvs_resp_free(struct skvs_resp *resp);
+/*---------------------------------------------------------------------------*/
+/**
+ * appends len bytes of data to buf.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int skvs_buf_append(struct skvs_buf *buf, const char *data, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases the memory of buf.
+ */
+void skvs_buf_free(struct skvs_buf *buf);
+/*---------------------------------------------------------------------------*/
 #endif // _SKVSLIB_H
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*---------------------------------------------------------------------------*/
+/* slab.c                                                                    */
+/* Size-class slab allocator with per-thread caches                          */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+/* object sizes: 8-byte steps up to 64, then four steps per power of two */
+static const uint32_t g_class_size[] = {
+    16, 24, 32, 40, 48, 56, 64,
+    80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024,
+    1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096,
+};
+#define SLAB_CLASSES (sizeof(g_class_size) / sizeof(g_class_size[0]))
+#define SLAB_MAX_SIZE 4096
+/* class of objects that get a chunk of their own */
+#define SLAB_LARGE SLAB_CLASSES
+/*---------------------------------------------------------------------------*/
+/* chunks are aligned to SLAB_CHUNK, so an object finds the header of its
+ * chunk by masking its address, and objects need no header of their own.
+ * a large object sits alone right behind the header of its chunk. */
+struct slab_chunk
+{
+    size_t cls;
+    size_t pad;             // pads the header to 16 bytes
+};
+/*---------------------------------------------------------------------------*/
+/* a free object links to the next free object of its list */
+struct slab_obj
+{
+    struct slab_obj *next;
+};
+/*---------------------------------------------------------------------------*/
+/* free objects shared by all threads, one list per class */
+struct slab_depot
+{
+    pthread_mutex_t lock;
+    struct slab_obj *free;
+};
+/*---------------------------------------------------------------------------*/
+/* per-thread cache. the counters are written by the owner only, and the
+ * record stays on g_caches after its thread exits, so that the counters
+ * keep adding up. */
+struct slab_cache
+{
+    struct slab_obj *free[SLAB_CLASSES];
+    int count[SLAB_CLASSES];
+    char *bump[SLAB_CLASSES];       // the uncarved rest of the last chunk
+    char *bump_end[SLAB_CLASSES];
+
+    unsigned long allocs, frees, mallocs, chunks, large;
+    unsigned long reserved;
+    /* class bytes handed out and taken back by this thread. objects
+     * cross threads, so only the sums over all caches mean anything. */
+    unsigned long bytes_out, bytes_in;
+
+    struct slab_cache *next;
+};
+/*---------------------------------------------------------------------------*/
+static struct slab_depot g_depot[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL},
+};
+/* class of every size up to SLAB_MAX_SIZE, in 8-byte steps */
+static uint8_t g_class_of[SLAB_MAX_SIZE / 8 + 1];
+static struct slab_cache *g_caches = NULL;
+static pthread_key_t g_key;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static __thread struct slab_cache *t_cache = NULL;
+/*---------------------------------------------------------------------------*/
+static inline void
+stat_add(unsigned long *stat, unsigned long n)
+{
+    __atomic_store_n(stat, *stat + n, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+static inline struct slab_chunk *
+chunk_of(void *ptr)
+{
+    return (struct slab_chunk *)((uintptr_t)ptr &
+                                 ~(uintptr_t)(SLAB_CHUNK - 1));
+}
+/*---------------------------------------------------------------------------*/
+/* returns a new chunk of cls with room for size bytes of objects */
+static struct slab_chunk *
+chunk_new(size_t cls, size_t size)
+{
+    void *mem;
+
+    if (posix_memalign(&mem, SLAB_CHUNK, sizeof(struct slab_chunk) + size))
+    {
+        DEBUG_PRINT("Failed to allocate slab chunk");
+        return NULL;
+    }
+    ((struct slab_chunk *)mem)->cls = cls;
+
+    return mem;
+}
+/*---------------------------------------------------------------------------*/
+/* moves up to n objects from the list *from to the list *to */
+static int
+slab_move(struct slab_obj **from, struct slab_obj **to, int n)
+{
+    struct slab_obj *obj;
+    int moved;
+
+    for (moved = 0; moved < n && *from; moved++)
+    {
+        obj = *from;
+        *from = obj->next;
+        obj->next = *to;
+        *to = obj;
+    }
+
+    return moved;
+}
+/*---------------------------------------------------------------------------*/
+/* hands the cached objects of an exiting thread to the depot */
+static void
+slab_cache_exit(void *arg)
+{
+    struct slab_cache *cache = arg;
+    size_t cls;
+
+    for (cls = 0; cls < SLAB_CLASSES; cls++)
+    {
+        pthread_mutex_lock(&g_depot[cls].lock);
+        slab_move(&cache->free[cls], &g_depot[cls].free, cache->count[cls]);
+        pthread_mutex_unlock(&g_depot[cls].lock);
+        cache->count[cls] = 0;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+slab_once(void)
+{
+    size_t i, cls = 0;
+
+    for (i = 0; i <= SLAB_MAX_SIZE / 8; i++)
+    {
+        while (g_class_size[cls] < i * 8)
+        {
+            cls++;
+        }
+        g_class_of[i] = cls;
+    }
+    pthread_key_create(&g_key, slab_cache_exit);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the cache of the calling thread, registering it on first use */
+static struct slab_cache *
+slab_cache_get(void)
+{
+    struct slab_cache *cache = t_cache;
+
+    if (cache)
+    {
+        return cache;
+    }
+
+    pthread_once(&g_once, slab_once);
+    cache = calloc(1, sizeof(struct slab_cache));
+    if (cache == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate slab cache");
+        return NULL;
+    }
+    pthread_setspecific(g_key, cache);
+
+    cache->next = __atomic_load_n(&g_caches, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_caches, &cache->next, cache, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        ;
+    }
+    t_cache = cache;
+
+    return cache;
+}
+/*---------------------------------------------------------------------------*/
+/* refills the empty list of cls from the depot, or carves new objects.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+slab_refill(struct slab_cache *cache, size_t cls)
+{
+    size_t size = g_class_size[cls];
+    struct slab_chunk *chunk;
+    struct slab_obj *obj;
+    int n;
+
+    pthread_mutex_lock(&g_depot[cls].lock);
+    n = slab_move(&g_depot[cls].free, &cache->free[cls], SLAB_BATCH);
+    pthread_mutex_unlock(&g_depot[cls].lock);
+    if (n > 0)
+    {
+        cache->count[cls] += n;
+        return 0;
+    }
+
+    if (cache->bump[cls] + size > cache->bump_end[cls])
+    {
+        chunk = chunk_new(cls, SLAB_CHUNK - sizeof(struct slab_chunk));
+        if (chunk == NULL)
+        {
+            return -1;
+        }
+        cache->bump[cls] = (char *)(chunk + 1);
+        cache->bump_end[cls] = (char *)chunk + SLAB_CHUNK;
+        stat_add(&cache->mallocs, 1);
+        stat_add(&cache->chunks, 1);
+        stat_add(&cache->reserved, SLAB_CHUNK);
+    }
+
+    for (n = 0; n < SLAB_BATCH &&
+                cache->bump[cls] + size <= cache->bump_end[cls]; n++)
+    {
+        obj = (struct slab_obj *)cache->bump[cls];
+        cache->bump[cls] += size;
+        obj->next = cache->free[cls];
+        cache->free[cls] = obj;
+    }
+    cache->count[cls] += n;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void *slab_alloc(size_t size)
+{
+    TRACE_PRINT();
+    struct slab_cache *cache = slab_cache_get();
+    struct slab_chunk *chunk;
+    struct slab_obj *obj;
+    size_t cls;
+
+    if (size > SLAB_MAX_SIZE || cache == NULL)
+    {
+        chunk = chunk_new(SLAB_LARGE, size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        if (cache)
+        {
+            stat_add(&cache->allocs, 1);
+            stat_add(&cache->mallocs, 1);
+            stat_add(&cache->large, 1);
+        }
+        return chunk + 1;
+    }
+
+    cls = g_class_of[(size + 7) / 8];
+    if (cache->free[cls] == NULL && slab_refill(cache, cls) < 0)
+    {
+        return NULL;
+    }
+    obj = cache->free[cls];
+    cache->free[cls] = obj->next;
+    cache->count[cls]--;
+
+    stat_add(&cache->allocs, 1);
+    stat_add(&cache->bytes_out, g_class_size[cls]);
+
+    return obj;
+}
+/*---------------------------------------------------------------------------*/
+void slab_free(void *ptr)
+{
+    TRACE_PRINT();
+    struct slab_obj *obj = ptr;
+    struct slab_cache *cache;
+    size_t cls;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    cls = chunk_of(ptr)->cls;
+    cache = slab_cache_get();
+    if (cache)
+    {
+        stat_add(&cache->frees, 1);
+    }
+
+    if (cls == SLAB_LARGE)
+    {
+        free(chunk_of(ptr));
+        return;
+    }
+    if (cache == NULL)
+    {
+        pthread_mutex_lock(&g_depot[cls].lock);
+        obj->next = g_depot[cls].free;
+        g_depot[cls].free = obj;
+        pthread_mutex_unlock(&g_depot[cls].lock);
+        return;
+    }
+
+    obj->next = cache->free[cls];
+    cache->free[cls] = obj;
+    stat_add(&cache->bytes_in, g_class_size[cls]);
+
+    /* keep a batch for the next allocations, share the rest */
+    if (++cache->count[cls] >= 2 * SLAB_BATCH)
+    {
+        pthread_mutex_lock(&g_depot[cls].lock);
+        slab_move(&cache->free[cls], &g_depot[cls].free, SLAB_BATCH);
+        pthread_mutex_unlock(&g_depot[cls].lock);
+        cache->count[cls] -= SLAB_BATCH;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void slab_stats(struct slab_stats *stats)
+{
+    TRACE_PRINT();
+    struct slab_cache *cache;
+    unsigned long out = 0, in = 0;
+
+    memset(stats, 0, sizeof(struct slab_stats));
+    for (cache = __atomic_load_n(&g_caches, __ATOMIC_ACQUIRE); cache;
+         cache = cache->next)
+    {
+        stats->allocs += __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&cache->frees, __ATOMIC_RELAXED);
+        stats->mallocs += __atomic_load_n(&cache->mallocs, __ATOMIC_RELAXED);
+        stats->chunks += __atomic_load_n(&cache->chunks, __ATOMIC_RELAXED);
+        stats->large += __atomic_load_n(&cache->large, __ATOMIC_RELAXED);
+        stats->reserved += __atomic_load_n(&cache->reserved,
+                                           __ATOMIC_RELAXED);
+        out += __atomic_load_n(&cache->bytes_out, __ATOMIC_RELAXED);
+        in += __atomic_load_n(&cache->bytes_in, __ATOMIC_RELAXED);
+    }
+    stats->in_use = out > in ? out - in : 0;
+}
+/*---------------------------------------------------------------------------*/
+void slab_dump(void)
+{
+    TRACE_PRINT();
+    struct slab_stats stats;
+
+    slab_stats(&stats);
+    printf("Slab: %lu allocs, %lu frees, %lu mallocs, %lu chunks, "
+           "%lu large, %zu KB reserved, %zu KB in use\n",
+           stats.allocs, stats.frees, stats.mallocs, stats.chunks,
+           stats.large, stats.reserved >> 10, stats.in_use >> 10);
+}
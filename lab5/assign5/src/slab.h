@@ -0,0 +1,54 @@
+/*---------------------------------------------------------------------------*/
+/* slab.h                                                                    */
+/* Size-class slab allocator with per-thread caches                          */
+/*---------------------------------------------------------------------------*/
+#ifndef _SLAB_H
+#define _SLAB_H
+/*---------------------------------------------------------------------------*/
+#include <stddef.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* memory taken at once and carved into objects of a class. chunks are
+ * aligned to their size, so a power of two. */
+#define SLAB_CHUNK (64 * 1024)
+/* objects moved between a thread cache and the shared depot at once */
+#define SLAB_BATCH 32
+/*---------------------------------------------------------------------------*/
+/* allocator counters, all since the start of the process */
+struct slab_stats
+{
+    unsigned long allocs;       // slab_alloc() calls
+    unsigned long frees;        // slab_free() calls
+    unsigned long mallocs;      // allocations from the system for them
+    unsigned long chunks;       // chunks carved so far
+    unsigned long large;        // objects too big for any class
+    size_t reserved;            // bytes of all chunks
+    size_t in_use;              // bytes of live objects of the classes
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates size bytes, aligned to 8 bytes, from the smallest size class
+ * that fits. objects carry no header. a thread takes objects from its
+ * own cache and only touches shared state once per SLAB_BATCH objects.
+ * an object larger than every class gets a chunk of its own.
+ * returns NULL when any internal errors occur.
+ */
+void *slab_alloc(size_t size);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees an object of slab_alloc(). any thread may free it; the object
+ * goes to the cache of the freeing thread. NULL is ignored.
+ */
+void slab_free(void *ptr);
+/*---------------------------------------------------------------------------*/
+/**
+ * fills stats with the counters of the allocator.
+ */
+void slab_stats(struct slab_stats *stats);
+/*---------------------------------------------------------------------------*/
+/**
+ * prints the counters of the allocator.
+ */
+void slab_dump(void);
+/*---------------------------------------------------------------------------*/
+#endif // _SLAB_H
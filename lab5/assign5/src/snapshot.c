@@ -0,0 +1,673 @@
+/*---------------------------------------------------------------------------*/
+/* snapshot.c                                                                */
+/* Point-in-time snapshots of the table by a forked child                    */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "snapshot.h"
+/*---------------------------------------------------------------------------*/
+/* a snapshot file is an image of the table: this header, a directory of
+ * (1 << dir_bits) + 1 offsets, and the records, grouped by the low
+ * dir_bits bits of the hash of their key under seed. bucket d holds the
+ * records from dir[d] to dir[d + 1], counted from the first record.
+ * a record is the key length (2 bytes), the value length (4 bytes) and
+ * the deadline of the key (8 bytes, 0 for none), then the key and the
+ * value without their NULs, all unpadded in host byte order. */
+struct snap_hdr
+{
+    char magic[8];          // SNAPSHOT_MAGIC
+    uint64_t count;         // records
+    uint64_t bytes;         // bytes of all records
+    uint64_t seed;          // hash64() seed the buckets were made with
+    uint32_t dir_bits;
+    uint32_t pad;
+};
+#define SNAP_REC_HDR (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint64_t))
+/*---------------------------------------------------------------------------*/
+/* what the child reports to the snapshot thread through a pipe */
+struct snap_result
+{
+    uint64_t count;
+    uint64_t bytes;
+    long write_us;          // from fork() to the renamed, synced file
+    long cow_kb;            // pages that stopped being shared meanwhile
+};
+/*---------------------------------------------------------------------------*/
+/* state of the child while it lays out the image */
+struct snap_writer
+{
+    uint64_t seed;
+    uint64_t mask;          // (1 << dir_bits) - 1
+    uint64_t *dir;          // bucket sizes, then offsets
+    char *recs;             // first record in the mapped file
+    uint64_t count;
+};
+/*---------------------------------------------------------------------------*/
+/* one thread building a loaded image into the table */
+struct snap_builder
+{
+    hashtable_t *table;
+    const struct snap_hdr *hdr;
+    const uint64_t *dir;
+    const char *recs;
+    int idx;                // this thread takes the parts with part % num
+    int num;
+    pthread_t thread;
+    uint64_t count;
+    int ret;
+};
+/*---------------------------------------------------------------------------*/
+struct snapshot
+{
+    hashtable_t *table;
+    char *path;
+    int interval_s;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // wakes the snapshot thread
+    pthread_cond_t forked;      // the snapshot thread forked, or failed to
+    int requested;
+    int busy;                   // a child is writing
+    unsigned long forks;        // fork attempts so far
+    int fork_ret;               // result of the last one
+    int stop;
+    pthread_t thread;
+
+    unsigned long taken, failed;
+};
+/*---------------------------------------------------------------------------*/
+static long
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* returns the private dirty memory of the calling process in KB,
+ * or 0 when the kernel does not tell. */
+static long
+private_dirty_kb(void)
+{
+    char buf[4096], *p;
+    ssize_t n;
+    int fd;
+
+    fd = open("/proc/self/smaps_rollup", O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    buf[n] = '\0';
+    p = strstr(buf, "Private_Dirty:");
+
+    return p ? strtol(p + strlen("Private_Dirty:"), NULL, 10) : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* adds the record of one entry to the size of its bucket. a hash_visit_t. */
+static int
+snapshot_count(void *arg, const char *key, size_t key_len,
+               const char *value, size_t value_len)
+{
+    struct snap_writer *w = arg;
+    uint64_t d = hash64(key, key_len, w->seed) & w->mask;
+
+    w->dir[d + 1] += SNAP_REC_HDR + key_len + value_len;
+    w->count++;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* copies the record of one entry to the next free place of its bucket.
+ * a hash_visit_t. */
+static int
+snapshot_put(void *arg, const char *key, size_t key_len,
+             const char *value, size_t value_len)
+{
+    struct snap_writer *w = arg;
+    uint64_t d = hash64(key, key_len, w->seed) & w->mask;
+    char *rec = w->recs + w->dir[d];
+    uint16_t klen = key_len;
+    uint32_t vlen = value_len;
+    uint64_t expires = hash_value_expires(value);
+
+    memcpy(rec, &klen, sizeof(klen));
+    memcpy(rec + sizeof(klen), &vlen, sizeof(vlen));
+    memcpy(rec + sizeof(klen) + sizeof(vlen), &expires, sizeof(expires));
+    memcpy(rec + SNAP_REC_HDR, key, key_len);
+    memcpy(rec + SNAP_REC_HDR + key_len, value, value_len);
+    w->dir[d] += SNAP_REC_HDR + key_len + value_len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* writes the table the child inherited as an image to a temporary file
+ * and renames it over path. it runs in the forked child, where no other
+ * thread exists and every lock of the table is held, so it takes no
+ * lock and maps its memory instead of calling malloc(). it never
+ * returns. */
+static void
+snapshot_child(hashtable_t *table, const char *path, int out)
+{
+    char tmp[PATH_MAX], *map;
+    struct snap_writer w = {.seed = table->seed};
+    struct snap_result res = {0};
+    struct snap_hdr hdr = {0};
+    long start = now_us(), cow = private_dirty_kb();
+    size_t buckets, dir_size, size, d;
+    int bits, fd;
+
+    for (bits = SNAPSHOT_DIR_MIN_BITS;
+         bits < SNAPSHOT_DIR_MAX_BITS && (1UL << bits) < table->total_entries;
+         bits++)
+    {
+        ;
+    }
+    buckets = 1UL << bits;
+    dir_size = (buckets + 1) * sizeof(uint64_t);
+    w.mask = buckets - 1;
+    w.dir = mmap(NULL, dir_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (w.dir == MAP_FAILED)
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    /* size the buckets, then place every record in its bucket */
+    hash_foreach(table, snapshot_count, &w);
+    for (d = 1; d <= buckets; d++)
+    {
+        w.dir[d] += w.dir[d - 1];
+    }
+    size = sizeof(hdr) + dir_size + w.dir[buckets];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0)
+    {
+        _exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        _exit(EXIT_FAILURE);
+    }
+    w.recs = map + sizeof(hdr) + dir_size;
+    hash_foreach(table, snapshot_put, &w);
+
+    /* each offset moved to the end of its bucket, the start of the next */
+    memmove(w.dir + 1, w.dir, buckets * sizeof(uint64_t));
+    w.dir[0] = 0;
+    memcpy(map + sizeof(hdr), w.dir, dir_size);
+
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.count = w.count;
+    hdr.bytes = w.dir[buckets];
+    hdr.seed = w.seed;
+    hdr.dir_bits = bits;
+    memcpy(map, &hdr, sizeof(hdr));
+
+    if (msync(map, size, MS_SYNC) < 0 || munmap(map, size) < 0 ||
+        close(fd) < 0 || rename(tmp, path) < 0)
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    res.count = w.count;
+    res.bytes = size;
+    res.write_us = now_us() - start;
+    res.cow_kb = private_dirty_kb() - cow;
+    if (write_all(out, (const char *)&res, sizeof(res)) < 0)
+    {
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+/*---------------------------------------------------------------------------*/
+/* tells the requesters that the point in time of the snapshot has passed */
+static void
+snapshot_forked(snapshot_t *snap, int ret)
+{
+    pthread_mutex_lock(&snap->lock);
+    snap->forks++;
+    snap->fork_ret = ret;
+    pthread_cond_broadcast(&snap->forked);
+    pthread_mutex_unlock(&snap->lock);
+}
+/*---------------------------------------------------------------------------*/
+/* takes one snapshot and waits for it.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+snapshot_take(snapshot_t *snap)
+{
+    struct snap_result res;
+    long start, pause_us;
+    int pipefd[2], status;
+    ssize_t n;
+    pid_t pid;
+
+    if (pipe(pipefd) < 0)
+    {
+        perror("Failed to create a pipe for the snapshot");
+        snapshot_forked(snap, -1);
+        return -1;
+    }
+
+    /* the child must not print what the parent has buffered */
+    fflush(stdout);
+    fflush(stderr);
+
+    /* no write is half done in the copy the child gets */
+    start = now_us();
+    hash_lock_all(snap->table);
+    pid = fork();
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+        snapshot_child(snap->table, snap->path, pipefd[1]);
+    }
+    hash_unlock_all(snap->table);
+    pause_us = now_us() - start;
+    snapshot_forked(snap, pid < 0 ? -1 : 0);
+
+    close(pipefd[1]);
+    if (pid < 0)
+    {
+        perror("Failed to fork for the snapshot");
+        close(pipefd[0]);
+        return -1;
+    }
+
+    do
+    {
+        n = read(pipefd[0], &res, sizeof(res));
+    } while (n < 0 && errno == EINTR);
+    close(pipefd[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+        ;
+    }
+    if (n != sizeof(res) || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Snapshot: failed to write %s\n", snap->path);
+        return -1;
+    }
+
+    printf("Snapshot: %lu entries, %lu KB in %ld ms (%ld MB/s), "
+           "writers paused %ld us, %ld KB copied on write\n",
+           (unsigned long)res.count, (unsigned long)(res.bytes >> 10),
+           res.write_us / 1000,
+           res.write_us ? (long)(res.bytes / res.write_us) : 0,
+           pause_us, res.cow_kb);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* takes a snapshot when asked to, or every interval_s seconds */
+static void *
+snapshot_main(void *arg)
+{
+    snapshot_t *snap = arg;
+    struct timespec deadline;
+    int ret;
+
+    pthread_mutex_lock(&snap->lock);
+    while (1)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += snap->interval_s;
+        while (!snap->stop && !snap->requested)
+        {
+            if (snap->interval_s <= 0)
+            {
+                pthread_cond_wait(&snap->cond, &snap->lock);
+            }
+            else if (pthread_cond_timedwait(&snap->cond, &snap->lock,
+                                            &deadline) == ETIMEDOUT)
+            {
+                snap->requested = 1;
+            }
+        }
+        if (snap->stop)
+        {
+            break;
+        }
+
+        snap->requested = 0;
+        snap->busy = 1;
+        pthread_mutex_unlock(&snap->lock);
+
+        ret = snapshot_take(snap);
+
+        pthread_mutex_lock(&snap->lock);
+        snap->busy = 0;
+        if (ret < 0)
+        {
+            snap->failed++;
+        }
+        else
+        {
+            snap->taken++;
+        }
+    }
+    pthread_mutex_unlock(&snap->lock);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* inserts the records of the buckets whose part belongs to this thread.
+ * no other thread inserts into those parts, so no lock is taken. */
+static void *
+snapshot_build(void *arg)
+{
+    struct snap_builder *b = arg;
+    uint64_t buckets = 1UL << b->hdr->dir_bits, d, h;
+    const char *rec, *end;
+    uint16_t klen;
+    uint32_t vlen;
+    uint64_t expires;
+
+    for (d = 0; d < buckets; d++)
+    {
+        if (b->num > 1 && hash_part_of(b->table, d) % b->num != b->idx)
+        {
+            continue;
+        }
+        rec = b->recs + b->dir[d];
+        end = b->recs + b->dir[d + 1];
+        while (rec < end)
+        {
+            if (end - rec < SNAP_REC_HDR)
+            {
+                goto err_corrupt;
+            }
+            memcpy(&klen, rec, sizeof(klen));
+            memcpy(&vlen, rec + sizeof(klen), sizeof(vlen));
+            memcpy(&expires, rec + sizeof(klen) + sizeof(vlen),
+                   sizeof(expires));
+            if (klen == 0 || klen > MAX_KEY_LEN || vlen >= BUFFER_SIZE ||
+                end - rec < SNAP_REC_HDR + klen + vlen)
+            {
+                goto err_corrupt;
+            }
+            /* a record in a wrong bucket could land in another's part */
+            h = hash64(rec + SNAP_REC_HDR, klen, b->hdr->seed);
+            if ((h & (buckets - 1)) != d)
+            {
+                goto err_corrupt;
+            }
+            if (hash_bulk_insert(b->table, h, rec + SNAP_REC_HDR, klen,
+                                 rec + SNAP_REC_HDR + klen, vlen,
+                                 expires) < 0)
+            {
+                b->ret = -1;
+                break;
+            }
+            b->count++;
+            rec += SNAP_REC_HDR + klen + vlen;
+        }
+        if (b->ret < 0)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+
+err_corrupt:
+    b->ret = -1;
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+long snapshot_load(hashtable_t *table, const char *path)
+{
+    TRACE_PRINT();
+    struct snap_builder builders[SNAPSHOT_LOAD_THREADS];
+    const struct snap_hdr *hdr;
+    const uint64_t *dir;
+    uint64_t buckets = 0, count = 0, d;
+    long start = now_us(), ncpu;
+    struct stat st;
+    char *map;
+    int fd, num, i, ret = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        perror("Failed to open the snapshot");
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct snap_hdr))
+    {
+        close(fd);
+        goto err_corrupt_unmapped;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("Failed to map the snapshot");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    /* check the layout before any thread trusts it */
+    hdr = (const struct snap_hdr *)map;
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->dir_bits > SNAPSHOT_DIR_MAX_BITS)
+    {
+        goto err_corrupt;
+    }
+    buckets = 1UL << hdr->dir_bits;
+    dir = (const uint64_t *)(map + sizeof(*hdr));
+    if ((uint64_t)st.st_size < sizeof(*hdr) + (buckets + 1) * sizeof(*dir) ||
+        (uint64_t)st.st_size != sizeof(*hdr) + (buckets + 1) * sizeof(*dir) +
+                                    hdr->bytes ||
+        dir[0] != 0 || dir[buckets] != hdr->bytes)
+    {
+        goto err_corrupt;
+    }
+    for (d = 0; d < buckets; d++)
+    {
+        if (dir[d] > dir[d + 1])
+        {
+            goto err_corrupt;
+        }
+    }
+
+    if (hash_bulk_begin(table, hdr->count, hdr->seed) < 0)
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    /* threads split the parts of the table, which works as long as the
+     * buckets of the image are no coarser than the parts */
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    num = ncpu < 1 ? 1 : ncpu > SNAPSHOT_LOAD_THREADS ? SNAPSHOT_LOAD_THREADS
+                                                       : ncpu;
+    if ((int)hdr->dir_bits < hash_part_bits(table))
+    {
+        num = 1;
+    }
+    for (i = 0; i < num; i++)
+    {
+        builders[i] = (struct snap_builder){
+            .table = table,
+            .hdr = hdr,
+            .dir = dir,
+            .recs = (const char *)(dir + buckets + 1),
+            .idx = i,
+            .num = num,
+        };
+        if (i > 0 && pthread_create(&builders[i].thread, NULL,
+                                    snapshot_build, &builders[i]) != 0)
+        {
+            /* build the rest on the threads already running */
+            num = i;
+            break;
+        }
+    }
+    for (i = 0; i < num; i++)
+    {
+        builders[i].num = num;
+    }
+    snapshot_build(&builders[0]);
+    for (i = 0; i < num; i++)
+    {
+        if (i > 0)
+        {
+            pthread_join(builders[i].thread, NULL);
+        }
+        count += builders[i].count;
+        ret |= builders[i].ret;
+    }
+    hash_bulk_end(table, count);
+    if (ret < 0 || count != hdr->count)
+    {
+        goto err_corrupt;
+    }
+
+    munmap(map, st.st_size);
+    printf("Snapshot: built %lu entries from %s in %ld ms with %d threads\n",
+           (unsigned long)count, path, (now_us() - start) / 1000, num);
+    return count;
+
+err_corrupt:
+    munmap(map, st.st_size);
+err_corrupt_unmapped:
+    fprintf(stderr, "Snapshot: %s is corrupt\n", path);
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+snapshot_t *snapshot_open(hashtable_t *table, const char *path,
+                          int interval_s)
+{
+    TRACE_PRINT();
+    snapshot_t *snap = calloc(1, sizeof(snapshot_t));
+
+    if (snap == NULL)
+    {
+        return NULL;
+    }
+    snap->table = table;
+    snap->interval_s = interval_s;
+    snap->path = strdup(path);
+    if (snap->path == NULL)
+    {
+        free(snap);
+        return NULL;
+    }
+    pthread_mutex_init(&snap->lock, NULL);
+    pthread_cond_init(&snap->cond, NULL);
+    pthread_cond_init(&snap->forked, NULL);
+
+    if (pthread_create(&snap->thread, NULL, snapshot_main, snap) != 0)
+    {
+        DEBUG_PRINT("Failed to start the snapshot thread");
+        pthread_cond_destroy(&snap->forked);
+        pthread_cond_destroy(&snap->cond);
+        pthread_mutex_destroy(&snap->lock);
+        free(snap->path);
+        free(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+/*---------------------------------------------------------------------------*/
+int snapshot_request(snapshot_t *snap)
+{
+    TRACE_PRINT();
+    unsigned long target;
+    int ret;
+
+    pthread_mutex_lock(&snap->lock);
+    if (snap->busy)
+    {
+        pthread_mutex_unlock(&snap->lock);
+        return 0;
+    }
+
+    /* join a request the thread has not picked up yet */
+    snap->requested = 1;
+    target = snap->forks + 1;
+    pthread_cond_signal(&snap->cond);
+    while (snap->forks < target && !snap->stop)
+    {
+        pthread_cond_wait(&snap->forked, &snap->lock);
+    }
+    ret = snap->forks >= target && snap->fork_ret == 0 ? 1 : -1;
+    pthread_mutex_unlock(&snap->lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+void snapshot_close(snapshot_t *snap)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&snap->lock);
+    snap->stop = 1;
+    pthread_cond_signal(&snap->cond);
+    pthread_cond_broadcast(&snap->forked);
+    pthread_mutex_unlock(&snap->lock);
+    pthread_join(snap->thread, NULL);
+
+    printf("Snapshot: %lu taken, %lu failed\n", snap->taken, snap->failed);
+
+    pthread_cond_destroy(&snap->forked);
+    pthread_cond_destroy(&snap->cond);
+    pthread_mutex_destroy(&snap->lock);
+    free(snap->path);
+    free(snap);
+}
@@ -0,0 +1,57 @@
+/*---------------------------------------------------------------------------*/
+/* snapshot.h                                                                */
+/* Point-in-time snapshots of the table by a forked child                    */
+/*---------------------------------------------------------------------------*/
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+/*---------------------------------------------------------------------------*/
+#include "hashtable.h"
+/*---------------------------------------------------------------------------*/
+/* first bytes of a snapshot file */
+#define SNAPSHOT_MAGIC "SKVSIMG2"
+/* the image has 1 << bits buckets, about one per entry, within these */
+#define SNAPSHOT_DIR_MIN_BITS 8
+#define SNAPSHOT_DIR_MAX_BITS 20
+/* most threads building a loaded image */
+#define SNAPSHOT_LOAD_THREADS 16
+/*---------------------------------------------------------------------------*/
+typedef struct snapshot snapshot_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * loads the snapshot at path into the empty table. a missing file is an
+ * empty snapshot. the file is mapped, and up to SNAPSHOT_LOAD_THREADS
+ * threads build the table from it without locks, each taking the
+ * buckets of the image that fall into its own parts of the table
+ * (hash_part_of()). the table adopts the hash seed of the image.
+ * call it before any other thread uses the table.
+ * returns -1 when any internal errors occur, e.g. a corrupt file.
+ * returns the number of loaded entries on success.
+ */
+long snapshot_load(hashtable_t *table, const char *path);
+/*---------------------------------------------------------------------------*/
+/**
+ * starts a thread that snapshots table to path on snapshot_request(),
+ * and every interval_s seconds when interval_s is positive.
+ * returns NULL when any internal errors occur.
+ */
+snapshot_t *snapshot_open(hashtable_t *table, const char *path,
+                          int interval_s);
+/*---------------------------------------------------------------------------*/
+/**
+ * asks for a snapshot and waits until the snapshot thread forked, not
+ * until the file is written. the thread stops the writers just long
+ * enough to fork(), and the child writes the table it inherited while
+ * the server keeps serving. so the snapshot holds every write finished
+ * before the call, and none that starts after it returns.
+ * returns -1 when any internal errors occur.
+ * returns 0 when the file of an earlier snapshot is still being written.
+ * returns 1 on success.
+ */
+int snapshot_request(snapshot_t *snap);
+/*---------------------------------------------------------------------------*/
+/**
+ * waits for a running snapshot, stops the thread and frees snap.
+ */
+void snapshot_close(snapshot_t *snap);
+/*---------------------------------------------------------------------------*/
+#endif // _SNAPSHOT_H
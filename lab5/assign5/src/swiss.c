@@ -0,0 +1,1136 @@
+/*---------------------------------------------------------------------------*/
+/* swiss.c                                                                   */
+/* Open addressing table engine with inline keys and SIMD probing            */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "swiss.h"
+/*---------------------------------------------------------------------------*/
+/* control bytes of free slots; a taken slot holds 7 bits of its hash */
+#define SWISS_EMPTY ((int8_t)0x80)
+#define SWISS_DELETED ((int8_t)0xFE)
+/*---------------------------------------------------------------------------*/
+/* a key is stored zero-padded, so equal keys compare equal as a whole */
+struct swiss_slot
+{
+    char key[MAX_KEY_LEN];
+    char *value;
+};
+/*---------------------------------------------------------------------------*/
+struct swiss_tab
+{
+    size_t num_groups;          // power of two
+    int8_t *ctrl;               // one control byte per slot
+    uint8_t *refs;              // reference bit of each slot, see hash_evict()
+    struct swiss_slot *slots;
+};
+/*---------------------------------------------------------------------------*/
+/* one shard, guarded by the table lock of the same index.
+ * a shard has a cache line of its own. */
+struct swiss_shard
+{
+    unsigned long seq;          // odd while a slot is being filled
+    struct swiss_tab *tab;
+    size_t used;                // live entries
+    size_t deleted;             // tombstones
+} __attribute__((aligned(64)));
+/*---------------------------------------------------------------------------*/
+struct swiss
+{
+    struct swiss_shard *shards;
+    size_t num_shards;
+    size_t hand_shard;          // shard and slot of the clock hand
+    size_t hand_slot;
+};
+/*---------------------------------------------------------------------------*/
+/* bitmask of the slots in the group whose control byte is b */
+static inline unsigned
+swiss_match(const int8_t *ctrl, int8_t b)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+#else
+    unsigned bits = 0;
+    int i;
+
+    for (i = 0; i < SWISS_GROUP; i++)
+    {
+        if (ctrl[i] == b)
+        {
+            bits |= 1u << i;
+        }
+    }
+
+    return bits;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/* bitmask of the empty or deleted slots in the group (high bit set) */
+static inline unsigned
+swiss_match_free(const int8_t *ctrl)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+    unsigned bits = 0;
+    int i;
+
+    for (i = 0; i < SWISS_GROUP; i++)
+    {
+        if (ctrl[i] < 0)
+        {
+            bits |= 1u << i;
+        }
+    }
+
+    return bits;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/* copies key into k, zero-padded.
+ * returns -1 when the key is too long to be stored inline.
+ * returns the length of the key on success. */
+static long
+swiss_key(char *k, const char *key)
+{
+    size_t len = strnlen(key, MAX_KEY_LEN + 1);
+
+    if (len > MAX_KEY_LEN)
+    {
+        return -1;
+    }
+    memcpy(k, key, len);
+    memset(k + len, 0, MAX_KEY_LEN - len);
+
+    return len;
+}
+/*---------------------------------------------------------------------------*/
+/* hashes a key of len bytes like the chaining engine does. the low 7 bits
+ * go to the control byte, the next ones pick the shard, and the high half
+ * picks the group. */
+static inline uint64_t
+swiss_hash(hashtable_t *table, const char *k, size_t len)
+{
+    return hash64(k, len, table->seed);
+}
+/*---------------------------------------------------------------------------*/
+static inline int8_t
+swiss_h2(uint64_t h)
+{
+    return h & ((1 << SWISS_H2_BITS) - 1);
+}
+/*---------------------------------------------------------------------------*/
+static struct swiss_tab *
+swiss_tab_new(size_t num_groups)
+{
+    struct swiss_tab *tab = malloc(sizeof(struct swiss_tab));
+    void *ctrl;
+
+    if (tab == NULL)
+    {
+        return NULL;
+    }
+    tab->num_groups = num_groups;
+    tab->slots = malloc(num_groups * SWISS_GROUP * sizeof(struct swiss_slot));
+    tab->refs = calloc(num_groups * SWISS_GROUP, 1);
+    if (tab->slots == NULL || tab->refs == NULL ||
+        posix_memalign(&ctrl, SWISS_GROUP, num_groups * SWISS_GROUP) != 0)
+    {
+        free(tab->slots);
+        free(tab->refs);
+        free(tab);
+        return NULL;
+    }
+    tab->ctrl = ctrl;
+    memset(tab->ctrl, SWISS_EMPTY, num_groups * SWISS_GROUP);
+
+    return tab;
+}
+/*---------------------------------------------------------------------------*/
+/* frees a table, not the values in it */
+static void
+swiss_tab_retired(void *ptr)
+{
+    struct swiss_tab *tab = ptr;
+
+    free(tab->ctrl);
+    free(tab->refs);
+    free(tab->slots);
+    free(tab);
+}
+/*---------------------------------------------------------------------------*/
+/* drops the reference of the table once readers are done with the value */
+static void
+swiss_value_retired(void *value)
+{
+    hash_value_unpin(value);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the slot holding k, or -1. probes a group at a time,
+ * and stops at the first group that has an empty slot. */
+static long
+swiss_find(const struct swiss_tab *tab, uint64_t h, const char *k)
+{
+    size_t mask = tab->num_groups - 1, g = (h >> 32) & mask, probe, i;
+    const int8_t *ctrl;
+    unsigned bits;
+
+    for (probe = 0; probe < tab->num_groups; probe++)
+    {
+        ctrl = tab->ctrl + g * SWISS_GROUP;
+        bits = swiss_match(ctrl, swiss_h2(h));
+        while (bits)
+        {
+            i = g * SWISS_GROUP + __builtin_ctz(bits);
+            if (memcmp(tab->slots[i].key, k, MAX_KEY_LEN) == 0)
+            {
+                return i;
+            }
+            bits &= bits - 1;
+        }
+        if (swiss_match(ctrl, SWISS_EMPTY))
+        {
+            return -1;
+        }
+        /* triangular steps visit every group of a power-of-two table */
+        g = (g + probe + 1) & mask;
+    }
+
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+/* returns the first empty or deleted slot on the probe sequence of h.
+ * the load limit guarantees there is one. */
+static size_t
+swiss_find_free(const struct swiss_tab *tab, uint64_t h)
+{
+    size_t mask = tab->num_groups - 1, g = (h >> 32) & mask, probe;
+    unsigned bits;
+
+    for (probe = 0; ; probe++)
+    {
+        bits = swiss_match_free(tab->ctrl + g * SWISS_GROUP);
+        if (bits)
+        {
+            return g * SWISS_GROUP + __builtin_ctz(bits);
+        }
+        g = (g + probe + 1) & mask;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* fills slot i; the control byte is published last */
+static void
+swiss_put(struct swiss_tab *tab, size_t i, uint64_t h,
+          const char *k, char *value)
+{
+    memcpy(tab->slots[i].key, k, MAX_KEY_LEN);
+    tab->slots[i].value = value;
+    __atomic_store_n(&tab->ctrl[i], swiss_h2(h), __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------------*/
+/* empties slot i of a shard and returns its value, to be retired by the
+ * caller. the caller holds the shard lock. */
+static char *
+swiss_remove(struct swiss_shard *shard, struct swiss_tab *tab, size_t i)
+{
+    /* a probe never went past a group that still has an empty slot,
+     * so the slot can become empty again; otherwise leave a tombstone */
+    if (swiss_match(tab->ctrl + (i / SWISS_GROUP) * SWISS_GROUP, SWISS_EMPTY))
+    {
+        __atomic_store_n(&tab->ctrl[i], SWISS_EMPTY, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_store_n(&tab->ctrl[i], SWISS_DELETED, __ATOMIC_RELEASE);
+        shard->deleted++;
+    }
+    shard->used--;
+
+    return tab->slots[i].value;
+}
+/*---------------------------------------------------------------------------*/
+/* drops slot i, whose deadline passed, from a shard. the caller holds the
+ * shard lock. */
+static void
+swiss_expire_slot(hashtable_t *table, struct swiss_shard *shard,
+                  struct swiss_tab *tab, size_t i)
+{
+    char key[MAX_KEY_LEN + 1], *old;
+
+    memcpy(key, tab->slots[i].key, MAX_KEY_LEN);
+    key[MAX_KEY_LEN] = '\0';
+    old = swiss_remove(shard, tab, i);
+    hash_expired(table, key,
+                 hash_entry_bytes(table, strlen(key), hash_value_len(old)));
+    epoch_retire(old, swiss_value_retired);
+}
+/*---------------------------------------------------------------------------*/
+/* moves the entries of a shard to a table of num_groups groups, dropping
+ * the tombstones. readers keep using the old table until it is retired.
+ * the caller holds the shard lock.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+swiss_rehash(hashtable_t *table, struct swiss_shard *shard,
+             size_t num_groups)
+{
+    struct swiss_tab *old = shard->tab, *tab = swiss_tab_new(num_groups);
+    size_t i, j;
+    uint64_t h;
+
+    if (tab == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for a grown shard");
+        return -1;
+    }
+
+    for (i = 0; i < old->num_groups * SWISS_GROUP; i++)
+    {
+        if (old->ctrl[i] < 0)
+        {
+            continue;
+        }
+        h = swiss_hash(table, old->slots[i].key,
+                       strnlen(old->slots[i].key, MAX_KEY_LEN));
+        j = swiss_find_free(tab, h);
+        swiss_put(tab, j, h, old->slots[i].key, old->slots[i].value);
+        tab->refs[j] = old->refs[i];
+    }
+
+    __atomic_store_n(&shard->tab, tab, __ATOMIC_RELEASE);
+    shard->deleted = 0;
+    epoch_retire(old, swiss_tab_retired);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* finds k without a lock and returns its value, or NULL.
+ * a slot may be refilled under the reader, so the result is only taken
+ * when the shard sequence did not change. the caller is in a read section,
+ * which keeps the table and the value alive. */
+static char *
+swiss_lookup(hashtable_t *table, struct swiss_shard *shard, uint64_t h,
+             const char *k)
+{
+    struct swiss_tab *tab;
+    unsigned long seq;
+    char *value;
+    long i;
+
+    while (1)
+    {
+        seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+
+        tab = __atomic_load_n(&shard->tab, __ATOMIC_ACQUIRE);
+        i = swiss_find(tab, h, k);
+        value = i < 0 ? NULL :
+                __atomic_load_n(&tab->slots[i].value, __ATOMIC_ACQUIRE);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq)
+        {
+            if (value && hash_value_expired(table, value))
+            {
+                return NULL;
+            }
+            if (value)
+            {
+                hash_touch(table, &tab->refs[i]);
+            }
+            return value;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+static inline size_t
+swiss_shard_of(struct swiss *sw, uint64_t h)
+{
+    return (h >> SWISS_H2_BITS) & (sw->num_shards - 1);
+}
+/*---------------------------------------------------------------------------*/
+int swiss_init(hashtable_t *table, size_t num_shards)
+{
+    TRACE_PRINT();
+    struct swiss *sw = malloc(sizeof(struct swiss));
+    void *shards;
+    size_t i, j;
+
+    if (sw == NULL)
+    {
+        return -1;
+    }
+    if (posix_memalign(&shards, 64,
+                       num_shards * sizeof(struct swiss_shard)) != 0)
+    {
+        free(sw);
+        return -1;
+    }
+    sw->shards = shards;
+    sw->num_shards = num_shards;
+    sw->hand_shard = sw->hand_slot = 0;
+    memset(sw->shards, 0, num_shards * sizeof(struct swiss_shard));
+
+    for (i = 0; i < num_shards; i++)
+    {
+        sw->shards[i].tab = swiss_tab_new(SWISS_INIT_SLOTS / SWISS_GROUP);
+        if (sw->shards[i].tab == NULL)
+        {
+            for (j = 0; j < i; j++)
+            {
+                swiss_tab_retired(sw->shards[j].tab);
+            }
+            free(sw->shards);
+            free(sw);
+            return -1;
+        }
+    }
+    table->swiss = sw;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void swiss_destroy(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    size_t i, j;
+
+    for (i = 0; i < sw->num_shards; i++)
+    {
+        tab = sw->shards[i].tab;
+        for (j = 0; j < tab->num_groups * SWISS_GROUP; j++)
+        {
+            if (tab->ctrl[j] >= 0)
+            {
+                hash_value_unpin(tab->slots[j].value);
+            }
+        }
+        swiss_tab_retired(tab);
+    }
+
+    free(sw->shards);
+    free(sw);
+    table->swiss = NULL;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_insert(hashtable_t *table, const char *key, const char *value,
+                 uint64_t expires)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char k[MAX_KEY_LEN], *v;
+    size_t idx, i, slots;
+    unsigned long seq;
+    uint64_t h;
+    long len, j;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        DEBUG_PRINT("Key too long to store inline");
+        return -1;
+    }
+    h = swiss_hash(table, k, len);
+    idx = swiss_shard_of(sw, h);
+    shard = &sw->shards[idx];
+    lock = &table->locks[idx].lock;
+
+    rwlock_write_lock(lock);
+
+    tab = shard->tab;
+    j = swiss_find(tab, h, k);
+    if (j >= 0 && !hash_value_expired(table, tab->slots[j].value))
+    {
+        rwlock_write_unlock(lock);
+        return 0;
+    }
+    if (j >= 0)
+    {
+        /* the key is gone already, drop it and insert it again */
+        swiss_expire_slot(table, shard, tab, j);
+    }
+
+    slots = tab->num_groups * SWISS_GROUP;
+    if ((shard->used + shard->deleted + 1) * 8 > slots * SWISS_MAX_LOAD)
+    {
+        /* grow, unless dropping the tombstones frees enough */
+        if (swiss_rehash(table, shard,
+                         (shard->used + 1) * 16 > slots * SWISS_MAX_LOAD
+                             ? tab->num_groups * 2
+                             : tab->num_groups) < 0)
+        {
+            rwlock_write_unlock(lock);
+            return -1;
+        }
+        tab = shard->tab;
+    }
+
+    v = hash_value_new(value, strlen(value));
+    if (v == NULL)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+
+    i = swiss_find_free(tab, h);
+    if (tab->ctrl[i] == SWISS_DELETED)
+    {
+        shard->deleted--;
+    }
+
+    /* a reader comparing the old key of a reused slot retries */
+    seq = shard->seq;
+    __atomic_store_n(&shard->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    swiss_put(tab, i, h, k, v);
+    tab->refs[i] = 0;
+    __atomic_store_n(&shard->seq, seq + 2, __ATOMIC_RELEASE);
+    shard->used++;
+    hash_report(table, HASH_OP_INSERT, key, value);
+    if (expires)
+    {
+        hash_ttl_set(table, key, v, expires);
+    }
+
+    rwlock_write_unlock(lock);
+
+    __atomic_add_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    hash_account(table, hash_entry_bytes(table, len, hash_value_len(v)), 0);
+    hash_evict(table);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_search(hashtable_t *table, const char *key, const char **value)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    char k[MAX_KEY_LEN], *v;
+    uint64_t h;
+    long len;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        return 0;
+    }
+    h = swiss_hash(table, k, len);
+
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+    v = swiss_lookup(table, &sw->shards[swiss_shard_of(sw, h)], h, k);
+    epoch_exit();
+
+    if (v == NULL)
+    {
+        return 0;
+    }
+    *value = v;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_search_pin(hashtable_t *table, const char *key,
+                     const char **value, size_t *len)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    char k[MAX_KEY_LEN], *v;
+    uint64_t h;
+    long klen;
+
+    klen = swiss_key(k, key);
+    if (klen < 0)
+    {
+        return 0;
+    }
+    h = swiss_hash(table, k, klen);
+
+    if (epoch_enter() < 0)
+    {
+        return -1;
+    }
+    v = swiss_lookup(table, &sw->shards[swiss_shard_of(sw, h)], h, k);
+    if (v)
+    {
+        /* still referenced by the table until our read section ends */
+        hash_value_pin(v);
+    }
+    epoch_exit();
+
+    if (v == NULL)
+    {
+        return 0;
+    }
+    *value = v;
+    *len = hash_value_len(v);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_update(hashtable_t *table, const char *key, const char *value,
+                 uint64_t expires)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char k[MAX_KEY_LEN], *v, *old;
+    size_t idx;
+    uint64_t h;
+    long len;
+    long i;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        return 0;
+    }
+    h = swiss_hash(table, k, len);
+    idx = swiss_shard_of(sw, h);
+    lock = &table->locks[idx].lock;
+
+    rwlock_write_lock(lock);
+
+    tab = sw->shards[idx].tab;
+    i = swiss_find(tab, h, k);
+    if (i >= 0 && hash_value_expired(table, tab->slots[i].value))
+    {
+        swiss_expire_slot(table, &sw->shards[idx], tab, i);
+        i = -1;
+    }
+    if (i < 0)
+    {
+        rwlock_write_unlock(lock);
+        return 0;
+    }
+
+    v = hash_value_new(value, strlen(value));
+    if (v == NULL)
+    {
+        rwlock_write_unlock(lock);
+        return -1;
+    }
+    old = tab->slots[i].value;
+    hash_value_set_expires(v, hash_value_expires(old));
+    __atomic_store_n(&tab->slots[i].value, v, __ATOMIC_RELEASE);
+    hash_account(table, hash_entry_bytes(table, len, hash_value_len(v)),
+                 hash_entry_bytes(table, len, hash_value_len(old)));
+    hash_report(table, HASH_OP_UPDATE, key, value);
+    if (expires)
+    {
+        hash_ttl_set(table, key, v, expires);
+    }
+
+    rwlock_write_unlock(lock);
+
+    epoch_retire(old, swiss_value_retired);
+    hash_evict(table);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+size_t swiss_lock_of(hashtable_t *table, uint64_t h)
+{
+    return swiss_shard_of(table->swiss, h);
+}
+/*---------------------------------------------------------------------------*/
+int swiss_set(hashtable_t *table, uint64_t h, const char *key,
+              const char *value)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard = &sw->shards[swiss_shard_of(sw, h)];
+    struct swiss_tab *tab = shard->tab;
+    char k[MAX_KEY_LEN], *v, *old;
+    size_t i, slots;
+    unsigned long seq;
+    long len, j;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        DEBUG_PRINT("Key too long to store inline");
+        return -1;
+    }
+    v = hash_value_new(value, strlen(value));
+    if (v == NULL)
+    {
+        return -1;
+    }
+
+    j = swiss_find(tab, h, k);
+    if (j >= 0 && hash_value_expired(table, tab->slots[j].value))
+    {
+        swiss_expire_slot(table, shard, tab, j);
+        j = -1;
+    }
+    if (j >= 0)
+    {
+        /* the same as swiss_update() */
+        old = tab->slots[j].value;
+        hash_value_set_expires(v, hash_value_expires(old));
+        __atomic_store_n(&tab->slots[j].value, v, __ATOMIC_RELEASE);
+        hash_account(table, hash_entry_bytes(table, len, hash_value_len(v)),
+                     hash_entry_bytes(table, len, hash_value_len(old)));
+        hash_report(table, HASH_OP_UPDATE, key, value);
+        epoch_retire(old, swiss_value_retired);
+        return 0;
+    }
+
+    /* the same as swiss_insert() */
+    slots = tab->num_groups * SWISS_GROUP;
+    if ((shard->used + shard->deleted + 1) * 8 > slots * SWISS_MAX_LOAD)
+    {
+        if (swiss_rehash(table, shard,
+                         (shard->used + 1) * 16 > slots * SWISS_MAX_LOAD
+                             ? tab->num_groups * 2
+                             : tab->num_groups) < 0)
+        {
+            hash_value_unpin(v);
+            return -1;
+        }
+        tab = shard->tab;
+    }
+
+    i = swiss_find_free(tab, h);
+    if (tab->ctrl[i] == SWISS_DELETED)
+    {
+        shard->deleted--;
+    }
+    seq = shard->seq;
+    __atomic_store_n(&shard->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    swiss_put(tab, i, h, k, v);
+    tab->refs[i] = 0;
+    __atomic_store_n(&shard->seq, seq + 2, __ATOMIC_RELEASE);
+    shard->used++;
+    hash_report(table, HASH_OP_INSERT, key, value);
+
+    __atomic_add_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    hash_account(table, hash_entry_bytes(table, len, hash_value_len(v)), 0);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void swiss_prefetch(hashtable_t *table, uint64_t h)
+{
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+
+    tab = __atomic_load_n(&sw->shards[swiss_shard_of(sw, h)].tab,
+                          __ATOMIC_ACQUIRE);
+    __builtin_prefetch(tab->ctrl +
+                       ((h >> 32) & (tab->num_groups - 1)) * SWISS_GROUP);
+}
+/*---------------------------------------------------------------------------*/
+int swiss_delete(hashtable_t *table, const char *key)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char k[MAX_KEY_LEN], *old;
+    size_t idx;
+    uint64_t h;
+    long len;
+    long i;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        return 0;
+    }
+    h = swiss_hash(table, k, len);
+    idx = swiss_shard_of(sw, h);
+    shard = &sw->shards[idx];
+    lock = &table->locks[idx].lock;
+
+    rwlock_write_lock(lock);
+
+    tab = shard->tab;
+    i = swiss_find(tab, h, k);
+    if (i < 0)
+    {
+        rwlock_write_unlock(lock);
+        return 0;
+    }
+
+    if (hash_value_expired(table, tab->slots[i].value))
+    {
+        /* dropped, but the key was gone already */
+        swiss_expire_slot(table, shard, tab, i);
+        rwlock_write_unlock(lock);
+        return 0;
+    }
+
+    old = swiss_remove(shard, tab, i);
+    hash_report(table, HASH_OP_DELETE, key, NULL);
+
+    rwlock_write_unlock(lock);
+
+    __atomic_sub_fetch(&table->total_entries, 1, __ATOMIC_RELAXED);
+    hash_account(table, 0, hash_entry_bytes(table, len, hash_value_len(old)));
+    epoch_retire(old, swiss_value_retired);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_expire(hashtable_t *table, const char *key, uint64_t expires)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char k[MAX_KEY_LEN];
+    size_t idx;
+    uint64_t h;
+    long len;
+    long i;
+    int ret = 0;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        return 0;
+    }
+    h = swiss_hash(table, k, len);
+    idx = swiss_shard_of(sw, h);
+    lock = &table->locks[idx].lock;
+
+    rwlock_write_lock(lock);
+
+    tab = sw->shards[idx].tab;
+    i = swiss_find(tab, h, k);
+    if (i >= 0 && hash_value_expired(table, tab->slots[i].value))
+    {
+        swiss_expire_slot(table, &sw->shards[idx], tab, i);
+    }
+    else if (i >= 0)
+    {
+        hash_ttl_set(table, key, tab->slots[i].value, expires);
+        ret = 1;
+    }
+
+    rwlock_write_unlock(lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+void swiss_expire_due(hashtable_t *table, const char *key, uint64_t deadline)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char k[MAX_KEY_LEN];
+    size_t idx;
+    uint64_t h, expires;
+    long len;
+    long i;
+
+    len = swiss_key(k, key);
+    if (len < 0)
+    {
+        return;
+    }
+    h = swiss_hash(table, k, len);
+    idx = swiss_shard_of(sw, h);
+    lock = &table->locks[idx].lock;
+
+    rwlock_write_lock(lock);
+
+    tab = sw->shards[idx].tab;
+    i = swiss_find(tab, h, k);
+    if (i >= 0)
+    {
+        expires = hash_value_expires(tab->slots[i].value);
+        if (expires && expires <= timer_now())
+        {
+            swiss_expire_slot(table, &sw->shards[idx], tab, i);
+        }
+        else if (expires == deadline &&
+                 timer_add(table->timers, key, deadline) < 0)
+        {
+            /* the clock went back, so wait for the deadline again */
+            DEBUG_PRINT("Failed to schedule the expiry of a key");
+        }
+    }
+
+    rwlock_write_unlock(lock);
+}
+/*---------------------------------------------------------------------------*/
+int swiss_bulk_begin(hashtable_t *table, size_t entries)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    size_t i, per_shard, groups;
+
+    /* a little slack, since the keys do not split evenly */
+    per_shard = entries / sw->num_shards + entries / sw->num_shards / 8 + 1;
+    for (groups = 1;
+         groups * SWISS_GROUP * SWISS_MAX_LOAD < per_shard * 8;
+         groups <<= 1)
+    {
+        ;
+    }
+
+    for (i = 0; i < sw->num_shards; i++)
+    {
+        if (groups > sw->shards[i].tab->num_groups &&
+            swiss_rehash(table, &sw->shards[i], groups) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int swiss_bulk_insert(hashtable_t *table, uint64_t h, const char *key,
+                      size_t klen, const char *value, size_t vlen,
+                      uint64_t expires)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard = &sw->shards[swiss_shard_of(sw, h)];
+    struct swiss_tab *tab = shard->tab;
+    char k[MAX_KEY_LEN], *v;
+
+    memcpy(k, key, klen);
+    memset(k + klen, 0, MAX_KEY_LEN - klen);
+
+    if ((shard->used + 1) * 8 > tab->num_groups * SWISS_GROUP * SWISS_MAX_LOAD)
+    {
+        if (swiss_rehash(table, shard, tab->num_groups * 2) < 0)
+        {
+            return -1;
+        }
+        tab = shard->tab;
+    }
+
+    v = hash_value_new(value, vlen);
+    if (v == NULL)
+    {
+        return -1;
+    }
+    swiss_put(tab, swiss_find_free(tab, h), h, k, v);
+    shard->used++;
+    hash_account(table, hash_entry_bytes(table, klen, vlen), 0);
+    if (expires)
+    {
+        /* the timer takes the key zero-padded as well */
+        hash_value_set_expires(v, expires);
+        timer_add(table->timers, k, expires);
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+size_t swiss_slot_bytes(void)
+{
+    /* the control byte and the reference bit come with every slot */
+    return sizeof(struct swiss_slot) + 2;
+}
+/*---------------------------------------------------------------------------*/
+void swiss_evict(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard;
+    struct swiss_tab *tab;
+    rwlock_t *lock;
+    char key[MAX_KEY_LEN + 1], *old;
+    size_t n, i, slots;
+
+    for (n = 0; n < HASH_EVICT_TURNS * sw->num_shards &&
+                hash_over_limit(table);
+         n++)
+    {
+        shard = &sw->shards[sw->hand_shard];
+        lock = &table->locks[sw->hand_shard].lock;
+        rwlock_write_lock(lock);
+
+        /* the shard may have been rehashed since the hand stopped in it */
+        tab = shard->tab;
+        slots = tab->num_groups * SWISS_GROUP;
+        for (i = sw->hand_slot; i < slots && hash_over_limit(table); i++)
+        {
+            if (tab->ctrl[i] < 0)
+            {
+                continue;
+            }
+            if (__atomic_load_n(&tab->refs[i], __ATOMIC_RELAXED))
+            {
+                /* read since the last turn, give it another one */
+                __atomic_store_n(&tab->refs[i], 0, __ATOMIC_RELAXED);
+                continue;
+            }
+            memcpy(key, tab->slots[i].key, MAX_KEY_LEN);
+            key[MAX_KEY_LEN] = '\0';
+            old = swiss_remove(shard, tab, i);
+            hash_evicted(table, key,
+                         hash_entry_bytes(table, strlen(key),
+                                          hash_value_len(old)));
+            epoch_retire(old, swiss_value_retired);
+        }
+
+        rwlock_write_unlock(lock);
+
+        if (i < slots)
+        {
+            /* under the limit, continue from here next time */
+            sw->hand_slot = i;
+            break;
+        }
+        sw->hand_slot = 0;
+        sw->hand_shard = (sw->hand_shard + 1) & (sw->num_shards - 1);
+    }
+}
+/*---------------------------------------------------------------------------*/
+size_t swiss_part_of(hashtable_t *table, uint64_t h)
+{
+    return swiss_shard_of(table->swiss, h);
+}
+/*---------------------------------------------------------------------------*/
+int swiss_foreach(hashtable_t *table, hash_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    size_t i, j;
+    int ret;
+
+    for (i = 0; i < sw->num_shards; i++)
+    {
+        tab = sw->shards[i].tab;
+        for (j = 0; j < tab->num_groups * SWISS_GROUP; j++)
+        {
+            if (tab->ctrl[j] < 0)
+            {
+                continue;
+            }
+            ret = visit(arg, tab->slots[j].key,
+                        strnlen(tab->slots[j].key, MAX_KEY_LEN),
+                        tab->slots[j].value,
+                        hash_value_len(tab->slots[j].value));
+            if (ret)
+            {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t swiss_scan(hashtable_t *table, uint64_t cursor, size_t steps,
+                    hash_visit_t visit, void *arg)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_tab *tab;
+    size_t idx = cursor >> 32, mask, g, probe, i, j, n, len;
+    uint64_t v = cursor & 0xFFFFFFFF, h;
+    rwlock_t *lock;
+    char *value;
+
+    for (n = 0; n < steps && idx < sw->num_shards; n++)
+    {
+        lock = &table->locks[idx].lock;
+        rwlock_read_lock(lock);
+        tab = sw->shards[idx].tab;
+        mask = tab->num_groups - 1;
+
+        /* a key lies on the probe sequence of its first group, before the
+         * first group with an empty slot, as swiss_find() relies on */
+        g = v & mask;
+        for (probe = 0; probe < tab->num_groups; probe++)
+        {
+            for (j = 0; j < SWISS_GROUP; j++)
+            {
+                i = g * SWISS_GROUP + j;
+                if (tab->ctrl[i] < 0)
+                {
+                    continue;
+                }
+                len = strnlen(tab->slots[i].key, MAX_KEY_LEN);
+                h = swiss_hash(table, tab->slots[i].key, len);
+                value = tab->slots[i].value;
+                if (((h >> 32) & mask) == (v & mask) &&
+                    !hash_value_expired(table, value))
+                {
+                    visit(arg, tab->slots[i].key, len,
+                          value, hash_value_len(value));
+                }
+            }
+            if (swiss_match(tab->ctrl + g * SWISS_GROUP, SWISS_EMPTY))
+            {
+                break;
+            }
+            g = (g + probe + 1) & mask;
+        }
+        rwlock_read_unlock(lock);
+
+        /* on to the next shard once every group of this one was visited */
+        v = hash_scan_next(v, mask);
+        if (v == 0)
+        {
+            idx++;
+        }
+    }
+
+    return idx < sw->num_shards ? (uint64_t)idx << 32 | v : 0;
+}
+/*---------------------------------------------------------------------------*/
+void swiss_dump(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct swiss *sw = table->swiss;
+    struct swiss_shard *shard;
+    struct swiss_tab *tab;
+    size_t i, j;
+
+    for (i = 0; i < sw->num_shards; i++)
+    {
+        shard = &sw->shards[i];
+        if (!shard->used)
+        {
+            continue;
+        }
+        tab = shard->tab;
+        printf("Shard %ld: %ld entries in %ld slots\n",
+               i, shard->used, tab->num_groups * SWISS_GROUP);
+        printf("  Lock State -> Read Count: %d, Write Count: %d\n",
+               table->locks[i].lock.read_count,
+               table->locks[i].lock.write_count);
+        for (j = 0; j < tab->num_groups * SWISS_GROUP; j++)
+        {
+            if (tab->ctrl[j] < 0)
+            {
+                continue;
+            }
+            printf("    Key:   %.*s\n"
+                   "    Value: %s\n", MAX_KEY_LEN, tab->slots[j].key,
+                   tab->slots[j].value);
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/*---------------------------------------------------------------------------*/
+/* swiss.h                                                                   */
+/* Open addressing table engine with inline keys and SIMD probing            */
+/*---------------------------------------------------------------------------*/
+#ifndef _SWISS_H
+#define _SWISS_H
+/*---------------------------------------------------------------------------*/
+#include "hashtable.h"
+/*---------------------------------------------------------------------------*/
+/* slots probed together through their control bytes */
+#define SWISS_GROUP 16
+/* slots of a shard when it is created */
+#define SWISS_INIT_SLOTS SWISS_GROUP
+/* rehash a shard when this many eighths of its slots are taken */
+#define SWISS_MAX_LOAD 7
+/* low bits of the hash kept in a control byte */
+#define SWISS_H2_BITS 7
+/*---------------------------------------------------------------------------*/
+/**
+ * creates the open addressing engine of table with num_shards shards,
+ * one for each lock of the table. every shard grows on its own,
+ * so a rehash only ever stops the writers of one shard.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int swiss_init(hashtable_t *table, size_t num_shards);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees the engine, its keys and its values.
+ */
+void swiss_destroy(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's versions of hash_insert_ttl(), hash_search(),
+ * hash_search_pin(), hash_update_ttl(), hash_delete() and hash_expire(),
+ * with the same return values. keys longer than MAX_KEY_LEN cannot be
+ * stored.
+ */
+int swiss_insert(hashtable_t *table, const char *key, const char *value,
+                 uint64_t expires);
+int swiss_search(hashtable_t *table, const char *key, const char **value);
+int swiss_search_pin(hashtable_t *table, const char *key,
+                     const char **value, size_t *len);
+int swiss_update(hashtable_t *table, const char *key, const char *value,
+                 uint64_t expires);
+int swiss_delete(hashtable_t *table, const char *key);
+int swiss_expire(hashtable_t *table, const char *key, uint64_t expires);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the index of the lock that guards the shard of hash h.
+ */
+size_t swiss_lock_of(hashtable_t *table, uint64_t h);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's part of hash_set_many(): inserts key, whose hash is h,
+ * or updates it. the caller holds the lock of swiss_lock_of().
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int swiss_set(hashtable_t *table, uint64_t h, const char *key,
+              const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * prefetches the first group probed for hash h, for hash_search_many().
+ * the caller is in a read section.
+ */
+void swiss_prefetch(hashtable_t *table, uint64_t h);
+/*---------------------------------------------------------------------------*/
+/**
+ * deletes key if its deadline passed, for the timer thread of the table.
+ * deadline is the one the timer was set for.
+ */
+void swiss_expire_due(hashtable_t *table, const char *key, uint64_t deadline);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's versions of hash_bulk_begin(), without the seed,
+ * hash_bulk_insert() and hash_part_of().
+ */
+int swiss_bulk_begin(hashtable_t *table, size_t entries);
+int swiss_bulk_insert(hashtable_t *table, uint64_t h, const char *key,
+                      size_t klen, const char *value, size_t vlen,
+                      uint64_t expires);
+size_t swiss_part_of(hashtable_t *table, uint64_t h);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the bytes of a slot, for hash_entry_bytes().
+ */
+size_t swiss_slot_bytes(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's part of hash_evict(). the clock hand sweeps one shard at
+ * a time under its lock. the caller holds the resize lock of the table.
+ */
+void swiss_evict(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's version of hash_foreach().
+ */
+int swiss_foreach(hashtable_t *table, hash_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * the engine's version of hash_scan(). the cursor holds a shard in its
+ * high half and a group of the shard in the low one. a step visits the
+ * keys whose probes start at that group, under the lock of the shard.
+ */
+uint64_t swiss_scan(hashtable_t *table, uint64_t cursor, size_t steps,
+                    hash_visit_t visit, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * dumps the entries of every shard.
+ */
+void swiss_dump(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+#endif // _SWISS_H
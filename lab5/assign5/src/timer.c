@@ -0,0 +1,347 @@
+/*---------------------------------------------------------------------------*/
+/* timer.c                                                                   */
+/* Hierarchical timer wheel for key expiry                                   */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "timer.h"
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+/* ticks the wheel spans; a later deadline waits in the last slot */
+#define TIMER_SPAN (1ULL << (TIMER_BITS * TIMER_LEVELS))
+/*---------------------------------------------------------------------------*/
+struct timer_entry
+{
+    uint64_t deadline;          // in milliseconds
+    struct timer_entry *next;
+    char key[MAX_KEY_LEN + 1];
+};
+/*---------------------------------------------------------------------------*/
+/* one wheel. level l has a slot for every 64^l ticks, and slot i of
+ * level l > 0 turns, moving its timers down, when the low l * TIMER_BITS
+ * bits of the tick are zero and the next ones are i. */
+struct timer_shard
+{
+    pthread_mutex_t lock;
+    uint64_t tick;              // next tick to run, all before it ran
+    unsigned long count;        // timers in the slots
+    struct timer_entry *slots[TIMER_LEVELS][TIMER_SLOTS];
+} __attribute__((aligned(64)));
+/*---------------------------------------------------------------------------*/
+struct timer_wheel
+{
+    struct timer_shard shards[TIMER_SHARDS];
+    timer_fire_t fire;
+    void *arg;
+
+    pthread_mutex_t lock;       // guards the fields below
+    pthread_cond_t wake;        // timers were added, or stop was set
+    unsigned long pending;      // timers not fired yet, also read unlocked
+    int held;
+    int started;
+    int stop;
+    pthread_t thread;
+
+    unsigned long fired;
+};
+/*---------------------------------------------------------------------------*/
+uint64_t timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+/* puts a timer in the slot of its deadline, relative to the next tick of
+ * the shard. the caller holds the shard lock. */
+static void
+timer_place(struct timer_shard *s, struct timer_entry *e)
+{
+    uint64_t d = (e->deadline + TIMER_TICK_MS - 1) / TIMER_TICK_MS, delta;
+    size_t idx;
+    int level;
+
+    if (d < s->tick)
+    {
+        /* already due, fire it on the next tick */
+        d = s->tick;
+    }
+    delta = d - s->tick;
+    if (delta >= TIMER_SPAN)
+    {
+        /* beyond the wheel, wait in the last slot of the last level */
+        d = s->tick + TIMER_SPAN - 1;
+        delta = TIMER_SPAN - 1;
+    }
+    for (level = 0; delta >> (TIMER_BITS * (level + 1)); level++)
+    {
+        ;
+    }
+
+    idx = (d >> (TIMER_BITS * level)) & TIMER_MASK;
+    e->next = s->slots[level][idx];
+    s->slots[level][idx] = e;
+}
+/*---------------------------------------------------------------------------*/
+/* runs the ticks of a shard up to now, and fires the due timers once the
+ * shard lock is released */
+static void
+timer_run(timer_wheel_t *t, struct timer_shard *s, uint64_t now)
+{
+    struct timer_entry *due = NULL, *e, *next;
+    unsigned long n = 0;
+    size_t idx;
+    int level;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->count && s->tick <= now)
+    {
+        /* the turning slots of the upper levels move their timers down,
+         * the highest first, so that they can move on in the same tick */
+        for (level = TIMER_LEVELS - 1; level > 0; level--)
+        {
+            if (s->tick & ((1ULL << (TIMER_BITS * level)) - 1))
+            {
+                continue;
+            }
+            idx = (s->tick >> (TIMER_BITS * level)) & TIMER_MASK;
+            e = s->slots[level][idx];
+            s->slots[level][idx] = NULL;
+            for (; e; e = next)
+            {
+                next = e->next;
+                timer_place(s, e);
+            }
+        }
+
+        idx = s->tick & TIMER_MASK;
+        for (e = s->slots[0][idx]; e; e = next)
+        {
+            next = e->next;
+            e->next = due;
+            due = e;
+            n++;
+            s->count--;
+        }
+        s->slots[0][idx] = NULL;
+        s->tick++;
+    }
+    if (s->count == 0 && s->tick <= now)
+    {
+        /* nothing to move, skip the idle ticks */
+        s->tick = now + 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    for (e = due; e; e = next)
+    {
+        next = e->next;
+        t->fire(t->arg, e->key, e->deadline);
+        slab_free(e);
+    }
+    if (n)
+    {
+        __atomic_sub_fetch(&t->pending, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&t->fired, n, __ATOMIC_RELAXED);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* ticks every TIMER_TICK_MS while timers are pending and the wheel is
+ * not held, and sleeps until that changes otherwise */
+static void *
+timer_main(void *arg)
+{
+    timer_wheel_t *t = arg;
+    struct timespec ts = {0, TIMER_TICK_MS * 1000000L};
+    uint64_t now;
+    int i, stop;
+
+    while (1)
+    {
+        pthread_mutex_lock(&t->lock);
+        while (!t->stop &&
+               (t->held ||
+                __atomic_load_n(&t->pending, __ATOMIC_RELAXED) == 0))
+        {
+            pthread_cond_wait(&t->wake, &t->lock);
+        }
+        stop = t->stop;
+        pthread_mutex_unlock(&t->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        now = timer_now() / TIMER_TICK_MS;
+        for (i = 0; i < TIMER_SHARDS; i++)
+        {
+            timer_run(t, &t->shards[i], now);
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* starts the thread unless it runs or is held. the caller holds t->lock. */
+static void
+timer_start(timer_wheel_t *t)
+{
+    if (t->started || t->held)
+    {
+        return;
+    }
+    if (pthread_create(&t->thread, NULL, timer_main, t) != 0)
+    {
+        /* expired keys are still dropped when they are accessed */
+        DEBUG_PRINT("Failed to start the timer thread");
+        return;
+    }
+    t->started = 1;
+}
+/*---------------------------------------------------------------------------*/
+timer_wheel_t *timer_open(timer_fire_t fire, void *arg)
+{
+    TRACE_PRINT();
+    timer_wheel_t *t;
+    uint64_t now = timer_now() / TIMER_TICK_MS;
+    void *mem;
+    int i;
+
+    if (posix_memalign(&mem, 64, sizeof(timer_wheel_t)) != 0)
+    {
+        return NULL;
+    }
+    t = memset(mem, 0, sizeof(timer_wheel_t));
+    t->fire = fire;
+    t->arg = arg;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wake, NULL);
+    for (i = 0; i < TIMER_SHARDS; i++)
+    {
+        pthread_mutex_init(&t->shards[i].lock, NULL);
+        t->shards[i].tick = now;
+    }
+
+    return t;
+}
+/*---------------------------------------------------------------------------*/
+int timer_add(timer_wheel_t *t, const char *key, uint64_t deadline)
+{
+    TRACE_PRINT();
+    struct timer_entry *e = slab_alloc(sizeof(struct timer_entry));
+    struct timer_shard *s;
+    size_t len = strnlen(key, MAX_KEY_LEN);
+    unsigned long h = 0;
+    uint64_t now;
+    size_t i;
+
+    if (e == NULL)
+    {
+        return -1;
+    }
+    e->deadline = deadline;
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+
+    /* any spread will do, the shards are only there to split the lock */
+    for (i = 0; i < len; i++)
+    {
+        h = h * 31 + (unsigned char)key[i];
+    }
+    s = &t->shards[h % TIMER_SHARDS];
+
+    pthread_mutex_lock(&s->lock);
+    if (s->count == 0)
+    {
+        /* the thread skipped the idle ticks only up to its last run */
+        now = timer_now() / TIMER_TICK_MS;
+        if (s->tick < now)
+        {
+            s->tick = now;
+        }
+    }
+    timer_place(s, e);
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (__atomic_fetch_add(&t->pending, 1, __ATOMIC_RELAXED) == 0 ||
+        !__atomic_load_n(&t->started, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&t->lock);
+        timer_start(t);
+        pthread_cond_signal(&t->wake);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void timer_hold(timer_wheel_t *t)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&t->lock);
+    t->held++;
+    pthread_mutex_unlock(&t->lock);
+}
+/*---------------------------------------------------------------------------*/
+void timer_release(timer_wheel_t *t)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&t->lock);
+    t->held--;
+    if (t->pending)
+    {
+        timer_start(t);
+        pthread_cond_signal(&t->wake);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+/*---------------------------------------------------------------------------*/
+void timer_close(timer_wheel_t *t)
+{
+    TRACE_PRINT();
+    struct timer_entry *e, *next;
+    int i, l, j;
+
+    pthread_mutex_lock(&t->lock);
+    t->stop = 1;
+    pthread_cond_signal(&t->wake);
+    pthread_mutex_unlock(&t->lock);
+    if (t->started)
+    {
+        pthread_join(t->thread, NULL);
+    }
+
+    for (i = 0; i < TIMER_SHARDS; i++)
+    {
+        for (l = 0; l < TIMER_LEVELS; l++)
+        {
+            for (j = 0; j < TIMER_SLOTS; j++)
+            {
+                for (e = t->shards[i].slots[l][j]; e; e = next)
+                {
+                    next = e->next;
+                    slab_free(e);
+                }
+            }
+        }
+        pthread_mutex_destroy(&t->shards[i].lock);
+    }
+    if (t->fired)
+    {
+        printf("Timers: %lu fired, %lu pending\n", t->fired, t->pending);
+    }
+    pthread_cond_destroy(&t->wake);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
@@ -0,0 +1,62 @@
+/*---------------------------------------------------------------------------*/
+/* timer.h                                                                   */
+/* Hierarchical timer wheel for key expiry                                   */
+/*---------------------------------------------------------------------------*/
+#ifndef _TIMER_H
+#define _TIMER_H
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* milliseconds per tick of the wheel */
+#define TIMER_TICK_MS 10
+/* slots per level are 1 << TIMER_BITS, so a level spans 64 times the
+ * one below it, and TIMER_LEVELS levels span about 46 hours of ticks.
+ * later deadlines wait in the last level and move down when it turns. */
+#define TIMER_BITS 6
+#define TIMER_LEVELS 4
+/* wheels of their own, each with a lock, so that writers setting
+ * deadlines at the same time rarely wait for each other */
+#define TIMER_SHARDS 16
+/*---------------------------------------------------------------------------*/
+/* called by the timer thread once the deadline of key has passed,
+ * outside every lock of the wheel */
+typedef void (*timer_fire_t)(void *arg, const char *key, uint64_t deadline);
+/*---------------------------------------------------------------------------*/
+typedef struct timer_wheel timer_wheel_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the current time in milliseconds of CLOCK_REALTIME, the clock
+ * of every deadline, so that deadlines keep their meaning in a log or
+ * a snapshot read after a restart.
+ */
+uint64_t timer_now(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * creates an empty wheel that calls fire(arg, ...) for due keys.
+ * its thread starts with the first timer.
+ * returns NULL when any internal errors occur.
+ */
+timer_wheel_t *timer_open(timer_fire_t fire, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * schedules fire for key at deadline, in O(1). a timer cannot be
+ * cancelled; fire checks whether the key still has that deadline.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int timer_add(timer_wheel_t *t, const char *key, uint64_t deadline);
+/*---------------------------------------------------------------------------*/
+/**
+ * keeps the thread of the wheel from firing timers, e.g. while the table
+ * is being loaded without locks, and lets it go on again. holds nest.
+ */
+void timer_hold(timer_wheel_t *t);
+void timer_release(timer_wheel_t *t);
+/*---------------------------------------------------------------------------*/
+/**
+ * stops the thread, drops the pending timers and frees the wheel.
+ */
+void timer_close(timer_wheel_t *t);
+/*---------------------------------------------------------------------------*/
+#endif // _TIMER_H
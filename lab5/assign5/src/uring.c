@@ -0,0 +1,726 @@
+/*---------------------------------------------------------------------------*/
+/* uring.c                                                                   */
+/* io_uring event loop for SKVS worker threads                               */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include "uring.h"
+/*---------------------------------------------------------------------------*/
+/* operation tag stored in the low bits of user_data */
+enum UOP
+{
+    UOP_ACCEPT = 1,
+    UOP_RECV,
+    UOP_SEND,
+    UOP_MASK = 3
+};
+/*---------------------------------------------------------------------------*/
+struct uring
+{
+    int fd;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local;      // tail including unsubmitted entries
+    unsigned sq_submitted;  // tail already passed to the kernel
+    struct io_uring_sqe *sqes;
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* mappings */
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+
+    /* provided buffer ring for recv */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *bufs;
+    unsigned short br_tail;
+
+    /* statistics */
+    unsigned long enters;   // io_uring_enter() calls
+    unsigned long requests; // served requests
+};
+/*---------------------------------------------------------------------------*/
+/* per-connection state, owned by exactly one worker */
+struct uconn
+{
+    int fd;
+    int recv_armed;         // multishot recv is active
+    int send_inflight;      // inflight is being sent by the kernel
+    int closing;
+
+    /* input, may end with an incomplete command */
+    char rbuf[SKVS_RBUF_SIZE];
+    size_t rlen;
+
+    /* output being sent, must not move until the send completes */
+    struct skvs_resp inflight;
+    struct msghdr msg;
+
+    /* output accumulated while a send is in flight */
+    struct skvs_resp out;
+
+    int dirty;              // queued on the flush list
+    struct uconn *next_dirty;
+    struct uconn *prev;
+    struct uconn *next;
+};
+/*---------------------------------------------------------------------------*/
+static inline int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+/*---------------------------------------------------------------------------*/
+static inline int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, arg, argsz);
+}
+/*---------------------------------------------------------------------------*/
+static inline int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+/*---------------------------------------------------------------------------*/
+static void
+uring_exit(struct uring *u)
+{
+    TRACE_PRINT();
+    if (u->br)
+    {
+        munmap(u->br, u->br_size);
+        u->br = NULL;
+    }
+    free(u->bufs);
+    u->bufs = NULL;
+    if (u->sqes)
+    {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+    {
+        munmap(u->cq_ptr, u->cq_size);
+    }
+    if (u->sq_ptr)
+    {
+        munmap(u->sq_ptr, u->sq_size);
+    }
+    if (u->fd >= 0)
+    {
+        close(u->fd);
+    }
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+uring_init(struct uring *u, unsigned entries, unsigned nbufs)
+{
+    TRACE_PRINT();
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+              IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    p.cq_entries = entries * 4;
+    u->fd = sys_io_uring_setup(entries, &p);
+    if (u->fd < 0 && errno == EINVAL)
+    {
+        /* older kernel, retry without the optional flags */
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        u->fd = sys_io_uring_setup(entries, &p);
+    }
+    if (u->fd < 0)
+    {
+        DEBUG_PRINT("io_uring_setup failed: %s", strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_EXT_ARG))
+    {
+        DEBUG_PRINT("io_uring features missing");
+        close(u->fd);
+        u->fd = -1;
+        return -1;
+    }
+
+    /* map the rings; both live in one mapping with FEAT_SINGLE_MMAP */
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_size > u->sq_size)
+    {
+        u->sq_size = u->cq_size;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+    {
+        u->sq_ptr = NULL;
+        uring_exit(u);
+        return -1;
+    }
+    u->cq_ptr = u->sq_ptr;
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        uring_exit(u);
+        return -1;
+    }
+
+    u->sq_head = (unsigned *)((char *)u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+    u->sq_local = u->sq_submitted = *u->sq_tail;
+
+    /* register the provided buffer ring */
+    u->br_size = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u->br == MAP_FAILED)
+    {
+        u->br = NULL;
+        uring_exit(u);
+        return -1;
+    }
+    u->bufs = malloc((size_t)nbufs * BUFFER_SIZE);
+    if (u->bufs == NULL)
+    {
+        uring_exit(u);
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)u->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        DEBUG_PRINT("Failed to register buffer ring: %s", strerror(errno));
+        uring_exit(u);
+        return -1;
+    }
+
+    for (i = 0; i < nbufs; i++)
+    {
+        struct io_uring_buf *buf = &u->br->bufs[i];
+        buf->addr = (unsigned long)(u->bufs + (size_t)i * BUFFER_SIZE);
+        buf->len = BUFFER_SIZE;
+        buf->bid = i;
+    }
+    u->br_tail = nbufs;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* hands a consumed receive buffer back to the kernel (committed later) */
+static inline void
+uring_recycle_buf(struct uring *u, unsigned short bid, unsigned nbufs)
+{
+    struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (nbufs - 1)];
+
+    buf->addr = (unsigned long)(u->bufs + (size_t)bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    u->br_tail++;
+}
+/*---------------------------------------------------------------------------*/
+static int
+uring_submit(struct uring *u, unsigned min_complete, int wait_sec)
+{
+    TRACE_PRINT();
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit = u->sq_local - u->sq_submitted;
+    unsigned flags = 0;
+    int ret;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete)
+    {
+        ts.tv_sec = wait_sec;
+        ts.tv_nsec = 0;
+        arg.ts = (unsigned long)&ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+
+    u->enters++;
+    ret = sys_io_uring_enter(u->fd, to_submit, min_complete, flags,
+                             min_complete ? &arg : NULL,
+                             min_complete ? sizeof(arg) : 0);
+    if (ret < 0)
+    {
+        if (errno == ETIME || errno == EINTR || errno == EBUSY)
+        {
+            ret = 0;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    u->sq_submitted += ret;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static struct io_uring_sqe *
+uring_get_sqe(struct uring *u)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head, idx;
+
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local - head > *u->sq_mask)
+    {
+        /* submission queue full, push what we have */
+        if (uring_submit(u, 0, 0) < 0)
+        {
+            return NULL;
+        }
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (u->sq_local - head > *u->sq_mask)
+        {
+            return NULL;
+        }
+    }
+
+    idx = u->sq_local & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local++;
+
+    return sqe;
+}
+/*---------------------------------------------------------------------------*/
+static int
+uring_prep_accept(struct uring *u, int listenfd)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UOP_ACCEPT;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+uring_prep_recv(struct uring *u, int fd, void *owner)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uintptr_t)owner | UOP_RECV;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+uring_prep_sendmsg(struct uring *u, int fd, const struct msghdr *msg,
+                   void *owner)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)owner | UOP_SEND;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int uring_supported(void)
+{
+    TRACE_PRINT();
+    struct uring u;
+    struct io_uring_cqe *cqe;
+    int sv[2], ok = 0;
+    unsigned head;
+
+    if (uring_init(&u, 8, 8) < 0)
+    {
+        return 0;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        uring_exit(&u);
+        return 0;
+    }
+
+    /* multishot recv with provided buffers is the newest feature we use */
+    if (uring_prep_recv(&u, sv[0], NULL) == 0 &&
+        write(sv[1], "x", 1) == 1 &&
+        uring_submit(&u, 1, 1) == 0)
+    {
+        head = *u.cq_head;
+        if (head != __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            cqe = &u.cqes[head & *u.cq_mask];
+            ok = cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER) &&
+                 (cqe->flags & IORING_CQE_F_MORE);
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    uring_exit(&u);
+
+    return ok;
+}
+/*---------------------------------------------------------------------------*/
+static void
+uconn_mark_dirty(struct uconn *c, struct uconn **dirty)
+{
+    if (!c->dirty)
+    {
+        c->dirty = 1;
+        c->next_dirty = *dirty;
+        *dirty = c;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+uconn_begin_close(struct uconn *c)
+{
+    if (!c->closing)
+    {
+        c->closing = 1;
+        /* terminates the multishot recv with a zero-length completion */
+        shutdown(c->fd, SHUT_RDWR);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+uconn_free(struct uconn **head, struct uconn *c)
+{
+    TRACE_PRINT();
+    close(c->fd);
+
+    if (c->prev)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        *head = c->next;
+    }
+    if (c->next)
+    {
+        c->next->prev = c->prev;
+    }
+
+    skvs_resp_free(&c->inflight);
+    skvs_resp_free(&c->out);
+    free(c);
+}
+/*---------------------------------------------------------------------------*/
+/* starts a send for connection c when nothing is in flight.
+ * pending output moves from out to inflight so that later responses
+ * can be appended while the kernel reads inflight. */
+static int
+uconn_flush(struct uring *u, struct uconn *c)
+{
+    struct skvs_resp tmp;
+    int cnt;
+
+    if (c->send_inflight || c->closing)
+    {
+        return 0;
+    }
+
+    if (c->inflight.len == 0)
+    {
+        if (c->out.len == 0)
+        {
+            return 0;
+        }
+        /* swap the iovec lists */
+        tmp = c->inflight;
+        c->inflight = c->out;
+        c->out = tmp;
+    }
+
+    cnt = c->inflight.cnt - c->inflight.head;
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->inflight.iov + c->inflight.head;
+    c->msg.msg_iovlen = cnt < IOV_MAX ? cnt : IOV_MAX;
+    if (uring_prep_sendmsg(u, c->fd, &c->msg, c) < 0)
+    {
+        return -1;
+    }
+    c->send_inflight = 1;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int uring_run(struct skvs_ctx *ctx, int listenfd, int idx,
+              volatile sig_atomic_t *shutdown)
+{
+    TRACE_PRINT();
+    struct uring u;
+    struct io_uring_cqe *cqe;
+    struct uconn *head = NULL, *dirty, *c;
+    ssize_t used;
+    char *buf;
+    unsigned cq_head, cq_tail;
+    unsigned short bid;
+    int res, more, op, ret = 0;
+
+    if (uring_init(&u, URING_ENTRIES, URING_NUM_BUFS) < 0)
+    {
+        fprintf(stderr, "Worker %d: io_uring setup failed\n", idx);
+        return -1;
+    }
+
+    if (uring_prep_accept(&u, listenfd) < 0)
+    {
+        uring_exit(&u);
+        return -1;
+    }
+
+    dirty = NULL;
+    while (!*shutdown)
+    {
+        /* queue one send per connection with new output */
+        while (dirty)
+        {
+            c = dirty;
+            dirty = c->next_dirty;
+            c->dirty = 0;
+            if (uconn_flush(&u, c) < 0)
+            {
+                uconn_begin_close(c);
+            }
+        }
+
+        /* a single syscall submits everything and waits for completions */
+        __atomic_store_n(&u.br->tail, u.br_tail, __ATOMIC_RELEASE);
+        if (uring_submit(&u, 1, TIMEOUT) < 0)
+        {
+            perror("io_uring_enter failed");
+            ret = -1;
+            break;
+        }
+
+        cq_head = *u.cq_head;
+        cq_tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++)
+        {
+            cqe = &u.cqes[cq_head & *u.cq_mask];
+            op = cqe->user_data & UOP_MASK;
+            c = (struct uconn *)(uintptr_t)(cqe->user_data &
+                                            ~(uint64_t)UOP_MASK);
+            res = cqe->res;
+            more = cqe->flags & IORING_CQE_F_MORE;
+
+            switch (op)
+            {
+            case UOP_ACCEPT:
+                if (res >= 0)
+                {
+                    c = calloc(1, sizeof(struct uconn));
+                    if (c == NULL || uring_prep_recv(&u, res, c) < 0)
+                    {
+                        DEBUG_PRINT("Failed to set up connection");
+                        free(c);
+                        close(res);
+                    }
+                    else
+                    {
+                        c->fd = res;
+                        c->recv_armed = 1;
+                        c->next = head;
+                        if (head)
+                        {
+                            head->prev = c;
+                        }
+                        head = c;
+                    }
+                }
+                else if (res != -EAGAIN && res != -ECANCELED)
+                {
+                    fprintf(stderr, "Worker %d: accept failed: %s\n",
+                            idx, strerror(-res));
+                }
+                if (!more && uring_prep_accept(&u, listenfd) < 0)
+                {
+                    ret = -1;
+                }
+                break;
+
+            case UOP_RECV:
+                if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+                {
+                    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    buf = u.bufs + (size_t)bid * BUFFER_SIZE;
+                    if (!c->closing)
+                    {
+                        if (c->rlen == 0)
+                        {
+                            /* serve straight from the provided buffer */
+                            used = skvs_serve_iov(ctx, buf, res, &c->out,
+                                                  &u.requests);
+                            if (used >= 0)
+                            {
+                                c->rlen = res - used;
+                                memcpy(c->rbuf, buf + used, c->rlen);
+                            }
+                        }
+                        else
+                        {
+                            /* complete the pending partial command */
+                            memcpy(c->rbuf + c->rlen, buf, res);
+                            c->rlen += res;
+                            used = skvs_serve_iov(ctx, c->rbuf, c->rlen,
+                                                  &c->out, &u.requests);
+                            if (used >= 0)
+                            {
+                                c->rlen -= used;
+                                memmove(c->rbuf, c->rbuf + used, c->rlen);
+                            }
+                        }
+                        if (used < 0)
+                        {
+                            uconn_begin_close(c);
+                        }
+                        uconn_mark_dirty(c, &dirty);
+                    }
+                    uring_recycle_buf(&u, bid, URING_NUM_BUFS);
+                }
+                if (!more)
+                {
+                    c->recv_armed = 0;
+                    if ((res > 0 || res == -ENOBUFS) && !c->closing)
+                    {
+                        /* buffers are replenished before the next submit */
+                        if (uring_prep_recv(&u, c->fd, c) == 0)
+                        {
+                            c->recv_armed = 1;
+                        }
+                        else
+                        {
+                            uconn_begin_close(c);
+                        }
+                    }
+                    else
+                    {
+                        uconn_begin_close(c);
+                    }
+                }
+                break;
+
+            case UOP_SEND:
+                c->send_inflight = 0;
+                if (res < 0)
+                {
+                    uconn_begin_close(c);
+                }
+                else
+                {
+                    skvs_resp_consume(&c->inflight, res);
+                    uconn_mark_dirty(c, &dirty);
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            /* release once the kernel holds no reference to the connection */
+            if (op != UOP_ACCEPT && c->closing &&
+                !c->recv_armed && !c->send_inflight)
+            {
+                if (c->dirty)
+                {
+                    /* drop it from the flush list first */
+                    struct uconn **pp = &dirty;
+                    while (*pp != c)
+                    {
+                        pp = &(*pp)->next_dirty;
+                    }
+                    *pp = c->next_dirty;
+                }
+                uconn_free(&head, c);
+            }
+        }
+        __atomic_store_n(u.cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+
+    printf("Worker %d: %lu requests, %lu io_uring_enter calls\n",
+           idx, u.requests, u.enters);
+
+    /* closing the ring cancels every pending request */
+    uring_exit(&u);
+    while (head)
+    {
+        uconn_free(&head, head);
+    }
+
+    return ret;
+}
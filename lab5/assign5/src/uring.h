@@ -0,0 +1,38 @@
+/*---------------------------------------------------------------------------*/
+/* uring.h                                                                   */
+/* io_uring event loop for SKVS worker threads                               */
+/*---------------------------------------------------------------------------*/
+#ifndef _URING_H
+#define _URING_H
+/*---------------------------------------------------------------------------*/
+#include <signal.h>
+#include "skvslib.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/* submission queue entries per worker (the completion queue is 4x) */
+#define URING_ENTRIES 1024
+/* provided receive buffers per worker, must be a power of two */
+#define URING_NUM_BUFS 1024
+/* buffer group id of the receive buffers */
+#define URING_BGID 0
+/*---------------------------------------------------------------------------*/
+/**
+ * checks whether the running kernel supports everything the io_uring
+ * backend needs: multishot accept/recv and provided buffer rings.
+ * returns 1 when supported.
+ * returns 0 otherwise.
+ */
+int uring_supported(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * runs the io_uring loop of one worker until *shutdown becomes non-zero.
+ * connections are accepted with a multishot accept on the shared
+ * listening socket, read with multishot recv into a provided buffer ring,
+ * and all responses of one loop iteration are submitted in one syscall.
+ * returns -1 when any internal errors occur.
+ * returns 0 on shutdown.
+ */
+int uring_run(struct skvs_ctx *ctx, int listenfd, int idx,
+              volatile sig_atomic_t *shutdown);
+/*---------------------------------------------------------------------------*/
+#endif // _URING_H
@@ -0,0 +1,507 @@
+/*---------------------------------------------------------------------------*/
+/* wal.c                                                                     */
+/* Append-only write-ahead log with group commit                             */
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "wal.h"
+/*---------------------------------------------------------------------------*/
+/* initial size of the append buffers */
+#define WAL_BUF_SIZE (64 * 1024)
+/*---------------------------------------------------------------------------*/
+/* a record is this header followed by the key and the value, without
+ * their NULs. crc covers everything behind the crc field. integers are
+ * in host byte order; a log is only read by the host that wrote it. */
+struct wal_hdr
+{
+    uint32_t crc;
+    uint8_t op;         // enum HASH_OP
+    uint8_t pad;
+    uint16_t klen;
+    uint32_t vlen;
+};
+/*---------------------------------------------------------------------------*/
+struct wal
+{
+    int fd;
+    int sync;                   // enum WAL_SYNC
+    int interval_ms;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;        // a write of the log finished
+    pthread_cond_t tick;        // wakes the sync thread early
+
+    /* records are appended to buf while out is being written */
+    char *buf, *out;
+    size_t len, cap, out_cap;
+
+    /* log positions in bytes since opening */
+    unsigned long appended;
+    unsigned long written;      // written, and synced with WAL_SYNC_ALWAYS
+    int flushing;               // a thread is writing out
+    int error;                  // a write failed, nothing is durable anymore
+    int stop;
+
+    pthread_t syncer;
+    int has_syncer;
+
+    unsigned long records, writes, syncs;
+};
+/*---------------------------------------------------------------------------*/
+static uint32_t g_crc_table[256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+/* position of the last record appended by this thread, and its log */
+static __thread wal_t *t_wal = NULL;
+static __thread unsigned long t_lsn = 0;
+/*---------------------------------------------------------------------------*/
+static void
+crc_init(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (j = 0; j < 8; j++)
+        {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[i] = c;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* continues the CRC-32 crc over len bytes of data */
+static uint32_t
+crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc = g_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+wal_crc(const struct wal_hdr *hdr, const char *key, const char *value)
+{
+    uint32_t crc;
+
+    crc = crc32(0, (const char *)hdr + sizeof(hdr->crc),
+                sizeof(struct wal_hdr) - sizeof(hdr->crc));
+    crc = crc32(crc, key, hdr->klen);
+
+    return crc32(crc, value, hdr->vlen);
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* writes out everything appended so far, and syncs it when do_sync is set.
+ * the caller holds wal->lock and nobody else is flushing. the lock is
+ * dropped during the I/O, so appenders fill the other buffer meanwhile. */
+static void
+wal_flush(wal_t *wal, int do_sync)
+{
+    char *data = wal->buf;
+    size_t len = wal->len, cap = wal->cap;
+    unsigned long target = wal->appended;
+    int ret;
+
+    wal->buf = wal->out;
+    wal->cap = wal->out_cap;
+    wal->len = 0;
+    wal->out = data;
+    wal->out_cap = cap;
+    wal->flushing = 1;
+    pthread_mutex_unlock(&wal->lock);
+
+    ret = write_all(wal->fd, data, len);
+    if (ret == 0 && do_sync)
+    {
+        ret = fdatasync(wal->fd);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->flushing = 0;
+    if (ret < 0)
+    {
+        DEBUG_PRINT("Failed to write the log");
+        wal->error = 1;
+    }
+    else
+    {
+        __atomic_store_n(&wal->written, target, __ATOMIC_RELEASE);
+        wal->writes++;
+        wal->syncs += do_sync;
+    }
+    pthread_cond_broadcast(&wal->done);
+}
+/*---------------------------------------------------------------------------*/
+/* syncs the log every interval_ms for WAL_SYNC_INTERVAL */
+static void *
+wal_syncer(void *arg)
+{
+    wal_t *wal = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wal->interval_ms / 1000;
+        deadline.tv_nsec += (long)(wal->interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&wal->tick, &wal->lock, &deadline);
+
+        if (!wal->flushing && wal->len > 0)
+        {
+            wal_flush(wal, 1);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+wal_t *wal_open(const char *path, int sync, int interval_ms)
+{
+    TRACE_PRINT();
+    wal_t *wal = calloc(1, sizeof(wal_t));
+
+    pthread_once(&g_crc_once, crc_init);
+    if (wal == NULL)
+    {
+        return NULL;
+    }
+    wal->sync = sync;
+    wal->interval_ms = interval_ms > 0 ? interval_ms : WAL_SYNC_MS;
+    wal->cap = wal->out_cap = WAL_BUF_SIZE;
+    wal->buf = malloc(wal->cap);
+    wal->out = malloc(wal->out_cap);
+    if (wal->buf == NULL || wal->out == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate log buffers");
+        goto err_free;
+    }
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0)
+    {
+        perror("Failed to open the log");
+        goto err_free;
+    }
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->done, NULL);
+    pthread_cond_init(&wal->tick, NULL);
+
+    if (sync == WAL_SYNC_INTERVAL)
+    {
+        if (pthread_create(&wal->syncer, NULL, wal_syncer, wal) != 0)
+        {
+            DEBUG_PRINT("Failed to start the log sync thread");
+            close(wal->fd);
+            goto err_free;
+        }
+        wal->has_syncer = 1;
+    }
+
+    return wal;
+
+err_free:
+    free(wal->buf);
+    free(wal->out);
+    free(wal);
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* applies one record to table.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success. */
+static int
+wal_apply(hashtable_t *table, int op, const char *key, const char *value)
+{
+    int ret;
+
+    switch (op)
+    {
+    case HASH_OP_INSERT:
+        ret = hash_insert(table, key, value);
+        if (ret == 0)
+        {
+            /* the table was not empty, the log wins */
+            ret = hash_update(table, key, value);
+        }
+        break;
+    case HASH_OP_UPDATE:
+        ret = hash_update(table, key, value);
+        break;
+    case HASH_OP_EXPIRE:
+        /* a passed deadline deletes the key soon after the replay */
+        ret = hash_expire(table, key, strtoull(value, NULL, 10));
+        break;
+    default:
+        ret = hash_delete(table, key);
+        break;
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+long wal_replay(wal_t *wal, hashtable_t *table)
+{
+    TRACE_PRINT();
+    char key[MAX_KEY_LEN + 1], value[BUFFER_SIZE + 1];
+    char *buf = malloc(WAL_READ_SIZE);
+    size_t have = 0, pos = 0, rlen;
+    off_t base = 0;             // file offset of buf[0]
+    struct wal_hdr hdr;
+    struct stat st;
+    long applied = 0;
+    ssize_t n;
+
+    if (buf == NULL)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        rlen = 0;
+        if (have - pos >= sizeof(hdr))
+        {
+            memcpy(&hdr, buf + pos, sizeof(hdr));
+            if (hdr.op > HASH_OP_EXPIRE || hdr.klen == 0 ||
+                hdr.klen > MAX_KEY_LEN || hdr.vlen >= BUFFER_SIZE)
+            {
+                break;
+            }
+            rlen = sizeof(hdr) + hdr.klen + hdr.vlen;
+        }
+
+        if (rlen == 0 || have - pos < rlen)
+        {
+            /* keep the partial record and read more behind it */
+            memmove(buf, buf + pos, have - pos);
+            base += pos;
+            have -= pos;
+            pos = 0;
+            n = read(wal->fd, buf + have, WAL_READ_SIZE - have);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("Failed to read the log");
+                free(buf);
+                return -1;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            have += n;
+            continue;
+        }
+
+        if (wal_crc(&hdr, buf + pos + sizeof(hdr),
+                    buf + pos + sizeof(hdr) + hdr.klen) != hdr.crc)
+        {
+            break;
+        }
+        memcpy(key, buf + pos + sizeof(hdr), hdr.klen);
+        key[hdr.klen] = '\0';
+        memcpy(value, buf + pos + sizeof(hdr) + hdr.klen, hdr.vlen);
+        value[hdr.vlen] = '\0';
+        if (wal_apply(table, hdr.op, key, value) < 0)
+        {
+            free(buf);
+            return -1;
+        }
+        applied++;
+        pos += rlen;
+    }
+    free(buf);
+
+    /* cut off a record torn by a crash, and anything behind it */
+    base += pos;
+    if (fstat(wal->fd, &st) == 0 && st.st_size > base)
+    {
+        fprintf(stderr, "Log: dropping %ld bytes of torn records at %ld\n",
+                (long)(st.st_size - base), (long)base);
+        if (ftruncate(wal->fd, base) < 0)
+        {
+            perror("Failed to truncate the log");
+            return -1;
+        }
+    }
+
+    return applied;
+}
+/*---------------------------------------------------------------------------*/
+void wal_append(void *arg, int op, const char *key, const char *value)
+{
+    TRACE_PRINT();
+    wal_t *wal = arg;
+    struct wal_hdr hdr;
+    size_t need, cap;
+    char *buf;
+
+    if (value == NULL)
+    {
+        value = "";
+    }
+    hdr.op = op;
+    hdr.pad = 0;
+    hdr.klen = strlen(key);
+    hdr.vlen = strlen(value);
+    hdr.crc = wal_crc(&hdr, key, value);
+    need = sizeof(hdr) + hdr.klen + hdr.vlen;
+
+    pthread_mutex_lock(&wal->lock);
+
+    if (wal->len + need > wal->cap)
+    {
+        for (cap = wal->cap * 2; cap < wal->len + need; cap *= 2)
+        {
+            ;
+        }
+        buf = realloc(wal->buf, cap);
+        if (buf == NULL)
+        {
+            DEBUG_PRINT("Failed to grow the log buffer");
+            wal->error = 1;
+            pthread_mutex_unlock(&wal->lock);
+            return;
+        }
+        wal->buf = buf;
+        wal->cap = cap;
+    }
+    memcpy(wal->buf + wal->len, &hdr, sizeof(hdr));
+    memcpy(wal->buf + wal->len + sizeof(hdr), key, hdr.klen);
+    memcpy(wal->buf + wal->len + sizeof(hdr) + hdr.klen, value, hdr.vlen);
+    wal->len += need;
+    wal->appended += need;
+    wal->records++;
+
+    t_wal = wal;
+    t_lsn = wal->appended;
+
+    pthread_mutex_unlock(&wal->lock);
+}
+/*---------------------------------------------------------------------------*/
+int wal_commit(wal_t *wal)
+{
+    TRACE_PRINT();
+    int ret;
+
+    if (t_wal != wal ||
+        (__atomic_load_n(&wal->written, __ATOMIC_ACQUIRE) >= t_lsn &&
+         !__atomic_load_n(&wal->error, __ATOMIC_RELAXED)))
+    {
+        /* nothing of ours is pending */
+        return 0;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    if (wal->sync != WAL_SYNC_INTERVAL)
+    {
+        /* whoever finds nobody writing writes for everybody */
+        while (!wal->error && wal->written < t_lsn)
+        {
+            if (!wal->flushing)
+            {
+                wal_flush(wal, wal->sync == WAL_SYNC_ALWAYS);
+            }
+            else
+            {
+                pthread_cond_wait(&wal->done, &wal->lock);
+            }
+        }
+    }
+    ret = wal->error ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int wal_close(wal_t *wal)
+{
+    TRACE_PRINT();
+    int ret;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = 1;
+    pthread_cond_signal(&wal->tick);
+    pthread_mutex_unlock(&wal->lock);
+    if (wal->has_syncer)
+    {
+        pthread_join(wal->syncer, NULL);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->flushing)
+    {
+        pthread_cond_wait(&wal->done, &wal->lock);
+    }
+    if (wal->len > 0)
+    {
+        wal_flush(wal, wal->sync != WAL_SYNC_NEVER);
+    }
+    ret = wal->error ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    printf("Log: %lu records, %lu writes, %lu syncs\n",
+           wal->records, wal->writes, wal->syncs);
+
+    if (close(wal->fd) < 0)
+    {
+        ret = -1;
+    }
+    pthread_cond_destroy(&wal->tick);
+    pthread_cond_destroy(&wal->done);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buf);
+    free(wal->out);
+    free(wal);
+
+    return ret;
+}
@@ -0,0 +1,68 @@
+/*---------------------------------------------------------------------------*/
+/* wal.h                                                                     */
+/* Append-only write-ahead log with group commit                             */
+/*---------------------------------------------------------------------------*/
+#ifndef _WAL_H
+#define _WAL_H
+/*---------------------------------------------------------------------------*/
+#include "hashtable.h"
+/*---------------------------------------------------------------------------*/
+/* when appended records reach the disk */
+enum WAL_SYNC
+{
+    WAL_SYNC_ALWAYS,    // written and fdatasync()ed before wal_commit returns
+    WAL_SYNC_INTERVAL,  // written and fdatasync()ed every interval_ms
+    WAL_SYNC_NEVER,     // written before wal_commit returns, never synced
+};
+/* default interval of WAL_SYNC_INTERVAL */
+#define WAL_SYNC_MS 1000
+/* bytes read at once while replaying */
+#define WAL_READ_SIZE (1 << 20)
+/*---------------------------------------------------------------------------*/
+typedef struct wal wal_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * opens or creates the log at path. with WAL_SYNC_INTERVAL, a thread
+ * syncs the log every interval_ms milliseconds.
+ * returns NULL when any internal errors occur.
+ */
+wal_t *wal_open(const char *path, int sync, int interval_ms);
+/*---------------------------------------------------------------------------*/
+/**
+ * applies every record of the log to table, in order. a torn or corrupt
+ * record ends the log; it and everything behind it are cut off.
+ * call it before the write hook is set, and before any other thread
+ * uses the table.
+ * returns -1 when any internal errors occur.
+ * returns the number of applied records on success.
+ */
+long wal_replay(wal_t *wal, hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * appends a record of a write to the log buffer. it never blocks on I/O.
+ * it is a hash_write_hook_t with the log as arg, so the table calls it
+ * under the lock of the key, and the records of one key keep their order.
+ */
+void wal_append(void *wal, int op, const char *key, const char *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * makes the records appended by the calling thread as durable as the
+ * sync policy promises. threads committing at the same time share one
+ * write() and one fdatasync(): the first one writes everything appended
+ * so far, and the others wait for it or write what came meanwhile.
+ * call it after the locks of the table are released, before the writes
+ * are acknowledged.
+ * returns -1 when any internal errors occur, e.g. a failed write.
+ * returns 0 on success.
+ */
+int wal_commit(wal_t *wal);
+/*---------------------------------------------------------------------------*/
+/**
+ * writes and syncs what is left, prints the counters of the log,
+ * and closes it.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int wal_close(wal_t *wal);
+/*---------------------------------------------------------------------------*/
+#endif // _WAL_H
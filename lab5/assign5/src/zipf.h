@@ -0,0 +1,105 @@
+/*---------------------------------------------------------------------------*/
+/* zipf.h                                                                    */
+/* Key distributions of the benchmarks                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _ZIPF_H
+#define _ZIPF_H
+/*---------------------------------------------------------------------------*/
+#include <math.h>
+#include <stdint.h>
+/*---------------------------------------------------------------------------*/
+/* keys 0 to n - 1, uniform when theta is 0, otherwise zipf with skew
+ * theta, below 1. the constants are those of Gray et al., "Quickly
+ * generating billion-record synthetic databases", as used by YCSB. */
+struct zipf
+{
+    unsigned long n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+    double half;                // 1 + 0.5^theta
+};
+/*---------------------------------------------------------------------------*/
+/* xorshift64*, state must not be 0 */
+static inline uint64_t
+zipf_rng(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+/*---------------------------------------------------------------------------*/
+/* the finalizer of splitmix64 */
+static inline uint64_t
+zipf_mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+
+    return x;
+}
+/*---------------------------------------------------------------------------*/
+/* takes O(n) for the zeta constant */
+static inline void
+zipf_init(struct zipf *z, unsigned long n, double theta)
+{
+    unsigned long i;
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    if (theta == 0)
+    {
+        return;
+    }
+    for (i = 1; i <= n; i++)
+    {
+        z->zetan += 1.0 / pow((double)i, theta);
+    }
+    z->half = 1.0 + pow(0.5, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - z->half / z->zetan);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the next key. the ranks are spread over the keys by a hash,
+ * since the hottest keys would otherwise sit next to each other. */
+static inline unsigned long
+zipf_next(const struct zipf *z, uint64_t *state)
+{
+    uint64_t r = zipf_rng(state);
+    double u, uz;
+    unsigned long rank;
+
+    if (z->theta == 0)
+    {
+        return r % z->n;
+    }
+
+    u = (r >> 11) * (1.0 / 9007199254740992.0);
+    uz = u * z->zetan;
+    if (uz < 1.0)
+    {
+        rank = 0;
+    }
+    else if (uz < z->half)
+    {
+        rank = 1;
+    }
+    else
+    {
+        rank = z->n * pow(z->eta * u - z->eta + 1.0, z->alpha);
+    }
+
+    return zipf_mix64(rank) % z->n;
+}
+/*---------------------------------------------------------------------------*/
+#endif // _ZIPF_H
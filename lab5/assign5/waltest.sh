@@ -0,0 +1,157 @@
+#!/bin/bash
+
+# Checks that the write-ahead log survives kill -9: the writes acknowledged
+# before the kill are replayed, and a torn record at the end of the log is
+# cut off on startup.
+# Run it where ./server was built; it starts the server in each I/O mode.
+
+# Default port number
+PORT=8080
+# I/O modes of the server: blocking, epoll (-e) and io_uring (-u)
+MODES=("" "-e" "-u")
+
+# Parse arguments for port number and server options (optional)
+while getopts "p:o:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        o) MODES=("$OPTARG") ;;
+        *) echo "Usage: $0 [-p port] [-o server_options]"; exit 1 ;;
+    esac
+done
+
+# Initialize output directory
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR  # Delete the directory if it exists
+fi
+mkdir -p $OUTPUT_DIR    # Create a new directory
+WAL="$OUTPUT_DIR/wal.log"
+
+# Before the kill: writes that are acknowledged, so they must be logged
+WRITES="CREATE wal1 a\nCREATE wal2 b\nUPDATE wal1 c\nDELETE wal2\nCREATE wal3 d\n"
+WRITES_RESPONSES=(
+    "CREATE OK"
+    "CREATE OK"
+    "UPDATE OK"
+    "DELETE OK"
+    "CREATE OK"
+)
+# After the replay: the state the writes left, then one more write
+REPLAY="READ wal1\nREAD wal2\nREAD wal3\nCREATE wal4 e\n"
+REPLAY_RESPONSES=(
+    "c"
+    "NOT FOUND"
+    "d"
+    "CREATE OK"
+)
+# After the second replay: the write made behind the truncated tail
+AFTER="READ wal1\nREAD wal3\nREAD wal4\n"
+AFTER_RESPONSES=(
+    "c"
+    "d"
+    "e"
+)
+# A torn tail: the start of a record whose rest never reached the file
+TORN="\x01\x00\x04\x00\x00\x00\x10wal5"
+
+# Function to start the server with the given options and wait for it
+start_server() {
+    ./server -p $PORT "$@" >> "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo -e "\033[31mError: server did not start with '$*'\033[0m"
+    return 1
+}
+
+# Function to kill the server without letting it shut down. io_uring
+# closes the listening socket of a killed process a little later, so
+# wait until the port is free.
+crash_server() {
+    kill -9 $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    for _ in $(seq 50); do
+        if ! (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+}
+
+# Function to send commands in one write and read n responses into a file
+request() {
+    local cmds=$1 n=$2 file=$3 line
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf "$cmds" >&3
+    : > "$file"
+    for ((j = 0; j < n; j++)); do
+        read -t 2 -r line <&3 || break
+        echo "$line" >> "$file"
+    done
+    exec 3<&-
+}
+
+# Function to compare a response file with the expected responses in order
+check_responses() {
+    local file=$1
+    shift
+    local expected
+    expected=$(printf "%s\n" "$@")
+    if [[ "$(cat "$file")" != "$expected" ]]; then
+        echo -e "\033[31mError: responses in $file differ from the expected ones\033[0m"
+        diff <(echo "$expected") "$file"
+        return 1
+    fi
+    return 0
+}
+
+echo "=== Starting Requests and Responses ==="
+
+for mode in "${MODES[@]}"; do
+    echo "Server mode: '${mode:-blocking}'"
+    out="$OUTPUT_DIR/mode${mode}"
+    rm -f "$WAL"
+
+    start_server -w "$WAL" $mode || exit 1
+    request "$WRITES" ${#WRITES_RESPONSES[@]} "$out.writes.log"
+    crash_server
+
+    # Tear the tail, then expect the replay to cut it off again
+    size=$(stat -c %s "$WAL")
+    printf "$TORN" >> "$WAL"
+    start_server -w "$WAL" $mode || exit 1
+    truncated=$(stat -c %s "$WAL")
+    request "$REPLAY" ${#REPLAY_RESPONSES[@]} "$out.replay.log"
+    crash_server
+
+    start_server -w "$WAL" $mode || exit 1
+    request "$AFTER" ${#AFTER_RESPONSES[@]} "$out.after.log"
+    crash_server
+
+    echo "=== Verifying Responses ==="
+    check_responses "$out.writes.log" "${WRITES_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: writes in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    check_responses "$out.replay.log" "${REPLAY_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: replay after kill -9 in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    if [[ $truncated -ne $size ]]; then
+        echo -e "\033[31mError: the log is $truncated bytes after the replay, not $size\033[0m"
+        echo -e "\033[31mTest Failed: torn tail in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    fi
+    check_responses "$out.after.log" "${AFTER_RESPONSES[@]}" || {
+        echo -e "\033[31mTest Failed: writes after the torn tail in mode '${mode:-blocking}'\033[0m"
+        exit 1
+    }
+    echo "Responses in mode '${mode:-blocking}' verified successfully."
+done
+
+echo -e "\033[32mTest Passed: All conditions satisfied.\033[0m"
+exit 0